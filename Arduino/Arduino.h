@@ -8,6 +8,11 @@
 
 #define F(s) s
 
+// Program memory is ordinary memory on the host.
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+#define memcpy_P memcpy
+
 typedef unsigned char byte;
 
 enum PinState {LOW = 0, HIGH = 1};
@@ -16,6 +21,7 @@ enum PinMode {OUTPUT, INPUT, INPUT_PULLUP};
 enum AnaloguePins {A0 = 20, A1, A2, A3, A4, A5, A6};
 
 unsigned long millis();
+unsigned long micros();
 void delay(unsigned int);
 byte highByte(unsigned int);
 byte lowByte(unsigned int);
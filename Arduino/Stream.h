@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 struct ENDL_T;
 
 class Stream
@@ -10,8 +12,10 @@ public:
 
   virtual operator bool();
   virtual void begin(int);
-  virtual bool available();
+  virtual int available();
   virtual char read();
+  virtual int availableForWrite();
+  virtual size_t write(const char *, size_t);
   virtual void print(const char *);
   virtual void println(const char *);
   virtual void flush();
@@ -0,0 +1,55 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+// Convert an MDF JSON file to a compressed C array in program memory for MdfService.
+// Usage: mdfToProgmem file.json [arrayName] > ModuleDataFile.h
+
+#include <stdio.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "Compression.h"
+
+int main(int argc, const char * const * argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s file.json [arrayName]\n", argv[0]);
+    return 1;
+  }
+  std::string name = argc > 2 ? argv[2] : "moduleDataFile";
+
+  std::ifstream in(argv[1], std::ios::binary);
+  if (!in)
+  {
+    fprintf(stderr, "Cannot read %s\n", argv[1]);
+    return 1;
+  }
+  std::vector<byte> json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+  // Keep the JSON as it is if it does not compress.
+  std::vector<byte> data(json.size());
+  data.resize(VLCB::compress(json.data(), json.size(), data.data(), data.size()));
+  const char *format = "VLCB::MDF_FORMAT_COMPRESSED_JSON";
+  if (data.empty())
+  {
+    data = json;
+    format = "VLCB::MDF_FORMAT_JSON";
+  }
+
+  printf("// Generated by mdfToProgmem from %s: %u bytes stored as %u bytes.\n",
+         argv[1], (unsigned int)json.size(), (unsigned int)data.size());
+  printf("#pragma once\n\n");
+  printf("#include <MdfService.h>\n\n");
+  printf("const VLCB::MdfFormat %sFormat = %s;\n", name.c_str(), format);
+  printf("const byte %s[] PROGMEM = {", name.c_str());
+  for (size_t i = 0; i < data.size(); ++i)
+  {
+    printf("%s0x%02X%s", i % 16 == 0 ? "\n  " : "", data[i], i + 1 < data.size() ? "," : "");
+  }
+  printf("\n};\n");
+  return 0;
+}
@@ -0,0 +1,32 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#pragma once
+
+#include "Clock.h"
+
+namespace VLCB
+{
+
+// A clock that only moves when told to.
+// Use it to run nodes faster than real time, e.g. to skip over long timeouts
+// or to run many nodes in one process with a shared notion of time.
+class SimulatedClock : public Clock
+{
+public:
+  explicit SimulatedClock(unsigned long startMicros = 0) : now(startMicros) {}
+
+  virtual unsigned long getMillis() override { return now / 1000; }
+  virtual unsigned long getMicros() override { return now; }
+
+  void advanceMicros(unsigned long micros) { now += micros; }
+  void advanceMillis(unsigned long millis) { now += millis * 1000; }
+  void setMicros(unsigned long micros) { now = micros; }
+
+private:
+  unsigned long now;
+};
+
+}
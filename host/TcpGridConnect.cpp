@@ -0,0 +1,311 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#include "TcpGridConnect.h"
+#include "GridConnect.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// Writing to a closed connection shall return an error instead of raising SIGPIPE.
+// Linux has a send flag for this. macOS has a socket option instead, set on each client.
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
+#else
+#define SEND_FLAGS MSG_DONTWAIT
+#endif
+
+//
+// Class to transfer CAN frames using the GridConnect protocol over TCP
+//
+// see GridConnect.cpp for more details on this protocol
+
+namespace VLCB
+{
+
+// grid connect should be 28 characters maximum
+static const size_t MAX_MESSAGE_LENGTH = 30;
+
+static bool setNonBlocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+TcpGridConnect::~TcpGridConnect()
+{
+  end();
+}
+
+bool TcpGridConnect::begin()
+{
+  end();
+  receivedCount = 0;
+  transmitCount = 0;
+
+  listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenSocket < 0)
+  {
+    return false;
+  }
+  int yes = 1;
+  setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  socklen_t addressLength = sizeof(address);
+  if (bind(listenSocket, (sockaddr *)&address, sizeof(address)) != 0
+      || listen(listenSocket, 4) != 0
+      || !setNonBlocking(listenSocket)
+      || getsockname(listenSocket, (sockaddr *)&address, &addressLength) != 0)
+  {
+    end();
+    return false;
+  }
+  port = ntohs(address.sin_port);
+  return true;
+}
+
+void TcpGridConnect::end()
+{
+  for (Client & client : clients)
+  {
+    close(client.socket);
+  }
+  clients.clear();
+  if (listenSocket >= 0)
+  {
+    close(listenSocket);
+    listenSocket = -1;
+  }
+}
+
+//
+/// accept new clients, move data to and from all clients
+/// return true if one or more frames are ready
+//
+bool TcpGridConnect::available()
+{
+  acceptClients();
+
+  for (size_t i = 0; i < clients.size(); )
+  {
+    if (readClient(clients[i]) && writeClient(clients[i]))
+    {
+      ++i;
+    }
+    else
+    {
+      close(clients[i].socket);
+      clients.erase(clients.begin() + i);
+    }
+  }
+
+  // Frames forwarded between clients may have been queued while reading.
+  for (Client & client : clients)
+  {
+    writeClient(client);
+  }
+
+  return rxQueue.available();
+}
+
+//
+/// get the next available CANMessage
+/// must call available first to ensure there is something to get
+//
+CANFrame TcpGridConnect::getNextCanFrame()
+{
+  return rxQueue.pop();
+}
+
+//
+/// send a CANMessage message in GridConnect format to all clients
+//
+bool TcpGridConnect::sendCanFrame(CANFrame *frame)
+{
+  transmitCount++;
+  char message[MAX_MESSAGE_LENGTH];
+  if (!encodeGridConnect(message, frame))
+  {
+    transmitErrorCount++;
+    return false;
+  }
+  for (Client & client : clients)
+  {
+    queueOutput(client, message);
+    writeClient(client);
+  }
+  return true;
+}
+
+void TcpGridConnect::reset()
+{
+  rxQueue.clear();
+  for (Client & client : clients)
+  {
+    client.input.clear();
+    client.output.clear();
+  }
+}
+
+unsigned int TcpGridConnect::transmitBufferUsage()
+{
+  unsigned int usage = 0;
+  for (const Client & client : clients)
+  {
+    if (client.output.size() > usage)
+    {
+      usage = client.output.size();
+    }
+  }
+  return usage;
+}
+
+void TcpGridConnect::acceptClients()
+{
+  if (listenSocket < 0)
+  {
+    return;
+  }
+  int clientSocket;
+  while ((clientSocket = accept(listenSocket, nullptr, nullptr)) >= 0)
+  {
+    if (!setNonBlocking(clientSocket))
+    {
+      close(clientSocket);
+      continue;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(clientSocket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    clients.push_back({clientSocket, "", ""});
+  }
+}
+
+//
+// read what the client has sent and parse it
+// returns false if the connection is closed
+//
+bool TcpGridConnect::readClient(Client & client)
+{
+  // Leave data in the socket while decoded frames are waiting to be read.
+  while (rxQueue.bufUse() < TCP_RX_FRAME_QUEUE_SIZE)
+  {
+    char buffer[256];
+    ssize_t count = recv(client.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (count == 0)
+    {
+      return false;
+    }
+    if (count < 0)
+    {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    client.input.append(buffer, count);
+    parseInput(client);
+  }
+  return true;
+}
+
+//
+// extract complete messages from the client's input
+// each decoded frame is queued for the node and passed on to the other clients
+//
+void TcpGridConnect::parseInput(Client & client)
+{
+  while (rxQueue.bufUse() < TCP_RX_FRAME_QUEUE_SIZE)
+  {
+    size_t end = client.input.find(';');
+    if (end == std::string::npos)
+    {
+      // keep a partial message, but discard anything that cannot be a message
+      size_t start = client.input.rfind(':');
+      if (start == std::string::npos || client.input.size() - start >= MAX_MESSAGE_LENGTH)
+      {
+        client.input.clear();
+      }
+      else
+      {
+        client.input.erase(0, start);
+      }
+      return;
+    }
+    // the message starts at the last 'start of message' before the 'end of message'
+    size_t start = client.input.rfind(':', end);
+    if (start == std::string::npos || end - start + 1 >= MAX_MESSAGE_LENGTH)
+    {
+      client.input.erase(0, end + 1);
+      continue;
+    }
+    char message[MAX_MESSAGE_LENGTH];
+    size_t length = end - start + 1;
+    for (size_t i = 0; i < length; ++i)
+    {
+      message[i] = toupper(client.input[start + i]);
+    }
+    message[length] = '\0';
+    client.input.erase(0, end + 1);
+
+    receivedCount++;
+    CANFrame frame;
+    if (!decodeGridConnect(message, &frame))
+    {
+      receiveErrorCount++;
+      continue;
+    }
+    rxQueue.put(frame);
+    for (Client & other : clients)
+    {
+      if (&other != &client)
+      {
+        queueOutput(other, message);
+      }
+    }
+  }
+}
+
+void TcpGridConnect::queueOutput(Client & client, const char * text)
+{
+  if (client.output.size() >= TCP_TX_PENDING_LIMIT)
+  {
+    // client is not reading, drop the frame for this client
+    transmitErrorCount++;
+    return;
+  }
+  client.output += text;
+  if (client.output.size() > transmitPeak)
+  {
+    transmitPeak = client.output.size();
+  }
+}
+
+//
+// write as much pending output as the socket accepts without blocking
+// returns false if the connection is broken
+//
+bool TcpGridConnect::writeClient(Client & client)
+{
+  while (!client.output.empty())
+  {
+    ssize_t count = send(client.socket, client.output.data(), client.output.size(), SEND_FLAGS);
+    if (count < 0)
+    {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    client.output.erase(0, count);
+  }
+  return true;
+}
+
+}
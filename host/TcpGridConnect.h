@@ -0,0 +1,94 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <Arduino.h>
+#include <CanTransport.h>
+#include <CircularBuffer.h>
+#include <vlcbdefs.hpp>
+
+namespace VLCB
+{
+
+// number of decoded frames waiting to be read
+static const int TCP_RX_FRAME_QUEUE_SIZE = 16;
+// max number of characters waiting to be sent to a client before frames are dropped
+static const unsigned int TCP_TX_PENDING_LIMIT = 4096;
+
+/// @brief CAN transport that serves the GridConnect protocol over TCP on the host.
+///
+/// Listens on a TCP port on the loopback interface and accepts any number of client
+/// connections. Frames received from one client are passed on to the VLCB node and
+/// to all other clients as if they were on the same CAN bus.
+/// Frames sent by the VLCB node go to all clients.
+///
+/// All socket operations are non-blocking.
+/// Call available() regularly, which CanService does, to accept new clients and move data.
+class TcpGridConnect : public CanTransport
+{
+public:
+  /// Use port 0 to let the operating system pick a free port. See getPort().
+  explicit TcpGridConnect(uint16_t port = 5550) : port(port) {}
+  virtual ~TcpGridConnect();
+
+  /// Start listening for clients. Returns false if the port cannot be opened.
+  bool begin();
+  /// Close the listening socket and all client connections.
+  void end();
+
+  /// The port that is listened on.
+  uint16_t getPort() const { return port; }
+  unsigned int getClientCount() const { return clients.size(); }
+
+  /// @cond LIBRARY
+  virtual bool available() override;
+  virtual CANFrame getNextCanFrame() override;
+  virtual bool sendCanFrame(CANFrame *frame) override;
+  virtual void reset() override;
+  virtual byte getHardwareType() override { return CAN_HW_SERIAL; };
+
+  virtual unsigned int receiveCounter() override { return receivedCount; }
+  virtual unsigned int transmitCounter() override { return transmitCount; }
+  virtual unsigned int receiveBufferSize() override { return TCP_RX_FRAME_QUEUE_SIZE; }
+  virtual unsigned int transmitBufferSize() override { return TCP_TX_PENDING_LIMIT; }
+  virtual unsigned int receiveErrorCounter() override { return receiveErrorCount; }
+  virtual unsigned int transmitErrorCounter() override { return transmitErrorCount; }
+  virtual unsigned int receiveBufferUsage() override { return rxQueue.bufUse(); };
+  virtual unsigned int transmitBufferUsage() override;
+  virtual unsigned int receiveBufferPeak() override { return rxQueue.getHighWaterMark(); };
+  virtual unsigned int transmitBufferPeak() override { return transmitPeak; };
+  virtual unsigned int errorStatus() override { return 0; }
+  /// @endcond
+
+private:
+  struct Client
+  {
+    int socket;
+    std::string input;   // Received characters not yet parsed
+    std::string output;  // Characters not yet accepted by the socket
+  };
+
+  uint16_t port;
+  int listenSocket = -1;
+  std::vector<Client> clients;
+  CircularBuffer<CANFrame, TCP_RX_FRAME_QUEUE_SIZE> rxQueue;
+
+  unsigned int receivedCount = 0;
+  unsigned int transmitCount = 0;
+  unsigned int receiveErrorCount = 0;
+  unsigned int transmitErrorCount = 0;
+  unsigned int transmitPeak = 0;
+
+  void acceptClients();
+  bool readClient(Client & client);
+  void parseInput(Client & client);
+  void queueOutput(Client & client, const char * text);
+  bool writeClient(Client & client);
+};
+
+}
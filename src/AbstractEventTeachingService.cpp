@@ -67,7 +67,7 @@ void AbstractEventTeachingService::handleMessage(const VlcbMessage *msg)
 
   case OPC_NERD:
     // 57 - request for all stored events
-    handleReadEvents(nn);
+    handleReadEvents(msg, nn);
     break;
 
   case OPC_REVAL:
@@ -218,6 +218,22 @@ class RespondEvents : public TimedResponse::Task
 private:
   Configuration *module_config;
   VlcbMessage msg;
+  byte eventIndex = 0; // Next event table index to look at.
+
+  // Move eventIndex to the next used event slot using the in-RAM event hash table.
+  // Returns false if there are no more used slots.
+  bool findNextEvent()
+  {
+    while (eventIndex < module_config->getNumEvents())
+    {
+      if (module_config->getEvTableEntry(eventIndex) != 0)
+      {
+        return true;
+      }
+      ++eventIndex;
+    }
+    return false;
+  }
 
 public:
   RespondEvents(Controller * controller, Configuration *module_config, int nodeNumber)
@@ -231,24 +247,25 @@ public:
   
   TimedResponse::Result runStep() override
   {
-    if (sequence >= module_config->getNumEvents())
+    // Empty slots are skipped so that each step sends a response.
+    if (!findNextEvent())
     {
       return TimedResponse::FINISHED;
     }
-    if (module_config->getEvTableEntry(sequence) != 0)
-    {
-      // it's a valid stored event
-      // read the event data from EEPROM
-      // construct and send a ENRSP message
-      module_config->readEvent(sequence, &msg.data[3]);
-      msg.data[7] = sequence;  // event table index
-      controller->sendMessage(&msg);
-    }
-    return TimedResponse::PROGRESS;
+
+    // it's a valid stored event
+    // read the event data from EEPROM
+    // construct and send a ENRSP message
+    module_config->readEvent(eventIndex, &msg.data[3]);
+    msg.data[7] = eventIndex;  // event table index
+    controller->sendMessage(&msg);
+
+    ++eventIndex;
+    return findNextEvent() ? TimedResponse::PROGRESS : TimedResponse::FINISHED;
   }
 };
 
-void AbstractEventTeachingService::handleReadEvents(unsigned int nn)
+void AbstractEventTeachingService::handleReadEvents(const VlcbMessage *msg, unsigned int nn)
 {
   //DEBUG_SERIAL << F("ets> NERD : request all stored events for nn = ") << nn << endl;
 
@@ -257,9 +274,13 @@ void AbstractEventTeachingService::handleReadEvents(unsigned int nn)
     return;
   }
 
-  controller->messageActedOn();
+  if (!controller->addTimedResponseTask<RespondEvents>(controller, controller->getModuleConfig(), nn))
+  {
+    controller->deferRequest(this, msg);
+    return;
+  }
 
-  controller->addTimedResponseTask(new RespondEvents(controller, controller->getModuleConfig(), nn));
+  controller->messageActedOn();
 }
 
 class RespondEventVar : public TimedResponse::Task
@@ -328,12 +349,15 @@ void AbstractEventTeachingService::handleReadEventVariable(const VlcbMessage *ms
 
   if (evnum == 0)
   {
-    // Return number of EVs. This may be dynamic in other implementations.
-    controller->sendMessageWithNN(OPC_NEVAL, eventIndex, evnum, module_config->getNumEVs());
-    if (!module_config->fcuCompatible)
+    // The task is added before the first response so that nothing is sent if the request is deferred.
+    if (!module_config->fcuCompatible
+        && !controller->addTimedResponseTask<RespondEventVar>(controller, eventIndex, module_config->getNumEVs()))
     {
-      controller->addTimedResponseTask(new RespondEventVar(controller, eventIndex, module_config->getNumEVs()));
+      controller->deferRequest(this, msg);
+      return;
     }
+    // Return number of EVs. This may be dynamic in other implementations.
+    controller->sendMessageWithNN(OPC_NEVAL, eventIndex, evnum, module_config->getNumEVs());
   }
   else
   {
@@ -43,7 +43,7 @@ private:
   void handleUnlearnEvent(const VlcbMessage *msg, unsigned int nn);
   void handleUnlearn(unsigned int nn);
   void handleRequestEventCount(unsigned int nn);
-  void handleReadEvents(unsigned int nn);
+  void handleReadEvents(const VlcbMessage *msg, unsigned int nn);
   void handleReadEventVariable(const VlcbMessage *msg, unsigned int nn);
   void handleClearEvents(unsigned int nn);
   void handleGetFreeEventSlots(unsigned int nn);
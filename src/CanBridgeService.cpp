@@ -0,0 +1,131 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#include "CanBridgeService.h"
+#include "Controller.h"
+
+namespace VLCB
+{
+
+CanBridgeService::CanBridgeService(CanTransport * a, CanTransport * b)
+{
+  links[A_TO_B].from = a;
+  links[A_TO_B].to = b;
+  links[B_TO_A].from = b;
+  links[B_TO_A].to = a;
+  for (Link & link : links)
+  {
+    link.forwarded = 0;
+    link.filtered = 0;
+    link.suppressed = 0;
+  }
+  for (RecentFrame & recent : recentFrames)
+  {
+    recent.valid = false;
+  }
+}
+
+void CanBridgeService::process()
+{
+  // Send what is already queued first so that frames keep their order.
+  sendQueuedFrames(links[A_TO_B]);
+  sendQueuedFrames(links[B_TO_A]);
+
+  readFrames(A_TO_B);
+  readFrames(B_TO_A);
+
+  sendQueuedFrames(links[A_TO_B]);
+  sendQueuedFrames(links[B_TO_A]);
+}
+
+void CanBridgeService::readFrames(Direction direction)
+{
+  Link & link = links[direction];
+  unsigned long now = controller->getClock()->getMillis();
+  for (byte count = 0; count < CAN_BRIDGE_RX_FRAMES_PER_PROCESS && link.from->available(); ++count)
+  {
+    CANFrame frame = link.from->getNextCanFrame();
+
+    if (filterFunc && !filterFunc(direction, frame))
+    {
+      ++link.filtered;
+      continue;
+    }
+
+    if (loopWindow > 0)
+    {
+      unsigned int hash = hashFrame(frame);
+      if (isRecentFrame(hash, now))
+      {
+        ++link.suppressed;
+        continue;
+      }
+      rememberFrame(hash, now);
+    }
+
+    // Oldest frame is dropped if the receiving side has not kept up.
+    link.queue.put(frame);
+  }
+}
+
+void CanBridgeService::sendQueuedFrames(Link & link)
+{
+  while (link.queue.available())
+  {
+    if (!link.to->sendCanFrame(link.queue.peek()))
+    {
+      // Receiving side is busy. Try again next time.
+      return;
+    }
+    link.queue.pop();
+    ++link.forwarded;
+  }
+}
+
+// FNV-1a hash of the parts of the frame that are sent on the bus, folded to 16 bits.
+unsigned int CanBridgeService::hashFrame(const CANFrame & frame)
+{
+  uint32_t hash = 2166136261UL;
+  auto add = [&hash](byte b)
+  {
+    hash ^= b;
+    hash *= 16777619UL;
+  };
+  add(frame.id);
+  add(frame.id >> 8);
+  add(frame.id >> 16);
+  add(frame.id >> 24);
+  add(frame.ext);
+  add(frame.rtr);
+  add(frame.len);
+  for (byte i = 0; i < frame.len && i < 8; ++i)
+  {
+    add(frame.data[i]);
+  }
+  return (hash >> 16) ^ (hash & 0xFFFF);
+}
+
+// Check if the frame has been forwarded recently. A matching entry is forgotten so
+// that only one echo is suppressed for each forwarded frame.
+bool CanBridgeService::isRecentFrame(unsigned int hash, unsigned long now)
+{
+  for (RecentFrame & recent : recentFrames)
+  {
+    if (recent.valid && recent.hash == hash && now - recent.time < loopWindow)
+    {
+      recent.valid = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+void CanBridgeService::rememberFrame(unsigned int hash, unsigned long now)
+{
+  recentFrames[recentNext] = {true, hash, now};
+  recentNext = (recentNext + 1) % CAN_BRIDGE_RECENT_FRAMES;
+}
+
+}
@@ -0,0 +1,115 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#pragma once
+
+#include "Service.h"
+#include "CanTransport.h"
+#include "CircularBuffer.h"
+#include <vlcbdefs.hpp>
+
+namespace VLCB
+{
+
+// Number of frames that can wait in each direction for the receiving side to accept them.
+const int CAN_BRIDGE_QUEUE_SIZE = 8;
+// Max number of frames to read from each side in each call to process().
+const byte CAN_BRIDGE_RX_FRAMES_PER_PROCESS = 4;
+// Number of recently forwarded frames remembered for loop suppression.
+const byte CAN_BRIDGE_RECENT_FRAMES = 8;
+// Default time in milliseconds that a forwarded frame is remembered.
+const unsigned int CAN_BRIDGE_LOOP_WINDOW = 50;
+
+/// @brief Service that forwards CAN frames between two CAN transports.
+///
+/// Use this to build a bridge such as CANCAN that splits a large layout into
+/// several CAN buses, or to connect a CAN bus to a serial GridConnect link.
+///
+/// Frames are forwarded unchanged in both directions. Each direction has its own
+/// queue for frames that the receiving transport cannot accept yet.
+/// An optional filter function decides which frames are forwarded.
+///
+/// A frame that is identical to a frame forwarded within the loop suppression window
+/// is not forwarded again. This stops echoes from transports that return sent frames
+/// and stops frames circulating when bridges form a loop.
+/// Identical frames sent within the window, such as a repeated event, are also
+/// suppressed. Use a short window or disable it if this is a problem.
+///
+/// The bridge owns both transports. Do not use them with a CanService as well.
+class CanBridgeService : public Service
+{
+public:
+  /// Direction of forwarding. Used with filters and statistics.
+  enum Direction : byte
+  {
+    A_TO_B = 0,
+    B_TO_A = 1
+  };
+
+  CanBridgeService(CanTransport * a, CanTransport * b);
+
+  /// Set a function that decides if a frame shall be forwarded.
+  /// The function returns true to forward the frame.
+  /// Use frame.data[0] to filter by op-code, or the node and event numbers for events.
+  void setFilter(bool (*func)(Direction direction, const CANFrame & frame)) { filterFunc = func; }
+
+  /// Set how long in milliseconds a forwarded frame is remembered for loop suppression.
+  /// A window of 0 disables loop suppression.
+  void setLoopSuppressionWindow(unsigned int millis) { loopWindow = millis; }
+
+  /// Number of frames passed on to the receiving transport.
+  unsigned int getForwardedCount(Direction direction) const { return links[direction].forwarded; }
+  /// Number of frames rejected by the filter.
+  unsigned int getFilteredCount(Direction direction) const { return links[direction].filtered; }
+  /// Number of frames dropped as echoes or loops.
+  unsigned int getSuppressedCount(Direction direction) const { return links[direction].suppressed; }
+  /// Number of frames dropped because the queue was full.
+  unsigned int getDropCount(Direction direction) const { return links[direction].queue.getOverflows(); }
+  /// Number of frames waiting for the receiving transport.
+  unsigned int getQueueUsage(Direction direction) const { return links[direction].queue.bufUse(); }
+  /// Highest number of frames that have been waiting for the receiving transport.
+  unsigned int getQueuePeak(Direction direction) const { return links[direction].queue.getHighWaterMark(); }
+
+  /// @cond LIBRARY
+  virtual VlcbServiceTypes getServiceID() const override { return SERVICE_ID_NONE; }
+  virtual byte getServiceVersionID() const override { return 1; }
+
+  virtual void process() override;
+  /// @endcond
+
+private:
+  struct Link
+  {
+    CanTransport * from;
+    CanTransport * to;
+    CircularBuffer<CANFrame, CAN_BRIDGE_QUEUE_SIZE> queue;
+    unsigned int forwarded;
+    unsigned int filtered;
+    unsigned int suppressed;
+  };
+
+  struct RecentFrame
+  {
+    bool valid;
+    unsigned int hash;
+    unsigned long time;
+  };
+
+  void readFrames(Direction direction);
+  void sendQueuedFrames(Link & link);
+  static unsigned int hashFrame(const CANFrame & frame);
+  bool isRecentFrame(unsigned int hash, unsigned long now);
+  void rememberFrame(unsigned int hash, unsigned long now);
+
+  Link links[2];
+
+  bool (*filterFunc)(Direction direction, const CANFrame & frame) = nullptr;
+
+  unsigned int loopWindow = CAN_BRIDGE_LOOP_WINDOW;
+  RecentFrame recentFrames[CAN_BRIDGE_RECENT_FRAMES];
+  byte recentNext = 0;
+};
+
+}
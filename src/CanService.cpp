@@ -13,6 +13,51 @@ namespace VLCB
 
 const int DEFAULT_PRIORITY = 0xB;     // default Controller messages priority. 1011 = 2|3 = normal/low
 
+byte getDefaultCanPriority(byte opCode)
+{
+  switch (opCode)
+  {
+    // Emergency and track control.
+    case OPC_HLT:
+    case OPC_BON:
+    case OPC_TOF:
+    case OPC_TON:
+    case OPC_ESTOP:
+    case OPC_ARST:
+    case OPC_RTOF:
+    case OPC_RTON:
+    case OPC_RESTP:
+      return CAN_PRIORITY_HIGH;
+
+    // DCC and throttle traffic. Loco control must not wait behind layout traffic.
+    case OPC_KLOC: case OPC_QLOC: case OPC_DKEEP:
+    case OPC_RLOC: case OPC_QCON: case OPC_ALOC: case OPC_STMOD:
+    case OPC_PCON: case OPC_KCON: case OPC_DSPD: case OPC_DFLG:
+    case OPC_DFNON: case OPC_DFNOF: case OPC_DFUN: case OPC_GLOC:
+    case OPC_ERR: case OPC_PLOC:
+    case OPC_RDCC3: case OPC_RDCC4: case OPC_RDCC5: case OPC_RDCC6:
+      return CAN_PRIORITY_ABOVE;
+
+    // Accessory events and configuration requests use the default normal priority.
+    // They still win over bulk responses below.
+
+    // Responses that are sent in bulk, typically by TimedResponse.
+    case OPC_ENRSP:
+    case OPC_NEVAL:
+    case OPC_EVANS:
+    case OPC_PARAN:
+    case OPC_NVANS:
+    case OPC_SD:
+    case OPC_ESD:
+    case OPC_DGN:
+    case OPC_HEARTB:
+      return CAN_PRIORITY_LOW;
+
+    default:
+      return CAN_PRIORITY_NORMAL;
+  }
+}
+
 Service::Data CanService::getServiceData()
 {
   byte canType = canTransport->getHardwareType();
@@ -21,7 +66,9 @@ Service::Data CanService::getServiceData()
 
 void CanService::process()
 {
-  checkIncomingCanFrame();
+  retryQueuedCanFrames();
+
+  checkIncomingCanFrames();
 
   if (enumeration_required)
   {
@@ -93,7 +140,7 @@ void CanService::handleSetCANID(const VlcbMessage *msg, unsigned int nn)
     return;
   }
 
-  controller->getModuleConfig()->setCANID(newCANID);
+  changeCanId(newCANID);
   controller->sendWRACK();
   controller->sendGRSP(OPC_CANID, getServiceID(), GRSP_OK);
 }
@@ -147,7 +194,8 @@ void CanService::startCANenumeration(bool fromENUM)
 
   // set global variables
   bCANenum = true;                  // we are enumerating
-  CANenumTime = millis();           // the cycle start time
+  ++enumerationCount;
+  CANenumTime = controller->getClock()->getMillis();  // the cycle start time
   memset(enum_responses, 0, sizeof(enum_responses));
   startedFromEnumMessage = fromENUM;
 
@@ -156,46 +204,78 @@ void CanService::startCANenumeration(bool fromENUM)
   // DEBUG_SERIAL << F("> enumeration cycle initiated") << endl;
 }
 
-void CanService::checkIncomingCanFrame()
+void CanService::checkIncomingCanFrames()
 {
   // Check concrete transport for messages and put on controller action queue.
-  if (!canTransport->available())
+  readIncomingFrames([this]()
   {
-    return;
+    CANFrame canFrame = canTransport->getNextCanFrame();
+    return handleIncomingFrame(canFrame.id, canFrame.ext, canFrame.rtr, canFrame.len, canFrame.data);
+  });
+}
+
+unsigned long CanService::startReadingFrames()
+{
+  return controller->getClock()->getMicros();
+}
+
+bool CanService::mayReadFrame(byte count, unsigned long startTime)
+{
+  // Read several frames to keep up with a busy bus but leave room in the action queue
+  // for the incoming messages and any other actions they cause.
+  return count < maxRxFramesPerProcess
+         && canTransport->available()
+         && controller->getActionQueue().bufUse() < ACTION_QUEUE_SIZE / 2
+         && (count == 0 || controller->getClock()->getMicros() - startTime < rxTimeBudget);
+}
+
+void CanService::endReadingFrames(byte count, bool activity)
+{
+  rxFramesLastProcess = count;
+  if (count > rxFramesPeak)
+  {
+    rxFramesPeak = count;
+  }
+  if (activity)
+  {
+    // Indicate activity once for all frames read.
+    controller->indicateActivity();
   }
-  CANFrame canFrame = canTransport->getNextCanFrame();
+}
 
+// Returns true if the frame is a standard frame that shall be indicated as activity.
+bool CanService::handleIncomingFrame(uint32_t id, bool ext, bool rtr, byte len, const byte *data)
+{
   // is this an extended frame ? we currently ignore these as bootloader, etc data may confuse us !
-  if (canFrame.ext)
+  if (ext)
   {
-    return;
+    return false;
   }
 
   // is this a CANID enumeration request from another node (RTR set) ?
-  if (canFrame.rtr)
+  if (rtr)
   {
     // DEBUG_SERIAL << F("> CANID enumeration RTR from CANID = ") << remoteCANID << endl;
     // send an empty canFrame to show our CANID
 
     sendEmptyFrame();
 
-    return;
+    return false;
   }
 
-  controller->indicateActivity();
-
-  byte remoteCANID = getCANID(canFrame.id);
+  byte remoteCANID = getCANID(id);
 
   /// set flag if we find a CANID conflict with the frame's producer
   /// doesn't apply to RTR or zero-length frames, so as not to trigger an enumeration loop
-  if (remoteCANID == controller->getModuleCANID() && canFrame.len > 0)
+  if (remoteCANID == controller->getModuleCANID() && len > 0)
   {
     // DEBUG_SERIAL << F("> CAN id clash, enumeration required") << endl;
+    ++canIdConflicts;
     enumeration_required = true;
   }
 
   // are we enumerating CANIDs ?
-  if (bCANenum && canFrame.len == 0)
+  if (bCANenum && len == 0)
   {
     // store this response in the responses array
     if (remoteCANID > 0)
@@ -205,48 +285,171 @@ void CanService::checkIncomingCanFrame()
       // DEBUG_SERIAL << F("> stored CANID ") << remoteCANID << F(" at index = ") << (remoteCANID / 8) << F(", bit = ") << (remoteCANID % 8) << endl;
     }
 
-    return;
+    return true;
+  }
+
+  if (filterEnabled)
+  {
+    if (!isRelevantMessage(len, data))
+    {
+      ++filterDropped;
+      return true;
+    }
+    ++filterPassed;
   }
 
   // The incoming CAN frame is a VLCB message.
-  Action action = {ACT_MESSAGE_IN, {canFrame.len}};
-  memcpy(action.vlcbMessage.data, canFrame.data, canFrame.len);
+  Action action = {ACT_MESSAGE_IN, {len}};
+  memcpy(action.vlcbMessage.data, data, len);
 
   controller->putAction(action);
+  return true;
+}
+
+/// Check if an incoming message may be of interest for any service in this node.
+/// Events are checked against a filter of stored events in Configuration.
+/// Requests addressed to a node number are checked against this node number.
+/// All other messages are considered relevant.
+bool CanService::isRelevantMessage(byte len, const byte *data)
+{
+  if (len < 3)
+  {
+    return true;
+  }
+
+  unsigned int nn = Configuration::getTwoBytes(&data[1]);
+  unsigned int en = len >= 5 ? Configuration::getTwoBytes(&data[3]) : 0;
+  switch (data[0])
+  {
+    // Long events and requests, matched on node number and event number.
+    case OPC_ACON: case OPC_ACOF: case OPC_AREQ: case OPC_ARON: case OPC_AROF:
+    case OPC_ACON1: case OPC_ACOF1: case OPC_ARON1: case OPC_AROF1:
+    case OPC_ACON2: case OPC_ACOF2: case OPC_ARON2: case OPC_AROF2:
+    case OPC_ACON3: case OPC_ACOF3: case OPC_ARON3: case OPC_AROF3:
+      return len < 5 || controller->getModuleConfig()->mayContainEvent(nn, en);
+
+    // Short events and requests, matched on event number only.
+    case OPC_ASON: case OPC_ASOF: case OPC_ASRQ: case OPC_ARSON: case OPC_ARSOF:
+    case OPC_ASON1: case OPC_ASOF1: case OPC_ARSON1: case OPC_ARSOF1:
+    case OPC_ASON2: case OPC_ASOF2: case OPC_ARSON2: case OPC_ARSOF2:
+    case OPC_ASON3: case OPC_ASOF3: case OPC_ARSON3: case OPC_ARSOF3:
+      return len < 5 || controller->getModuleConfig()->mayContainEvent(0, en);
+
+    // Requests addressed to a specific node.
+    case OPC_RQNPN:
+    case OPC_NNULN:
+    case OPC_NNCLR:
+    case OPC_NNEVN:
+    case OPC_NERD:
+    case OPC_RQEVN:
+    case OPC_NVRD:
+    case OPC_NENRD:
+    case OPC_CANID:
+    case OPC_MODE:
+    case OPC_RQSD:
+    case OPC_RDGN:
+    case OPC_NVSET:
+    case OPC_NVSETRD:
+    case OPC_REVAL:
+    case OPC_ENUM:
+    case OPC_NNRSM:
+    case OPC_NNRST:
+      return isThisNodeNumber(nn);
+
+    // NNLRN for another node ends learn mode in this node.
+    // EVLRNI carries the NN of the event being taught, not of this node.
+    case OPC_NNLRN:
+    case OPC_EVLRNI:
+    default:
+      return true;
+  }
 }
 
 bool CanService::sendMessage(const VlcbMessage *msg)
 {
   // caller must populate the frame data
   // this method will create the correct frame header (CAN ID and priority bits)
-  // rtr and ext default to false unless arguments are supplied - see method definition in .h
-  // priority defaults to 1011 low/medium
+  // priority is looked up from the op-code
 
-  CANFrame frame;
-  frame.id = makeHeader_impl(controller->getModuleCANID(), DEFAULT_PRIORITY);
-  frame.len = msg->len;
-  frame.rtr = false;
-  frame.ext = false;
-  memcpy(frame.data, msg->data, msg->len);
+  byte priority = msg->len > 0 ? priorityFunc(msg->data[0]) : DEFAULT_PRIORITY;
 
   controller->indicateActivity();
-  return sendCanFrame(&frame);
+  return sendFrame(makeHeader_impl(controller->getModuleCANID(), priority), false, msg->len, msg->data);
 }
 
-bool CanService::sendRtrFrame()
+bool CanService::transmitFrame(uint32_t id, bool rtr, byte len, const byte *data)
 {
-  return sendEmptyFrame(true);
+  CANFrame frame;
+  frame.id = id;
+  frame.rtr = rtr;
+  frame.ext = false;
+  frame.len = len;
+  memcpy(frame.data, data, len);
+
+  return canTransport->sendCanFrame(&frame);
 }
 
-bool CanService::sendEmptyFrame(bool rtr)
+/// Send a frame to the transport. If the transport cannot accept it, then
+/// keep the frame in the retry queue. Frames already queued are sent first
+/// to keep the order of frames.
+bool CanService::sendFrame(uint32_t id, bool rtr, byte len, const byte *data)
 {
+  if (!txQueue.available())
+  {
+    if (transmitFrame(id, rtr, len, data))
+    {
+      return true;
+    }
+    // This frame becomes the first in the queue and has been rejected once.
+    txHeadRejected = true;
+  }
+  else if (txQueue.bufUse() == CAN_TX_QUEUE_SIZE)
+  {
+    // The oldest frame is dropped and the next frame has not been tried yet.
+    txHeadRejected = false;
+  }
+
   CANFrame frame;
-  frame.id = makeHeader_impl(controller->getModuleCANID(), DEFAULT_PRIORITY);
+  frame.id = id;
   frame.rtr = rtr;
   frame.ext = false;
-  frame.len = 0;
+  frame.len = len;
+  memcpy(frame.data, data, len);
+  txQueue.put(frame);
+  return false;
+}
+
+void CanService::retryQueuedCanFrames()
+{
+  while (txQueue.available())
+  {
+    // Frames queued behind a rejected frame are sent here for the first time.
+    // Only count attempts for frames that the transport has rejected.
+    if (txHeadRejected)
+    {
+      ++txRetries;
+    }
+    CANFrame *frame = txQueue.peek();
+    if (!transmitFrame(frame->id, frame->rtr, frame->len, frame->data))
+    {
+      // Transport is still busy. Try again next time.
+      txHeadRejected = true;
+      return;
+    }
+    txQueue.pop();
+    txHeadRejected = false;
+  }
+}
 
-  return sendCanFrame(&frame);
+bool CanService::sendRtrFrame()
+{
+  return sendEmptyFrame(true);
+}
+
+bool CanService::sendEmptyFrame(bool rtr)
+{
+  byte noData[1];
+  return sendFrame(makeHeader_impl(controller->getModuleCANID(), DEFAULT_PRIORITY), rtr, 0, noData);
 }
 
 void CanService::checkCANenumTimout()
@@ -254,7 +457,8 @@ void CanService::checkCANenumTimout()
   //
   /// check the 100ms CAN enumeration cycle timer
   //
-  if (bCANenum && (millis() - CANenumTime) >= 100)
+  unsigned long now = controller->getClock()->getMillis();
+  if (bCANenum && (now - CANenumTime) >= 100)
   {
     // enumeration timer has expired -- stop enumeration and process the responses
 
@@ -262,13 +466,21 @@ void CanService::checkCANenumTimout()
     // DEBUG_SERIAL << F("> processing received responses") << endl;
 
     byte selected_id = findFreeCanId();
+    if (selected_id == 0)
+    {
+      // all CAN ids are in use
+      ++enumerationFailures;
+      selected_id = 1;
+    }
 
     // DEBUG_SERIAL << F("> lowest available CAN id = ") << selected_id << endl;
 
     bCANenum = false;
+    lastEnumerationDuration = now - CANenumTime;
+    totalEnumerationDuration += lastEnumerationDuration;
 
     // store the new CAN ID
-    controller->getModuleConfig()->setCANID(selected_id);
+    changeCanId(selected_id);
 
     // send NNACK if initiated by ENUM request.
     if (startedFromEnumMessage)
@@ -308,7 +520,16 @@ byte CanService::findFreeCanId()
     }
   }
 
-  return 1;     // default if no responses from other modules
+  return 0;     // no free CAN id
+}
+
+void CanService::changeCanId(byte canId)
+{
+  if (canId != controller->getModuleCANID())
+  {
+    ++canIdChanges;
+  }
+  controller->getModuleConfig()->setCANID(canId);
 }
 
 }
\ No newline at end of file
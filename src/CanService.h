@@ -7,11 +7,32 @@
 
 #include "Service.h"
 #include "CanTransport.h"
+#include "CircularBuffer.h"
 #include <vlcbdefs.hpp>
 
 namespace VLCB
 {
 
+// Default max number of incoming CAN frames to read in each call to process().
+const byte CAN_RX_FRAMES_PER_PROCESS = 4;
+// Default max time in microseconds to spend reading incoming CAN frames in each call to process().
+const unsigned int CAN_RX_TIME_BUDGET = 1000;
+// Number of outgoing CAN frames that can be held for retry when the transport cannot accept them.
+const int CAN_TX_QUEUE_SIZE = 4;
+
+// CAN priorities. The 4 bit priority consists of 2 bits major priority and 2 bits minor priority.
+// Lower values win arbitration on the CAN bus.
+// Major priority is always 10 (normal). The minor priority depends on the op-code
+// following the CBUS priority rules: emergency stop and track control first,
+// then DCC and throttle traffic, then everything else. Bulk responses go last.
+const byte CAN_PRIORITY_HIGH = 0x8;    ///< Emergency and track control messages.
+const byte CAN_PRIORITY_ABOVE = 0x9;   ///< DCC and throttle messages.
+const byte CAN_PRIORITY_NORMAL = 0xA;  ///< Accessory events, requests and single responses.
+const byte CAN_PRIORITY_LOW = 0xB;     ///< Bulk responses such as event, parameter and variable lists.
+
+/// Returns the CAN priority that VLCB assigns to messages with the given op-code.
+byte getDefaultCanPriority(byte opCode);
+
 struct VlcbMessage;
 
 /// @brief Service for sending and receiving messages on a CAN bus
@@ -33,6 +54,54 @@ public:
   /// transmission on the CAN bus.
   CanService(CanTransport * tpt) : canTransport(tpt) {}
 
+  /// Set how many incoming CAN frames may be read in each call to process().
+  /// Reading stops when maxFrames frames have been read or when timeBudget 
+  /// microseconds have passed, whichever comes first.
+  /// Reading also stops if the action queue is getting full.
+  void setReceiveLimits(byte maxFrames, unsigned int timeBudget)
+  {
+    maxRxFramesPerProcess = maxFrames;
+    rxTimeBudget = timeBudget;
+  }
+  /// Number of incoming CAN frames read in the last call to process().
+  byte getReceivedFramesLastProcess() const { return rxFramesLastProcess; }
+  /// Highest number of incoming CAN frames read in a single call to process().
+  byte getReceivedFramesPeak() const { return rxFramesPeak; }
+
+  /// Set a function that returns the CAN priority for a given op-code.
+  /// Use this to override the default priority for some op-codes.
+  /// The function may call getDefaultCanPriority() for other op-codes.
+  void setPriorityFunction(byte (*func)(byte opCode)) { priorityFunc = func; }
+
+  /// Enable or disable filtering of incoming messages.
+  /// When enabled, accessory events that are not stored in the event table and
+  /// requests addressed to other nodes are dropped before they are put on the action queue.
+  void setIngressFilter(bool enable) { filterEnabled = enable; }
+  /// Number of incoming messages dropped by the ingress filter.
+  unsigned int getFilterDropCount() const { return filterDropped; }
+  /// Number of incoming messages that passed the ingress filter.
+  unsigned int getFilterPassCount() const { return filterPassed; }
+
+  /// Number of outgoing CAN frames waiting to be retried.
+  unsigned int getTransmitQueueUsage() const { return txQueue.bufUse(); }
+  /// Number of outgoing CAN frames dropped because the retry queue was full.
+  unsigned int getTransmitQueueOverruns() const { return txQueue.getOverflows(); }
+  /// Number of times a CAN frame that the transport rejected was sent again.
+  unsigned int getTransmitRetries() const { return txRetries; }
+
+  /// Number of CANID enumerations started.
+  unsigned int getEnumerationCount() const { return enumerationCount; }
+  /// Number of incoming frames that used the CANID of this module.
+  unsigned int getCanIdConflictCount() const { return canIdConflicts; }
+  /// Number of times the CANID of this module has changed.
+  unsigned int getCanIdChangeCount() const { return canIdChanges; }
+  /// Number of CANID enumerations that did not find a free CANID.
+  unsigned int getEnumerationFailureCount() const { return enumerationFailures; }
+  /// Time in milliseconds that the last CANID enumeration took.
+  unsigned long getLastEnumerationDuration() const { return lastEnumerationDuration; }
+  /// Total time in milliseconds spent in CANID enumerations.
+  unsigned long getTotalEnumerationDuration() const { return totalEnumerationDuration; }
+
   /// @cond LIBRARY
   virtual VlcbServiceTypes getServiceID() const override { return SERVICE_ID_CAN; }
   virtual byte getServiceVersionID() const override { return 2; }
@@ -43,6 +112,30 @@ public:
 
 protected:
   CanTransport * canTransport;
+
+  /// Read and handle incoming frames from the transport. Called once in each process().
+  /// Override this to read frames directly from the transport's own frame type.
+  virtual void checkIncomingCanFrames();
+  /// Read incoming frames while the receive limits allow it.
+  /// readFrame() reads and handles one frame and returns true if it shall be indicated as activity.
+  /// This is a template so that reading each frame needs no virtual call.
+  template <typename Reader>
+  void readIncomingFrames(Reader readFrame)
+  {
+    unsigned long startTime = startReadingFrames();
+    byte count = 0;
+    bool activity = false;
+    while (mayReadFrame(count, startTime))
+    {
+      activity |= readFrame();
+      ++count;
+    }
+    endReadingFrames(count, activity);
+  }
+  bool handleIncomingFrame(uint32_t id, bool ext, bool rtr, byte len, const byte *data);
+  /// Send one standard frame to the transport. Returns false if the transport cannot accept it.
+  /// Override this to build the frame directly in the transport's own frame type.
+  virtual bool transmitFrame(uint32_t id, bool rtr, byte len, const byte *data);
   /// @endcond 
 
 private:
@@ -53,18 +146,46 @@ private:
   bool sendMessage(const VlcbMessage *msg);
   bool sendRtrFrame();
   bool sendEmptyFrame(bool rtr = false);
-  bool sendCanFrame(CANFrame *msg) { return canTransport->sendCanFrame(msg); }
+  bool sendFrame(uint32_t id, bool rtr, byte len, const byte *data);
+  void retryQueuedCanFrames();
   void startCANenumeration(bool fromENUM = false);
 
-  void checkIncomingCanFrame();
+  unsigned long startReadingFrames();
+  bool mayReadFrame(byte count, unsigned long startTime);
+  void endReadingFrames(byte count, bool activity);
+  bool isRelevantMessage(byte len, const byte *data);
   void checkCANenumTimout();
   byte findFreeCanId();
+  void changeCanId(byte canId);
 
   bool enumeration_required = false;
   bool bCANenum = false;
   bool startedFromEnumMessage = false;
   unsigned long CANenumTime;
   byte enum_responses[16];     // 128 bits for storing CAN ID enumeration results
+
+  unsigned int enumerationCount = 0;
+  unsigned int canIdConflicts = 0;
+  unsigned int canIdChanges = 0;
+  unsigned int enumerationFailures = 0;
+  unsigned long lastEnumerationDuration = 0;
+  unsigned long totalEnumerationDuration = 0;
+
+  byte maxRxFramesPerProcess = CAN_RX_FRAMES_PER_PROCESS;
+  unsigned int rxTimeBudget = CAN_RX_TIME_BUDGET;
+  byte rxFramesLastProcess = 0;
+  byte rxFramesPeak = 0;
+
+  // Outgoing frames that the transport did not accept. Oldest frame is dropped when full.
+  CircularBuffer<CANFrame, CAN_TX_QUEUE_SIZE> txQueue;
+  bool txHeadRejected = false; // First frame in txQueue has been rejected by the transport.
+  unsigned int txRetries = 0;
+
+  byte (*priorityFunc)(byte opCode) = getDefaultCanPriority;
+
+  bool filterEnabled = false;
+  unsigned int filterDropped = 0;
+  unsigned int filterPassed = 0;
 };
 
 }
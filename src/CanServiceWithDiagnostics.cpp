@@ -27,6 +27,9 @@ void CanServiceWithDiagnostics::reportDiagnostics(byte serviceIndex, byte diagno
     case 0x04: // Tx buffer current usage count
       diagnosticsValue = canTransport->transmitBufferUsage();
       break;
+    case 0x05: // Tx buffer overrun count
+      diagnosticsValue = getTransmitQueueOverruns();
+      break;
     case 0x06: // TX message count
       diagnosticsValue = canTransport->transmitCounter();
       break;
@@ -36,6 +39,18 @@ void CanServiceWithDiagnostics::reportDiagnostics(byte serviceIndex, byte diagno
     case 0x09: // RX message counter
       diagnosticsValue = canTransport->receiveCounter();
       break;
+    case 0x0D: // number of CANID enumerations
+      diagnosticsValue = getEnumerationCount();
+      break;
+    case 0x0E: // number of CANID conflicts detected
+      diagnosticsValue = getCanIdConflictCount();
+      break;
+    case 0x0F: // the number of CANID changes
+      diagnosticsValue = getCanIdChangeCount();
+      break;
+    case 0x10: // the number of CANID enumeration failures
+      diagnosticsValue = getEnumerationFailureCount();
+      break;
     case 0x11: // Transmit buffers used high water mark - Added in service version 2
       diagnosticsValue = canTransport->transmitBufferPeak();
       break;
@@ -44,15 +59,10 @@ void CanServiceWithDiagnostics::reportDiagnostics(byte serviceIndex, byte diagno
       break;
 
     // Diagnostics codes not yet implemented
-    case 0x05: // Tx buffer overrun count
     case 0x08: // RX buffer overrun count
     case 0x0A: // CAN error frames detected
     case 0x0B: // CAN error frames generated (both active and passive ?)
     case 0x0C: // number of times CAN arbitration was lost
-    case 0x0D: // number of CANID enumerations
-    case 0x0E: // number of CANID conflicts detected
-    case 0x0F: // the number of CANID changes
-    case 0x10: // the number of CANID enumeration failures
       diagnosticsValue = 0;
       break;
 
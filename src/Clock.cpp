@@ -0,0 +1,17 @@
+// Copyright (C) Sven Rosvall (sven@rosvall.ie)
+// This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+// Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+// The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0/
+
+#include "Clock.h"
+
+namespace VLCB
+{
+
+Clock * getDefaultClock()
+{
+  static ArduinoClock clock;
+  return &clock;
+}
+
+}
@@ -0,0 +1,38 @@
+// Copyright (C) Sven Rosvall (sven@rosvall.ie)
+// This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+// Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+// The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0/
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace VLCB
+{
+
+/// Interface for reading the time. Used by Controller and the services for all timing.
+///
+/// The default clock uses the Arduino `millis()` and `micros()` functions.
+/// Other implementations can provide a simulated time, for example to run
+/// nodes on a host computer faster than real time.
+class Clock
+{
+public:
+  /// Milliseconds since start. Wraps around like Arduino `millis()`.
+  virtual unsigned long getMillis() = 0;
+  /// Microseconds since start. Wraps around like Arduino `micros()`.
+  virtual unsigned long getMicros() = 0;
+};
+
+/// Clock that uses the Arduino `millis()` and `micros()` functions.
+class ArduinoClock : public Clock
+{
+public:
+  virtual unsigned long getMillis() override { return millis(); }
+  virtual unsigned long getMicros() override { return micros(); }
+};
+
+/// The clock that is used unless another clock is set.
+extern Clock * getDefaultClock();
+
+}
@@ -0,0 +1,157 @@
+// Copyright (C) Sven Rosvall (sven@rosvall.ie)
+// This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+// Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+// The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0/
+
+#include "Compression.h"
+#include <string.h>
+
+namespace VLCB
+{
+
+// Decompressor states.
+enum : byte
+{
+  EXPECT_CONTROL = 0,
+  IN_LITERALS,
+  EXPECT_DISTANCE
+};
+
+unsigned int compress(const byte *src, unsigned int srcLen, byte *dest, unsigned int destLen)
+{
+  unsigned int in = 0, out = 0;
+  unsigned int literalStart = 0;
+
+  // Write pending literals up to the current position.
+  auto flushLiterals = [&]() -> bool
+  {
+    while (literalStart < in)
+    {
+      unsigned int n = in - literalStart;
+      if (n > COMPRESSION_MAX_LITERALS)
+      {
+        n = COMPRESSION_MAX_LITERALS;
+      }
+      if (out + 1 + n > destLen)
+      {
+        return false;
+      }
+      dest[out++] = n - 1;
+      memcpy(dest + out, src + literalStart, n);
+      out += n;
+      literalStart += n;
+    }
+    return true;
+  };
+
+  while (in < srcLen)
+  {
+    // Find the longest match in the window. Matches may overlap the current position.
+    unsigned int bestLen = 0, bestDistance = 0;
+    unsigned int maxLen = srcLen - in < COMPRESSION_MAX_MATCH ? srcLen - in : COMPRESSION_MAX_MATCH;
+    unsigned int maxDistance = in < COMPRESSION_WINDOW ? in : COMPRESSION_WINDOW;
+    for (unsigned int distance = 1; distance <= maxDistance && bestLen < maxLen; ++distance)
+    {
+      const byte *candidate = src + in - distance;
+      unsigned int len = 0;
+      while (len < maxLen && candidate[len] == src[in + len])
+      {
+        ++len;
+      }
+      if (len > bestLen)
+      {
+        bestLen = len;
+        bestDistance = distance;
+      }
+    }
+
+    if (bestLen < COMPRESSION_MIN_MATCH)
+    {
+      ++in;
+      continue;
+    }
+
+    if (!flushLiterals() || out + 2 > destLen)
+    {
+      return 0;
+    }
+    dest[out++] = 0x80 | (bestLen - COMPRESSION_MIN_MATCH);
+    dest[out++] = bestDistance - 1;
+    in += bestLen;
+    literalStart = in;
+  }
+
+  if (!flushLiterals())
+  {
+    return 0;
+  }
+  return out;
+}
+
+bool Decompressor::put(byte in, byte *out, unsigned int outLen)
+{
+  switch (state)
+  {
+    case EXPECT_CONTROL:
+      if (in & 0x80)
+      {
+        count = (in & 0x7F) + COMPRESSION_MIN_MATCH;
+        state = EXPECT_DISTANCE;
+      }
+      else
+      {
+        count = in + 1;
+        state = IN_LITERALS;
+      }
+      return true;
+
+    case IN_LITERALS:
+      if (outIndex >= outLen)
+      {
+        return false;
+      }
+      out[outIndex++] = in;
+      if (--count == 0)
+      {
+        state = EXPECT_CONTROL;
+      }
+      return true;
+
+    case EXPECT_DISTANCE:
+    {
+      unsigned int distance = in + 1;
+      if (distance > outIndex)
+      {
+        corrupt = true;
+        return false;
+      }
+      if (outIndex + count > outLen)
+      {
+        return false;
+      }
+      // Copy one byte at a time as the match may overlap the bytes being written.
+      for (; count > 0; --count, ++outIndex)
+      {
+        out[outIndex] = out[outIndex - distance];
+      }
+      state = EXPECT_CONTROL;
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned int decompress(const byte *src, unsigned int srcLen, byte *dest, unsigned int destLen)
+{
+  Decompressor decompressor;
+  for (unsigned int i = 0; i < srcLen; ++i)
+  {
+    if (!decompressor.put(src[i], dest, destLen))
+    {
+      return 0;
+    }
+  }
+  return decompressor.isComplete() ? decompressor.outIndex : 0;
+}
+
+}
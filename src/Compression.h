@@ -0,0 +1,59 @@
+// Copyright (C) Sven Rosvall (sven@rosvall.ie)
+// This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+// Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+// The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0/
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace VLCB
+{
+
+//
+/// Small LZ77 style compression for long message payloads.
+/// The compressed data is a sequence of tokens. Each token starts with a control byte:
+///   0x00-0x7F: a run of control + 1 literal bytes follows.
+///   0x80-0xFF: copy (control & 0x7F) + 3 bytes from earlier output. The next byte is
+///              the distance back - 1, i.e. up to 256 bytes back.
+/// A distance of 1 repeats the last byte so runs of the same value compress well.
+///
+/// The decompressor needs no memory apart from the output buffer and can work one
+/// byte at a time as fragments arrive:
+///   Decompressor d;
+///   for each byte: if (!d.put(b, out, outLen)) error;
+///   if (!d.isComplete()) error;
+///   d.outIndex is the length of the output.
+//
+
+const byte COMPRESSION_MIN_MATCH = 3;
+const byte COMPRESSION_MAX_MATCH = 0x7F + COMPRESSION_MIN_MATCH;
+const byte COMPRESSION_MAX_LITERALS = 0x80;
+const unsigned int COMPRESSION_WINDOW = 256;
+
+/// Compress src into dest.
+/// Returns the compressed length, or 0 if the result does not fit in destLen.
+/// Each byte is matched against the whole window so the time grows with
+/// srcLen * COMPRESSION_WINDOW. Data that does not compress is the slowest.
+unsigned int compress(const byte *src, unsigned int srcLen, byte *dest, unsigned int destLen);
+
+/// Decompress a whole buffer. Returns the decompressed length, or 0 if the data is
+/// corrupt or does not fit in destLen.
+unsigned int decompress(const byte *src, unsigned int srcLen, byte *dest, unsigned int destLen);
+
+struct Decompressor
+{
+  byte state = 0;
+  byte count = 0;
+  unsigned int outIndex = 0;
+  /// Set when put() fails because the data refers back past the start of the output.
+  bool corrupt = false;
+
+  /// Decompress the next byte of compressed data into out.
+  /// Returns false if the data is corrupt or the output does not fit in outLen.
+  bool put(byte in, byte *out, unsigned int outLen);
+  /// True if the compressed data ended at the end of a token.
+  bool isComplete() const { return state == 0; }
+};
+
+}
@@ -0,0 +1,259 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#include "ConfigTransferService.h"
+#include "Controller.h"
+#include "LongMessageService.h"
+#include "Crc16.h"
+
+namespace VLCB
+{
+
+// Sizes of the parts of an image.
+static const byte IMAGE_HEADER_LEN = 4;
+static const byte IMAGE_EVENT_KEY_LEN = 1 + EE_HASH_BYTES;
+static const byte IMAGE_CRC_LEN = 2;
+
+ConfigTransferService::ConfigTransferService(LongMessageDispatcher & dispatcher, byte *buffer, unsigned int bufferLen, byte streamId)
+  : dispatcher(dispatcher)
+  , longMessageService(dispatcher.getLongMessageService())
+  , buffer(buffer)
+  , bufferLen(bufferLen)
+  , streamId(streamId)
+{
+}
+
+void ConfigTransferService::begin()
+{
+  dispatcher.registerHandler(streamId, this);
+}
+
+unsigned int ConfigTransferService::imageSize()
+{
+  Configuration *config = controller->getModuleConfig();
+  unsigned int size = IMAGE_HEADER_LEN + config->getNumNodeVariables() + 1 + IMAGE_CRC_LEN;
+  for (byte i = 0; i < config->getNumEvents(); ++i)
+  {
+    if (config->isEventSlotInUse(i))
+    {
+      size += IMAGE_EVENT_KEY_LEN + config->getNumEVs();
+    }
+  }
+  return size;
+}
+
+unsigned int ConfigTransferService::exportImage(byte *dest, unsigned int destLen)
+{
+  Configuration *config = controller->getModuleConfig();
+  unsigned int size = imageSize();
+  if (size > destLen)
+  {
+    return 0;
+  }
+
+  byte *p = dest;
+  *p++ = CONFIG_IMAGE_VERSION;
+  *p++ = config->getNumNodeVariables();
+  *p++ = config->getNumEvents();
+  *p++ = config->getNumEVs();
+
+  config->readNVs(p);
+  p += config->getNumNodeVariables();
+
+  byte *eventCount = p++;
+  *eventCount = 0;
+  for (byte i = 0; i < config->getNumEvents(); ++i)
+  {
+    if (config->isEventSlotInUse(i))
+    {
+      *p++ = i;
+      config->readEventEntry(i, p);
+      p += config->EE_BYTES_PER_EVENT;
+      ++*eventCount;
+    }
+  }
+
+  Configuration::setTwoBytes(p, crc16(dest, p - dest));
+  ++exportCount;
+  return size;
+}
+
+// Find the event for a slot in the events part of an image.
+static const byte * findImageEvent(const byte *events, byte numEvents, unsigned int eventLen, byte index)
+{
+  for (byte e = 0; e < numEvents; ++e)
+  {
+    if (events[e * eventLen] == index)
+    {
+      return events + e * eventLen;
+    }
+  }
+  return nullptr;
+}
+
+ConfigTransferStatus ConfigTransferService::importImage(const byte *src, unsigned int len)
+{
+  Configuration *config = controller->getModuleConfig();
+
+  // Check everything before writing anything.
+  if (len < IMAGE_HEADER_LEN + IMAGE_CRC_LEN || src[0] != CONFIG_IMAGE_VERSION)
+  {
+    ++importErrorCount;
+    return CONFIG_FORMAT_ERROR;
+  }
+  if (crc16(src, len - IMAGE_CRC_LEN) != Configuration::getTwoBytes(&src[len - IMAGE_CRC_LEN]))
+  {
+    ++importErrorCount;
+    return CONFIG_CRC_ERROR;
+  }
+  if (src[1] != config->getNumNodeVariables() || src[2] != config->getNumEvents() || src[3] != config->getNumEVs())
+  {
+    ++importErrorCount;
+    return CONFIG_SIZE_MISMATCH;
+  }
+
+  if (len < (unsigned int)IMAGE_HEADER_LEN + config->getNumNodeVariables() + 1 + IMAGE_CRC_LEN)
+  {
+    // Too short for the NVs and the number of events.
+    ++importErrorCount;
+    return CONFIG_FORMAT_ERROR;
+  }
+
+  const byte *nvs = src + IMAGE_HEADER_LEN;
+  const byte *events = nvs + config->getNumNodeVariables();
+  byte numEvents = events[0];
+  unsigned int eventLen = IMAGE_EVENT_KEY_LEN + config->getNumEVs();
+  if (len != (unsigned int)(events + 1 - src) + numEvents * eventLen + IMAGE_CRC_LEN)
+  {
+    ++importErrorCount;
+    return CONFIG_FORMAT_ERROR;
+  }
+  ++events;
+  for (byte e = 0; e < numEvents; ++e)
+  {
+    if (events[e * eventLen] >= config->getNumEvents())
+    {
+      ++importErrorCount;
+      return CONFIG_FORMAT_ERROR;
+    }
+  }
+
+  config->writeNVs(nvs);
+  for (byte i = 0; i < config->getNumEvents(); ++i)
+  {
+    // Write each slot once, either with the event from the image or cleared.
+    const byte *event = findImageEvent(events, numEvents, eventLen, i);
+    if (event != nullptr)
+    {
+      config->writeEventEntry(i, event + 1);
+    }
+    else if (config->isEventSlotInUse(i))
+    {
+      config->cleareventEEPROM(i);
+    }
+  }
+  // Cleared slots keep their old hash entries. Rebuild the hash table and event filter
+  // once instead of for each cleared slot.
+  config->rebuildEvHashTable();
+  config->commitToEEPROM();
+
+  ++importCount;
+  return CONFIG_OK;
+}
+
+void ConfigTransferService::handleLongMessage(const void *msg, unsigned int msgLen, byte status)
+{
+  if (status == LONG_MESSAGE_INCOMPLETE)
+  {
+    // The buffer was too small. Wait for the end of the message and report it.
+    overflowed = true;
+    return;
+  }
+  if (status != LONG_MESSAGE_COMPLETE)
+  {
+    overflowed = false;
+    return;
+  }
+
+  const byte *data = (const byte *)msg;
+  if (msgLen < CONFIG_MESSAGE_HEADER_LEN || !isThisNodeNumber(Configuration::getTwoBytes(&data[1])))
+  {
+    overflowed = false;
+    return;
+  }
+
+  if (overflowed)
+  {
+    overflowed = false;
+    ++importErrorCount;
+    sendResult(CONFIG_TOO_LARGE);
+    return;
+  }
+
+  switch (data[0])
+  {
+    case CONFIG_CMD_READ:
+      readRequested = true;
+      break;
+
+    case CONFIG_CMD_WRITE:
+      // The image is only available during this call so import it now and reply later.
+      sendResult(importImage(data + CONFIG_MESSAGE_HEADER_LEN, msgLen - CONFIG_MESSAGE_HEADER_LEN));
+      break;
+  }
+}
+
+void ConfigTransferService::process()
+{
+  // The plain LongMessageService sends straight from the buffer so wait until it is done.
+  // A message in the send queue is still in the buffer.
+  if ((!readRequested && !resultPending && imageLen == 0)
+      || longMessageService.is_sending() || longMessageService.getSendQueueUsage() > 0)
+  {
+    return;
+  }
+
+  // An image already in the buffer is sent before any result.
+  if (imageLen == 0 && resultPending)
+  {
+    setMessageHeader(CONFIG_CMD_RESULT);
+    buffer[CONFIG_MESSAGE_HEADER_LEN] = pendingResult;
+    resultPending = !longMessageService.sendLongMessage(buffer, CONFIG_MESSAGE_HEADER_LEN + 1, streamId);
+    return;
+  }
+
+  if (imageLen == 0)
+  {
+    readRequested = false;
+    imageLen = exportImage(buffer + CONFIG_MESSAGE_HEADER_LEN, bufferLen - CONFIG_MESSAGE_HEADER_LEN);
+    if (imageLen == 0)
+    {
+      sendResult(CONFIG_TOO_LARGE);
+      return;
+    }
+    setMessageHeader(CONFIG_CMD_IMAGE);
+  }
+
+  // Try again later if the long message service has no free send context.
+  if (longMessageService.sendLongMessage(buffer, CONFIG_MESSAGE_HEADER_LEN + imageLen, streamId))
+  {
+    imageLen = 0;
+  }
+}
+
+void ConfigTransferService::sendResult(ConfigTransferStatus status)
+{
+  // Sent from process() when the buffer is free.
+  pendingResult = status;
+  resultPending = true;
+}
+
+void ConfigTransferService::setMessageHeader(ConfigTransferCommand command)
+{
+  buffer[0] = command;
+  Configuration::setTwoBytes(&buffer[1], controller->getModuleConfig()->nodeNum);
+}
+
+}
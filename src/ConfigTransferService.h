@@ -0,0 +1,108 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#pragma once
+
+#include "Service.h"
+#include "LongMessageDispatcher.h"
+#include <vlcbdefs.hpp>
+
+namespace VLCB
+{
+
+// Default long message stream ID used for configuration transfers.
+const byte CONFIG_TRANSFER_STREAM_ID = 0xC0;
+// Version of the configuration image format.
+const byte CONFIG_IMAGE_VERSION = 1;
+// Bytes before the image in a message: command and node number.
+const byte CONFIG_MESSAGE_HEADER_LEN = 3;
+
+/// Commands in the first byte of a configuration transfer message.
+/// The command is followed by the node number of the module.
+enum ConfigTransferCommand : byte
+{
+  CONFIG_CMD_READ = 1,    ///< Request the configuration image.
+  CONFIG_CMD_IMAGE = 2,   ///< Configuration image sent by the module.
+  CONFIG_CMD_WRITE = 3,   ///< Configuration image to write to the module.
+  CONFIG_CMD_RESULT = 4   ///< Result of a read or write, followed by a ConfigTransferStatus.
+};
+
+/// Result of importing a configuration image.
+enum ConfigTransferStatus : byte
+{
+  CONFIG_OK = 0,
+  CONFIG_CRC_ERROR = 1,       ///< The image was corrupted.
+  CONFIG_FORMAT_ERROR = 2,    ///< Unknown version, wrong length or bad event index.
+  CONFIG_SIZE_MISMATCH = 3,   ///< The image has a different number of NVs, events or EVs than this module.
+  CONFIG_TOO_LARGE = 4        ///< The image does not fit in the buffer.
+};
+
+/// @brief Service that reads and writes the whole module configuration in one long message.
+///
+/// Configuring a module with single NVSET/EVLRN messages takes many round trips.
+/// This service exports all NVs and stored events with their EVs as one image that
+/// a configuration tool can save, and imports such an image to restore or clone a module.
+///
+/// Messages are sent on one long message stream. Each message starts with a
+/// ConfigTransferCommand and the node number.
+/// The image has this layout:
+/// * version, number of NVs, number of events, number of EVs
+/// * all NV values
+/// * number of stored events, then for each: event index, NN, EN and EV values
+/// * CRC-16 of all the bytes above
+///
+/// An image is only imported if the CRC is correct and the sizes match this module.
+/// The buffer is used for sending and must hold the largest image plus the 3 byte
+/// message header. Use imageSize() to find the size for the current configuration.
+/// The receive buffer of the LongMessageDispatcher, or the receive context buffers of
+/// LongMessageServiceEx, must be as large to write an image to the module.
+class ConfigTransferService : public Service, public LongMessageHandler
+{
+public:
+  ConfigTransferService(LongMessageDispatcher & dispatcher, byte *buffer, unsigned int bufferLen,
+                        byte streamId = CONFIG_TRANSFER_STREAM_ID);
+
+  /// Number of bytes in an image of the current configuration.
+  unsigned int imageSize();
+  /// Write an image of the current configuration. Returns the image length or 0 if it does not fit.
+  unsigned int exportImage(byte *dest, unsigned int destLen);
+  /// Write a configuration image to the module. Nothing is written unless the image is valid.
+  ConfigTransferStatus importImage(const byte *src, unsigned int len);
+
+  /// Handle a complete long message for the configuration stream.
+  virtual void handleLongMessage(const void *msg, unsigned int msgLen, byte status) override;
+
+  unsigned int getExportCount() const { return exportCount; }
+  unsigned int getImportCount() const { return importCount; }
+  unsigned int getImportErrorCount() const { return importErrorCount; }
+
+  /// @cond LIBRARY
+  virtual void begin() override;
+  virtual void process() override;
+  virtual VlcbServiceTypes getServiceID() const override { return SERVICE_ID_NONE; }
+  virtual byte getServiceVersionID() const override { return 1; }
+  /// @endcond
+
+private:
+  void sendResult(ConfigTransferStatus status);
+  void setMessageHeader(ConfigTransferCommand command);
+
+  LongMessageDispatcher & dispatcher;
+  LongMessageService & longMessageService;
+  byte *buffer;
+  unsigned int bufferLen;
+  byte streamId;
+  bool overflowed = false;
+  bool readRequested = false;
+  unsigned int imageLen = 0;
+  bool resultPending = false;
+  ConfigTransferStatus pendingResult = CONFIG_OK;
+
+  unsigned int exportCount = 0;
+  unsigned int importCount = 0;
+  unsigned int importErrorCount = 0;
+};
+
+}
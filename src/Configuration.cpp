@@ -288,19 +288,33 @@ void Configuration::makeEvHashTable()
 {
   // DEBUG_SERIAL << F("> creating event hash table") << endl;
 
-  // TODO: Check for null return. Don't call updateEvHashEntry in that case.
   evhashtbl = (byte *)malloc(getNumEvents() * sizeof(byte));
+  if (evhashtbl == NULL)
+  {
+    memset(evFilter, 0, sizeof(evFilter));
+    return;
+  }
+
+  // Every entry is written here so no entry is left uninitialised.
+  rebuildEvHashTable();
+}
 
+//
+/// recalculate all hash table entries and the event filter -- after changing many events
+//
+void Configuration::rebuildEvHashTable()
+{
   for (byte idx = 0; idx < getNumEvents(); idx++)
   {
-    updateEvHashEntry(idx);
+    evhashtbl[idx] = readEvHash(idx);
   }
+  makeEvFilter();
 }
 
 //
-/// update a single hash table entry -- after a learn or unlearn
+/// read an event from EEPROM and return its hash value, or zero for an empty slot
 //
-void Configuration::updateEvHashEntry(byte idx)
+byte Configuration::readEvHash(byte idx)
 {
   byte evarray[EE_HASH_BYTES];
 
@@ -310,11 +324,32 @@ void Configuration::updateEvHashEntry(byte idx)
   // empty slots have all four bytes set to 0xff
   if (nnenEquals(evarray, unused_entry))
   {
+    return 0;
+  }
+  return makeHash(evarray);
+}
+
+//
+/// update a single hash table entry -- after a learn or unlearn
+//
+void Configuration::updateEvHashEntry(byte idx)
+{
+  byte hash = readEvHash(idx);
+
+  if (hash == 0)
+  {
+    bool wasUsed = evhashtbl[idx] != 0;
     evhashtbl[idx] = 0;
+    if (wasUsed)
+    {
+      // Other events may share the filter bit so rebuild the filter.
+      makeEvFilter();
+    }
   }
   else
   {
-    evhashtbl[idx] = makeHash(evarray);
+    evhashtbl[idx] = hash;
+    setEvFilterBit(hash);
   }
 
   // DEBUG_SERIAL << F("> updateEvHashEntry for idx = ") << idx << F(", hash = ") << hash << endl;
@@ -344,6 +379,40 @@ void Configuration::clearEvHashTable()
   {
     evhashtbl[i] = 0;
   }
+  memset(evFilter, 0, sizeof(evFilter));
+}
+
+void Configuration::setEvFilterBit(byte hash)
+{
+  // Hash values are 1-127 and 255. Fold 255 into bit 0 as hash 0 is never used.
+  hash %= HASH_LENGTH;
+  bitSet(evFilter[hash / 8], hash % 8);
+}
+
+void Configuration::makeEvFilter()
+{
+  memset(evFilter, 0, sizeof(evFilter));
+  for (byte i = 0; i < getNumEvents(); i++)
+  {
+    if (evhashtbl[i] != 0)
+    {
+      setEvFilterBit(evhashtbl[i]);
+    }
+  }
+}
+
+//
+/// quick check if an event may be stored in the event table
+/// returns false if the event is definitely not stored. 
+/// returns true if the event may be stored. Use findExistingEvent() to be sure.
+//
+bool Configuration::mayContainEvent(unsigned int nn, unsigned int en) const
+{
+  byte tarray[EE_HASH_BYTES];
+  setTwoBytes(&tarray[0], nn);
+  setTwoBytes(&tarray[2], en);
+  byte hash = makeHash(tarray) % HASH_LENGTH;
+  return bitRead(evFilter[hash / 8], hash % 8);
 }
 
 //
@@ -424,6 +493,22 @@ void Configuration::writeNV(byte idx, byte val)
   storage->write(EE_NVS_START + (idx - 1), val);
 }
 
+//
+/// read all NVs in one go, dest must hold getNumNodeVariables() bytes
+//
+void Configuration::readNVs(byte dest[]) const
+{
+  storage->readBytes(EE_NVS_START, getNumNodeVariables(), dest);
+}
+
+//
+/// write all NVs in one go
+//
+void Configuration::writeNVs(const byte src[])
+{
+  storage->writeBytes(EE_NVS_START, src, getNumNodeVariables());
+}
+
 //
 /// generic EEPROM access methods
 //
@@ -449,6 +534,23 @@ void Configuration::writeEvent(byte index, const byte data[EE_HASH_BYTES])
   storage->writeBytes(eeaddress, data, EE_HASH_BYTES);
 }
 
+//
+/// read a whole event entry, NN, EN and all EVs. dest must hold EE_BYTES_PER_EVENT bytes
+//
+void Configuration::readEventEntry(byte index, byte dest[]) const
+{
+  storage->readBytes(EE_EVENTS_START + (index * EE_BYTES_PER_EVENT), EE_BYTES_PER_EVENT, dest);
+}
+
+//
+/// write a whole event entry, NN, EN and all EVs, and update the hash table
+//
+void Configuration::writeEventEntry(byte index, const byte src[])
+{
+  storage->writeBytes(EE_EVENTS_START + (index * EE_BYTES_PER_EVENT), src, EE_BYTES_PER_EVENT);
+  updateEvHashEntry(index);
+}
+
 //
 /// clear an event from the table
 //
@@ -51,17 +51,23 @@ public:
   byte getEvTableEntry(byte tindex) const;
   byte numEvents() const;
   void updateEvHashEntry(byte idx);
+  void rebuildEvHashTable();
   void clearEvHashTable();
+  bool mayContainEvent(unsigned int nn, unsigned int en) const;
   byte getEventEVval(byte idx, byte evnum) const;
   void writeEventEV(byte idx, byte evnum, byte evval);
 
   byte readNV(byte idx) const;
   void writeNV(byte idx, byte val);
+  void readNVs(byte dest[]) const;
+  void writeNVs(const byte src[]);
 
   bool isEventSlotInUse(byte eventIndex) const;
   void readEvent(byte idx, byte tarr[EE_HASH_BYTES]) const;
   void writeEvent(byte eventIndex, unsigned int nn, unsigned int en);
   void writeEvent(byte index, const byte data[EE_HASH_BYTES]);
+  void readEventEntry(byte index, byte dest[]) const;
+  void writeEventEntry(byte index, const byte src[]);
   void cleareventEEPROM(byte index);
   void resetModule();
   void commitToEEPROM();
@@ -129,12 +135,17 @@ private:
   void setModuleMode(VlcbModeParams m);
   byte makeHash(byte tarr[EE_HASH_BYTES]) const;
   void makeEvHashTable();
+  byte readEvHash(byte idx);
+  void setEvFilterBit(byte hash);
+  void makeEvFilter();
 
   void loadNVs();
 
   unsigned int getEVAddress(byte idx, byte evnum) const;
 
   byte *evhashtbl;
+  // One bit per hash value for quickly rejecting events that are not stored.
+  byte evFilter[HASH_LENGTH / 8];
 };
 
 }
@@ -150,7 +150,16 @@ void Controller::indicateActivity()
 void Controller::process()
 {
   //Serial << F("Ctrl::process() start, action queue size = ") << actionQueue.size();
-  if (actionQueue.available())
+  // Handle a deferred request again once a task slot is free.
+  if (deferredRequests.available() && timedResponses.getPoolUsage() < TIMED_RESPONSE_POOL_SIZE)
+  {
+    DeferredRequest request = deferredRequests.pop();
+    Action action = {ACT_MESSAGE_IN, request.msg};
+    request.service->processAction(action);
+  }
+
+  // Process the actions that are queued now. Actions added while processing are left for next call.
+  for (byte pending = actionQueue.bufUse(); pending > 0; --pending)
   {
     // Get the next action and store it locally so that it is not overwritten if the action queue gets full.
     Action action = actionQueue.pop();
@@ -166,11 +175,17 @@ void Controller::process()
     service->process();
   }
 
-  timedResponses.process();
+  timedResponses.process(clock->getMillis());
   
   module_config->commitToEEPROM();
 }
 
+void Controller::deferRequest(Service * service, const VlcbMessage * msg)
+{
+  DeferredRequest request = {service, *msg};
+  deferredRequests.put(request);
+}
+
 bool Controller::sendMessage(const VlcbMessage *msg)
 {
   Action action = {ACT_MESSAGE_OUT, *msg};
@@ -240,7 +255,7 @@ bool Controller::pendingAction()
 
 bool Controller::pendingTasks()
 {
-  return timedResponses.pendingTasks();
+  return timedResponses.pendingTasks() || deferredRequests.available();
 }
 
 void Controller::messageActedOn()
@@ -249,9 +264,4 @@ void Controller::messageActedOn()
   ++diagMsgsActed;
 }
 
-void Controller::addTimedResponseTask(TimedResponse::Task * task)
-{
-  timedResponses.add(task);
-}
-
 }
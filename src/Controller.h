@@ -14,6 +14,8 @@
 #include "CircularBuffer.h"
 #include "Configuration.h"
 #include "TimedResponse.h"
+#include "VlcbMessage.h"
+#include "Clock.h"
 
 namespace VLCB
 {
@@ -23,15 +25,6 @@ namespace VLCB
 // Set size to 8 to be on the safe side.
 const int ACTION_QUEUE_SIZE = 8;
 
-//
-/// CAN/Controller message type
-//
-struct VlcbMessage
-{
-  uint8_t len; // Value 0-7 or FF for messages handled in CanTransport
-  uint8_t data[8];
-};
-
 /// Type of Action.
 enum ACTION : byte
 {
@@ -60,6 +53,13 @@ struct Action
 
 class Service;
 
+/// A request that is handled again when a TimedResponse task slot is free.
+struct DeferredRequest
+{
+  Service * service;
+  VlcbMessage msg;
+};
+
 //
 /// Main object in VLCB. Coordinates transport, ui, configuration and services.
 //
@@ -113,7 +113,25 @@ public:
   
   const CircularBuffer<Action, ACTION_QUEUE_SIZE> & getActionQueue() const { return actionQueue; }
 
-  void addTimedResponseTask(TimedResponse::Task * task);
+  /// Create a task of type T that sends responses at timed intervals.
+  /// The arguments are passed on to the constructor of T.
+  /// Returns false if the task could not be created as the task pool is full.
+  /// The request may then be passed to deferRequest().
+  template <typename T, typename... Args>
+  bool addTimedResponseTask(Args &&... args)
+  {
+    return timedResponses.add<T>(static_cast<Args &&>(args)...);
+  }
+  const TimedResponse & getTimedResponses() const { return timedResponses; }
+  /// Pass a request message to the service again when a TimedResponse task slot is free.
+  /// The oldest deferred request is dropped if too many are waiting.
+  void deferRequest(Service * service, const VlcbMessage * msg);
+  const CircularBuffer<DeferredRequest, TIMED_RESPONSE_POOL_SIZE> & getDeferredRequests() const { return deferredRequests; }
+
+  /// Set the clock used for all timing in the controller and its services.
+  /// Call this before begin(). The default clock uses Arduino millis() and micros().
+  void setClock(Clock * clk) { clock = clk; }
+  Clock * getClock() const { return clock; }
 
 private:
   Configuration *module_config;
@@ -121,6 +139,8 @@ private:
 
   CircularBuffer<Action, ACTION_QUEUE_SIZE> actionQueue;
   TimedResponse timedResponses;
+  CircularBuffer<DeferredRequest, TIMED_RESPONSE_POOL_SIZE> deferredRequests;
+  Clock * clock = getDefaultClock();
 
   bool sendMessageWithNNandData(VlcbOpCodes opc) { return sendMessageWithNNandData(opc, 0, 0); }
   bool sendMessageWithNNandData(VlcbOpCodes opc, int len, ...);
@@ -0,0 +1,36 @@
+// Copyright (C) Sven Rosvall (sven@rosvall.ie)
+// This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+// Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+// The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0/
+
+#include "Crc16.h"
+
+namespace VLCB
+{
+
+// CRC of each 4 bit value for the reflected polynomial 0x8408.
+// A nibble table is 32 bytes instead of 512 bytes for a byte table and is
+// still much faster than calculating one bit at a time.
+static const uint16_t crcTable[16] = {
+  0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+  0x8408, 0x9489, 0xA50A, 0xB58B, 0xC60C, 0xD68D, 0xE70E, 0xF78F
+};
+
+uint16_t crc16Update(uint16_t crc, const byte *data, unsigned int length)
+{
+  while (length--)
+  {
+    byte b = *data++;
+    crc = (crc >> 4) ^ crcTable[(crc ^ b) & 0x0F];
+    crc = (crc >> 4) ^ crcTable[(crc ^ (b >> 4)) & 0x0F];
+  }
+  return crc;
+}
+
+uint16_t crc16Final(uint16_t crc)
+{
+  crc = ~crc;
+  return (crc << 8) | (crc >> 8);
+}
+
+}
@@ -0,0 +1,35 @@
+// Copyright (C) Sven Rosvall (sven@rosvall.ie)
+// This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+// Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+// The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0/
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace VLCB
+{
+
+//
+/// CRC-16 as used by long messages (RFC 0005).
+/// CCITT polynomial in reflected form, initial value 0xFFFF and inverted result
+/// with the two bytes swapped.
+///
+/// The CRC can be calculated in steps as data arrives:
+///   uint16_t crc = CRC16_INIT;
+///   crc = crc16Update(crc, part1, len1);
+///   crc = crc16Update(crc, part2, len2);
+///   uint16_t result = crc16Final(crc);
+//
+
+const uint16_t CRC16_INIT = 0xFFFF;
+
+uint16_t crc16Update(uint16_t crc, const byte *data, unsigned int length);
+uint16_t crc16Final(uint16_t crc);
+
+inline uint16_t crc16(const byte *data, unsigned int length)
+{
+  return crc16Final(crc16Update(CRC16_INIT, data, length));
+}
+
+}
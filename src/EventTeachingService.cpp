@@ -114,11 +114,14 @@ void EventTeachingService::handleRequestEventVariable(const VlcbMessage *msg, un
     // Reuse the incoming message as it contains the event NN/EN and event index.
     response.data[5] = 0;
     response.data[6] = module_config->getNumEVs();
-    controller->sendMessage(&response);
-    if (!module_config->fcuCompatible)
+    // The task is added before the first response so that nothing is sent if the request is deferred.
+    if (!module_config->fcuCompatible
+        && !controller->addTimedResponseTask<RespondEV>(controller, module_config, response, eventIndex))
     {
-      controller->addTimedResponseTask(new RespondEV(controller, module_config, response, eventIndex));
+      controller->deferRequest(this, msg);
+      return;
     }
+    controller->sendMessage(&response);
   }
   else
   {
@@ -46,16 +46,28 @@
 // And the GridConnect Identifier field is also leading zero padded, so always 8 characters for an extended message
 // 
 
-#include <ctype.h>
 #include "GridConnect.h"
 
 namespace VLCB
 {
 
+  static const char hexDigits[] = "0123456789ABCDEF";
+
+  // write value as count upper case hex digits, most significant first
+  //
+  static char * putHex(char * p, uint32_t value, byte count)
+  {
+    for (int shift = (count - 1) * 4; shift >= 0; shift -= 4)
+    {
+      *p++ = hexDigits[(value >> shift) & 0xF];
+    }
+    return p;
+  }
+
   bool encodeGridConnect(char * gcBuffer, CANFrame *frame)
   {
-      byte offset = 0;
       gcBuffer[0] = 0;  // null terminate buffer to start with
+      char * p = gcBuffer;
       // set starting character & standard or extended CAN identifier
       if (frame->ext)
       {
@@ -65,17 +77,17 @@ namespace VLCB
           return false;
         }
         // mark as extended frame
-        strcpy (gcBuffer,":X");
+        *p++ = ':';
+        *p++ = 'X';
         // extended 29 bit CAN idenfier in bytes 2 to 9
         // chars 2 & 3 are ID bits 21 to 28
-        sprintf(gcBuffer + 2, "%02X", (frame->id) >> 21);
+        p = putHex(p, frame->id >> 21, 2);
         // char 4 -  bits 1 to 3 are ID bits 18 to 20
-        sprintf(gcBuffer + 4, "%01X", ((frame->id) >> 17) & 0xE);
+        *p++ = hexDigits[(frame->id >> 17) & 0xE];
         // char 5 -  bits 0 to 1 are ID bits 16 & 17
-        sprintf(gcBuffer + 5, "%01X", ((frame->id) >> 16) & 0x3);
+        *p++ = hexDigits[(frame->id >> 16) & 0x3];
         // chars 6 to 9 are ID bits 0 to 15
-        sprintf(gcBuffer + 6, "%04X", frame->id & 0xFFFF);
-        offset = 10;
+        p = putHex(p, frame->id & 0xFFFF, 4);
       } 
       else
       {
@@ -85,111 +97,108 @@ namespace VLCB
           // id is greater than 11 bits, so fail the encoding
           return false;
         }
-        strcpy (gcBuffer,":S");
+        *p++ = ':';
+        *p++ = 'S';
         // standard 11 bit CAN idenfier in bytes 2 to 5, left shifted 5 to occupy highest bits
-        sprintf(gcBuffer + 2, "%04X", frame->id << 5);
-        offset = 6;
+        p = putHex(p, frame->id << 5, 4);
       }
-      // set RTR or normal - byte 6 or 10
-      strcpy(gcBuffer + offset++, frame->rtr ? "R" : "N");
       if (frame->len > 8)
       { 
         // if greater than 8 then faulty frame
         gcBuffer[0] = 0;
         return false;
       }
+      // set RTR or normal - byte 6 or 10
+      *p++ = frame->rtr ? 'R' : 'N';
       //now add hex data from byte 7 if len > 0
       for (int i=0; i < frame->len; i++)
       {
-        sprintf(gcBuffer + offset, "%02X", frame->data[i]);
-        offset += 2;
+        *p++ = hexDigits[frame->data[i] >> 4];
+        *p++ = hexDigits[frame->data[i] & 0xF];
       }
       // add terminator
-      strcpy (gcBuffer + offset,";");
+      *p++ = ';';
+      *p = 0;
       return true;
   }
 
-  // Function to convert a pair of hexadecimal characters to a byte value
+  // value of an upper case hexadecimal character, or -1 if not a hex character
   //
-  static int ascii_pair_to_byte(const char *pair)
+  static int8_t hexValue(char c)
   {
-      unsigned char* data = (unsigned char*)pair;
-      int result;
-      if (data[1] < 'A') { result = data[1] - '0'; }
-      else { result = data[1] - 'A' + 10; }
-      if (data[0] < 'A') { result += (data[0] - '0') << 4; }
-      else { result += (data[0] - 'A' + 10) << 4; }
-      return result;
+    if (c >= '0' && c <= '9')
+    {
+      return c - '0';
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+      return c - 'A' + 10;
+    }
+    return -1;
   }
 
-
-  // check supplied array is comprised of only hexadecimal characters
+  // convert count hexadecimal characters to a value
+  // returns false if any character is not an upper case hex character
   //
-  static bool checkHexChars(const char *charBuff, int count)
+  static bool getHex(const char * p, byte count, uint32_t * value)
   {
-    for (int i = 0 ; i< count; i++)
+    uint32_t result = 0;
+    for (byte i = 0; i < count; i++)
     {
-      // must be upper case, so fail if lower case
-      if (islower(charBuff[i]))
-      {
-        return false;
-      }
-      if (!isxdigit(charBuff[i]))
+      int8_t nibble = hexValue(p[i]);
+      if (nibble < 0)
       {
         return false;
       }
+      result = (result << 4) | nibble;
     }
+    *value = result;
     return true;
   }
 
 
   // convert a gridconnect message to CANFrame object
   // see Gridconnect format at beginning of file for byte positions
+  // the message is validated and converted in a single pass
   //
   bool decodeGridConnect(const char * gcBuffer, CANFrame *frame) 
   {
-    int gcIndex = 0;                          // index used to 'walk' gc frame
-    int gcBufferLength = strlen(gcBuffer);    // save for later use
+    const char * p = gcBuffer;
 
     // must have start of frame character
-    if (gcBuffer[gcIndex++] != ':') 
+    if (*p++ != ':') 
     {
       return false;
     }
     //
     // do CAN Identifier, must be either 'X' or 'S'
-    if (gcBuffer[gcIndex] == 'X') 
+    uint32_t value;
+    if (*p == 'X') 
     {
       frame->ext = true;
-      // now get 29 bit ID - convert from hex, but check they are all hex first
-      if (checkHexChars(&gcBuffer[2], 8) == false)
+      // now get 29 bit ID from characters 2 to 9
+      if (!getHex(p + 1, 8, &value))
       {
         return false;
       }
-      // ok, all hex, so build up id from characters 2 to 9
       // chars 2 & 3 are bits 21 to 28
-      frame->id = uint32_t(ascii_pair_to_byte(&gcBuffer[2])) << 21;
-      // chars 4 & 5 -  bits 5 to 7 are bits 18 to 20
-      frame->id += uint32_t(ascii_pair_to_byte(&gcBuffer[4]) & 0xE0) << 13;
-      // chars 4 & 5 -  bits 0 to 1 are bits 16 & 17
-      frame->id += uint32_t(ascii_pair_to_byte(&gcBuffer[4]) & 0x3) << 16;
-      // chars 6 & 7 are bits 8 to 15
-      frame->id += uint32_t(ascii_pair_to_byte(&gcBuffer[6])) << 8;
-      // chars 8 & 9 are bits 0 to 7 
-      frame->id += ascii_pair_to_byte(&gcBuffer[8]);
-      gcIndex = 10;
+      // char 4 -  bits 1 to 3 are bits 18 to 20
+      // char 5 -  bits 0 to 1 are bits 16 & 17
+      // chars 6 to 9 are bits 0 to 15
+      frame->id = ((value >> 3) & 0x1FFC0000) | (value & 0x3FFFF);
+      p += 9;
     }
-    else if (gcBuffer[gcIndex] == 'S') 
+    else if (*p == 'S') 
     {
       frame->ext = false;
-      // now get 11 bit ID - convert from hex, but check they are all hex first
-      if (checkHexChars(&gcBuffer[2], 4) == false)
+      // now get 11 bit ID from characters 2 to 5
+      if (!getHex(p + 1, 4, &value))
       {
         return false;
       }
       // 11 bit identifier needs to be shifted right by 5
-      frame->id = strtol(&gcBuffer[2], NULL, 16) >> 5;
-      gcIndex = 6;
+      frame->id = value >> 5;
+      p += 5;
     } 
     else 
     {
@@ -197,11 +206,11 @@ namespace VLCB
     }
     //
     // do RTR flag
-    if (gcBuffer[gcIndex] == 'R') 
+    if (*p == 'R') 
     {
       frame->rtr = true;
     } 
-    else if (gcBuffer[gcIndex] == 'N')
+    else if (*p == 'N')
     {
       frame->rtr = false;
     } 
@@ -209,37 +218,28 @@ namespace VLCB
     {
       return false;
     }
-    gcIndex++;  // set to next character afert RTR flag
+    p++;  // set to next character afert RTR flag
     //
-    // Do data segment - convert hex array to byte array
-    // find out how many chars in data segment (0 to 16, in multiples of 2) 
-    // should be gcBufferLength minus gcIndex as it is now (after RTR flag), minus 1
-    int dataLength = gcBufferLength - gcIndex - 1;
-    // must be even number of hex characters, and no more than 16
-    if ((dataLength % 2 ) || (dataLength > 16 )) 
+    // Do data segment - convert pairs of hex characters to bytes until end of frame
+    byte len = 0;
+    while (*p != ';')
     {
-      return false;
-    } 
-    // set length of data segment
-    frame->len = dataLength / 2;
-    // now convert hex data into bytes
-    for (int i = 0; i < dataLength/2; i++) 
-    {
-      // check they are hex chars first
-      if (checkHexChars(&gcBuffer[gcIndex], 2) == false)
+      int8_t high = hexValue(p[0]);
+      if (high < 0 || len >= 8)
       {
         return false;
       }
-      frame->data[i] = ascii_pair_to_byte(&gcBuffer[gcIndex]);
-      gcIndex += 2;
-    }
-    //
-    // must have end of frame character
-    if (gcBuffer[gcBufferLength-1] != ';') 
-    {
-      return false;
+      int8_t low = hexValue(p[1]);
+      if (low < 0)
+      {
+        return false;
+      }
+      frame->data[len++] = (high << 4) | low;
+      p += 2;
     }
+    frame->len = len;
     //
-    return true; 
+    // end of frame character must be the last character
+    return p[1] == 0;
   }
-}
\ No newline at end of file
+}
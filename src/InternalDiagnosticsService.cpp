@@ -28,6 +28,12 @@ void InternalDiagnosticsService::reportDiagnostics(byte serviceIndex, byte diagn
     case 0x04: // Action queue: number of overflows
       diagnosticsValue = controller->getActionQueue().getOverflows();
       break;
+    case 0x05: // TimedResponse task pool: high water mark
+      diagnosticsValue = controller->getTimedResponses().getPoolHighWaterMark();
+      break;
+    case 0x06: // TimedResponse task pool: number of failed task allocations
+      diagnosticsValue = controller->getTimedResponses().getAllocationFailures();
+      break;
 
     default:
       controller->sendGRSP(OPC_RDGN, serviceIndex, GRSP_INVALID_DIAGNOSTIC);
@@ -39,7 +45,7 @@ void InternalDiagnosticsService::reportDiagnostics(byte serviceIndex, byte diagn
 
 int InternalDiagnosticsService::getDiagnosticCount()
 {
-  return 4;
+  return 6;
 }
 
 }
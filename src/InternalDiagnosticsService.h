@@ -22,6 +22,8 @@ namespace VLCB
 /// 2) ActionQueue current size
 /// 3) ActionQueue high water mark
 /// 4) ActionQueue number of overflows
+/// 5) TimedResponse task pool high water mark
+/// 6) TimedResponse task pool allocation failures
 class InternalDiagnosticsService : public Service
 {
 public:
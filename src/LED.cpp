@@ -60,13 +60,13 @@ void LED::blink(unsigned int rate)
 {
   _mode = Blinking_On;
   _interval = rate;
-  _timer_start = millis();
+  _timer_start = _clock->getMillis();
 }
 
 // pulse the LED
 void LED::pulse(unsigned int duration)
 {
-  unsigned long now = millis();
+  unsigned long now = _clock->getMillis();
   // Set the interval to the max of remainder of current pulse and new pulse.
   if (_mode == Pulsing && _timer_start + _interval > now + duration)
   {
@@ -90,17 +90,17 @@ void LED::run()
   if (_mode & IsBlinking)
   {
     // blinking - toggle each time timer expires
-    if ((millis() - _timer_start) >= _interval)
+    if ((_clock->getMillis() - _timer_start) >= _interval)
     {
       toggle();
-      _timer_start = millis();
+      _timer_start = _clock->getMillis();
     }
   }
 
   // single pulse - switch off after timer expires
   if (_mode & IsPulsing)
   {
-    if (millis() - _timer_start >= _interval)
+    if (_clock->getMillis() - _timer_start >= _interval)
     {
       _mode = Off;
     }
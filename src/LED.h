@@ -14,6 +14,7 @@
 #endif
 
 #include <Arduino.h>      // for definition of byte datatype
+#include "Clock.h"
 // #include <Streaming.h>
 
 namespace VLCB
@@ -52,12 +53,16 @@ public:
 
   void run();
 
+  /// Set the clock used for blink and pulse timing.
+  void setClock(Clock * clock) { _clock = clock; }
+
 protected:
   byte _pin;
   byte _mode;
   bool _active;
   unsigned int _interval;
   unsigned long _timer_start;
+  Clock * _clock = getDefaultClock();
 
   void _update();
 };
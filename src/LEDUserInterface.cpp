@@ -23,6 +23,13 @@ LEDUserInterface::LEDUserInterface(byte greenLedPin, byte yellowLedPin, byte pus
 
 }
 
+void LEDUserInterface::begin()
+{
+  greenLed.setClock(controller->getClock());
+  yellowLed.setClock(controller->getClock());
+  pushButton.setClock(controller->getClock());
+}
+
 bool LEDUserInterface::isButtonPressed()
 {
   return pushButton.isPressed();
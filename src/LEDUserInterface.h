@@ -29,6 +29,7 @@ public:
   virtual byte getServiceVersionID() const override { return 1; };
 
   bool isButtonPressed();
+  virtual void begin() override;
   virtual void process() override;
   virtual void processAction(const Action &action) override;
   /// @endcond 
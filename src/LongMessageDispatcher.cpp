@@ -0,0 +1,62 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#include "LongMessageDispatcher.h"
+#include "LongMessageService.h"
+
+namespace VLCB
+{
+
+// The long message handler is a plain function so it needs to find the dispatcher.
+static LongMessageDispatcher * dispatcher = nullptr;
+
+LongMessageDispatcher::LongMessageDispatcher(LongMessageService & longMessageService, byte *receiveBuffer, unsigned int receiveBufferLen)
+  : longMessageService(longMessageService)
+  , receiveBuffer(receiveBuffer)
+  , receiveBufferLen(receiveBufferLen)
+{
+}
+
+bool LongMessageDispatcher::registerHandler(byte streamId, LongMessageHandler *handler)
+{
+  byte i = 0;
+  while (i < numStreams && streamIds[i] != streamId)
+  {
+    ++i;
+  }
+  if (i == LONG_MESSAGE_DISPATCHER_MAX_STREAMS)
+  {
+    return false;
+  }
+  if (i == numStreams)
+  {
+    streamIds[i] = streamId;
+    ++numStreams;
+  }
+  handlers[i] = handler;
+
+  // Subscribe again so that the long message service sees the new stream.
+  dispatcher = this;
+  longMessageService.subscribe(streamIds, numStreams, receiveBuffer, receiveBufferLen, messageHandler);
+  return true;
+}
+
+void LongMessageDispatcher::messageHandler(void *msg, unsigned int msgLen, byte streamId, byte status)
+{
+  if (dispatcher == nullptr)
+  {
+    return;
+  }
+  for (byte i = 0; i < dispatcher->numStreams; ++i)
+  {
+    if (dispatcher->streamIds[i] == streamId)
+    {
+      dispatcher->handlers[i]->handleLongMessage(msg, msgLen, status);
+      return;
+    }
+  }
+}
+
+}
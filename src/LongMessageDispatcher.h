@@ -0,0 +1,60 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace VLCB
+{
+
+class LongMessageService;
+
+// Number of streams that can be registered with a LongMessageDispatcher.
+const byte LONG_MESSAGE_DISPATCHER_MAX_STREAMS = 4;
+
+/// Interface for handling complete long messages on one stream.
+class LongMessageHandler
+{
+public:
+  /// Handle a long message. The status is one of the LONG_MESSAGE_* values.
+  virtual void handleLongMessage(const void *msg, unsigned int msgLen, byte status) = 0;
+};
+
+/// @brief Shares the subscription of a LongMessageService between several handlers.
+///
+/// A LongMessageService has one subscription, and each call to subscribe() replaces it.
+/// Services that use a long message stream, such as ConfigTransferService and MdfService,
+/// register with the dispatcher instead. The dispatcher subscribes to the streams of all
+/// registered handlers and passes each received message to the handler for its stream.
+/// A sketch can register its own handlers for other streams.
+///
+/// Messages are received into the buffer given to the dispatcher, which must hold the
+/// largest message on any of the streams. LongMessageServiceEx receives into its
+/// context buffers instead.
+/// Only one dispatcher can be used as the long message handler is a plain function.
+class LongMessageDispatcher
+{
+public:
+  LongMessageDispatcher(LongMessageService & longMessageService, byte *receiveBuffer, unsigned int receiveBufferLen);
+
+  /// Pass messages for a stream to a handler. Replaces an earlier handler for the same stream.
+  /// Returns false if all streams are in use.
+  bool registerHandler(byte streamId, LongMessageHandler *handler);
+
+  LongMessageService & getLongMessageService() { return longMessageService; }
+
+private:
+  static void messageHandler(void *msg, unsigned int msgLen, byte streamId, byte status);
+
+  LongMessageService & longMessageService;
+  byte *receiveBuffer;
+  unsigned int receiveBufferLen;
+  byte streamIds[LONG_MESSAGE_DISPATCHER_MAX_STREAMS];
+  LongMessageHandler *handlers[LONG_MESSAGE_DISPATCHER_MAX_STREAMS];
+  byte numStreams = 0;
+};
+
+}
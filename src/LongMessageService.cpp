@@ -10,15 +10,13 @@
 
 #include <LongMessageService.h>
 #include <Controller.h>
+#include <Crc16.h>
 #include <vlcbdefs.hpp>
 #include <Streaming.h>
 
 namespace VLCB
 {
 
-static uint16_t crc16(uint8_t *data_p, uint16_t length);
-static uint32_t crc32(const char *s, size_t n);
-
 //
 /// subscribe to a range of stream IDs
 //
@@ -29,10 +27,43 @@ void LongMessageService::subscribe(byte *stream_ids, const byte num_stream_ids,
 	_receive_buffer = (byte *)receive_buffer;
 	_receive_buffer_len = receive_buff_len;
 	_messagehandler = messagehandler;
+	_streamhandler = NULL;
 
 	// DEBUG_SERIAL << F("> subscribe: num_stream_ids = ") << num_stream_ids << F(", receive_buff_len = ") << receive_buff_len << endl;
 }
 
+//
+/// subscribe to a range of stream IDs without a receive buffer
+/// the handler is called with the data of each fragment as it arrives, together with its offset in the message
+/// and the total message length. The status is LONG_MESSAGE_INCOMPLETE until the last fragment.
+/// this uses no RAM for received messages, so large messages can be written straight to storage or a parser
+/// a received message may still fail with a sequence, timeout or CRC error after earlier fragments have been handled
+//
+void LongMessageService::subscribeStreaming(byte *stream_ids, const byte num_stream_ids, void (*streamhandler)(const void *data, const unsigned int data_len, const unsigned int offset, const unsigned int message_len, const byte stream_id, const byte status))
+{
+	_stream_ids = stream_ids;
+	_num_stream_ids = num_stream_ids;
+	_receive_buffer = NULL;
+	_receive_buffer_len = 0;
+	_messagehandler = NULL;
+	_streamhandler = streamhandler;
+}
+
+//
+/// report a failed message to the user's handler
+//
+void LongMessageService::reportReceiveError(byte *buffer, unsigned int buffer_index, unsigned int bytes_received, unsigned int message_len, byte stream_id, byte status)
+{
+	if (_streamhandler != NULL)
+	{
+		(*_streamhandler)(NULL, 0, bytes_received, message_len, stream_id, status);
+	}
+	else
+	{
+		(*_messagehandler)(buffer, buffer_index, stream_id, status);
+	}
+}
+
 void LongMessageService::processAction(const Action &action)
 {
   if (action.actionType == ACT_MESSAGE_IN)
@@ -56,8 +87,72 @@ void LongMessageService::handleMessage(const VlcbMessage *msg)
 /// initiate sending of a long message
 /// this method sends the first message - the header packet
 /// the remainder of the message is sent in chunks from the process() method
+/// returns false if the message cannot be sent now, e.g. if another message is being sent
+/// if a send queue is set the message is queued behind earlier queued messages to keep the order
+/// and false is returned if the queue is full
 //
 bool LongMessageService::sendLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id)
+{
+	if (_send_queue_depth > 0)
+	{
+		return queueLongMessage(msg, msg_len, stream_id);
+	}
+	return startLongMessage(msg, msg_len, stream_id, NULL);
+}
+
+//
+/// provide storage for a queue of messages waiting to be sent
+/// queued messages are sent by process() in the order they were queued
+//
+void LongMessageService::setSendQueue(send_queue_entry_t *entries, const byte depth)
+{
+	_send_queue = entries;
+	_send_queue_depth = depth;
+	_send_queue_head = 0;
+	_send_queue_count = 0;
+}
+
+//
+/// queue a message to be sent when earlier messages have been sent
+/// the completion function, if any, is called when the whole message has been sent
+/// the message buffer must not be changed until then
+/// returns false if the queue is full
+//
+bool LongMessageService::queueLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, void (*completion)(const byte stream_id, const byte status))
+{
+	if (_send_queue_count >= _send_queue_depth)
+	{
+		return false;
+	}
+
+	byte tail = (_send_queue_head + _send_queue_count) % _send_queue_depth;
+	_send_queue[tail] = {msg, msg_len, stream_id, completion};
+	++_send_queue_count;
+
+	// start sending straight away if possible
+	sendQueuedMessages();
+	return true;
+}
+
+//
+/// start sending queued messages, oldest first
+//
+void LongMessageService::sendQueuedMessages()
+{
+	while (_send_queue_count > 0 && canSendFragment())
+	{
+		send_queue_entry_t &entry = _send_queue[_send_queue_head];
+		if (!startLongMessage(entry.buffer, entry.length, entry.stream_id, entry.completion))
+		{
+			// wait until an earlier message has been sent
+			return;
+		}
+		_send_queue_head = (_send_queue_head + 1) % _send_queue_depth;
+		--_send_queue_count;
+	}
+}
+
+bool LongMessageService::startLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, void (*completion)(const byte stream_id, const byte status))
 {
 	VlcbMessage frame;
 
@@ -74,6 +169,8 @@ bool LongMessageService::sendLongMessage(const void *msg, const unsigned int msg
 	_send_stream_id = stream_id;
   _send_buffer_index = 0;
 	_send_sequence_num = 0;
+	_send_start_time = controller->getClock()->getMillis();
+	_send_completion = completion;
 
 	// send the first fragment which forms the message header
 	frame.data[1] = _send_stream_id;																									// the unique stream id
@@ -87,6 +184,11 @@ bool LongMessageService::sendLongMessage(const void *msg, const unsigned int msg
 	bool ret = sendMessageFragment(&frame);														// send the header packet
 	++_send_sequence_num;																															// increment the sending sequence number - it's fine if it wraps around
 
+	if (msg_len == 0 && _send_completion != NULL)
+	{
+		(*_send_completion)(_send_stream_id, LONG_MESSAGE_COMPLETE);
+	}
+
 	// DEBUG_SERIAL << F("> L: message header sent, stream id = ") << _send_stream_id << F(", message length = ") << _send_buffer_len << endl;
 	return (ret);
 }
@@ -97,15 +199,12 @@ bool LongMessageService::sendLongMessage(const void *msg, const unsigned int msg
 //
 void LongMessageService::process()
 {
-	byte i;
-	VlcbMessage frame;
-
 	/// check receive timeout
 
-	if (_is_receiving && (millis() - _last_fragment_received >= _receive_timeout))
+	if (_is_receiving && (controller->getClock()->getMillis() - _last_fragment_received >= _receive_timeout))
   {
 		// DEBUG_SERIAL << F("> L: ERROR: timed out waiting for continuation packet") << endl;
-		(void)(*_messagehandler)(_receive_buffer, _receive_buffer_index, _receive_stream_id, LONG_MESSAGE_TIMEOUT_ERROR);
+		reportReceiveError(_receive_buffer, _receive_buffer_index, _incoming_bytes_received, _incoming_message_length, _receive_stream_id, LONG_MESSAGE_TIMEOUT_ERROR);
 		_is_receiving = false;
 		_incoming_message_length = 0;
 		_incoming_bytes_received = 0;
@@ -113,30 +212,127 @@ void LongMessageService::process()
 		// timeout error status is surfaced to the user's handler function
 	}
 
-	/// send the next outgoing fragment, after a configurable delay to avoid flooding the bus
+	sendQueuedMessages();
 
-	if (_send_buffer_index < _send_buffer_len && (millis() - _last_fragment_sent >= _msg_delay))
-  {
-		_last_fragment_sent = millis();
+	/// send the next outgoing fragments, after a configurable delay to avoid flooding the bus
+	/// with adaptive pacing several fragments may be sent back to back while the transport is idle
 
-		memset(&frame.data, 0, sizeof(frame.data));
-		frame.data[1] = _send_stream_id;
-		frame.data[2] = _send_sequence_num;
+	for (byte count = 0; count < maxBurst() && _send_buffer_index < _send_buffer_len && canSendFragment(); ++count)
+	{
+		unsigned long now = controller->getClock()->getMillis();
+		if (!isFragmentDue(_last_fragment_sent, _min_interval, _max_interval, now))
+		{
+			break;
+		}
+		countPacingBackoff(_min_interval, _max_interval);
+		_last_fragment_sent = now;
 
-		/// only the last fragment is potentially less than 5 bytes long
+		sendDataFragment(_send_stream_id, _send_sequence_num, _send_buffer, _send_buffer_index, _send_buffer_len);
+		// DEBUG_SERIAL << F("> L: process: sent message fragment, seq = ") << _send_sequence_num << endl;
 
-		for (i = 0; i < 5 && _send_buffer_index < _send_buffer_len; i++)
-    {								// for up to 5 bytes of payload
-			frame.data[i + 3] = _send_buffer[_send_buffer_index];														// take the next byte
-			// DEBUG_SERIAL << F("> L: consumed data byte = ") << (char)_send_buffer[_send_buffer_index] << endl;
-			++_send_buffer_index;
+		++_send_sequence_num;
+
+		if (_send_buffer_index >= _send_buffer_len)
+		{
+			recordThroughput(_send_buffer_len, _send_start_time, now);
+			if (_send_completion != NULL)
+			{
+				(*_send_completion)(_send_stream_id, LONG_MESSAGE_COMPLETE);
+			}
+			// a queued message can follow immediately
+			sendQueuedMessages();
 		}
+	}
+}
+
+//
+/// build and send a data fragment with up to 5 bytes from the buffer
+/// only the last fragment is potentially less than 5 bytes long
+//
+void LongMessageService::sendDataFragment(byte stream_id, byte sequence_num, const byte *buffer, unsigned int &buffer_index, unsigned int buffer_len)
+{
+	VlcbMessage frame;
+	memset(&frame.data, 0, sizeof(frame.data));
+	frame.data[1] = stream_id;
+	frame.data[2] = sequence_num;
 
-		sendMessageFragment(&frame);																			// send the data packet
-		// DEBUG_SERIAL << F("> L: process: sent message fragment, seq = ") << _send_sequence_num << F(", size = ") << i << endl;
+	byte i;
+	for (i = 0; i < 5 && buffer_index < buffer_len; i++)
+	{
+		frame.data[i + 3] = buffer[buffer_index];
+		++buffer_index;
+	}
 
-		++_send_sequence_num;
+	sendMessageFragment(&frame);
+	_bytes_sent += i;
+	++_fragments_sent;
+}
+
+//
+/// with adaptive pacing fragments go via the action queue only while it has room for other actions
+/// without adaptive pacing fragments are only limited by the fixed delay
+//
+bool LongMessageService::canSendFragment()
+{
+	return _pacing_transport == NULL || controller->getActionQueue().bufUse() < ACTION_QUEUE_SIZE / 2;
+}
+
+//
+/// number of fragments that may be sent in each call to process()
+/// only adaptive pacing sends several fragments back to back
+//
+byte LongMessageService::maxBurst()
+{
+	return _pacing_transport == NULL ? 1 : LONG_MESSAGE_MAX_BURST;
+}
+
+//
+/// time in milliseconds to wait between fragments
+/// without adaptive pacing this is the fixed delay
+/// with adaptive pacing the interval grows from min to max as the action queue
+/// and the transport's transmit buffer fill up
+//
+unsigned int LongMessageService::pacingInterval(byte min_interval, byte max_interval)
+{
+	if (_pacing_transport == NULL)
+	{
+		return _msg_delay;
 	}
+
+	unsigned int usage = controller->getActionQueue().bufUse() + _pacing_transport->transmitBufferUsage();
+	unsigned int size = ACTION_QUEUE_SIZE + _pacing_transport->transmitBufferSize();
+	if (max_interval <= min_interval)
+	{
+		return min_interval;
+	}
+	if (usage >= size)
+	{
+		return max_interval;
+	}
+	return min_interval + (unsigned long)(max_interval - min_interval) * usage / size;
+}
+
+bool LongMessageService::isFragmentDue(unsigned long last_fragment_sent, byte min_interval, byte max_interval, unsigned long now)
+{
+	unsigned int interval = pacingInterval(min_interval, max_interval);
+	return now - last_fragment_sent >= interval;
+}
+
+//
+/// count a fragment that is sent after a longer interval than the minimum because the transport is busy
+//
+void LongMessageService::countPacingBackoff(byte min_interval, byte max_interval)
+{
+	if (_pacing_transport != NULL && pacingInterval(min_interval, max_interval) > min_interval)
+	{
+		++_pacing_backoffs;
+	}
+}
+
+void LongMessageService::recordThroughput(unsigned int msg_len, unsigned long start_time, unsigned long now)
+{
+	unsigned long elapsed = now - start_time;
+	_last_throughput = (unsigned long)msg_len * 1000UL / (elapsed > 0 ? elapsed : 1);
 }
 
 //
@@ -149,7 +345,7 @@ void LongMessageService::processReceivedMessageFragment(const VlcbMessage *frame
 
 	// DEBUG_SERIAL << F("> L: processing received long message packet, message length = ") << _incoming_message_length << F(", rcvd so far = ") << _incoming_bytes_received << endl;
 
-	_last_fragment_received = millis();
+	_last_fragment_received = controller->getClock()->getMillis();
 
 	byte i, j;
 
@@ -176,7 +372,10 @@ void LongMessageService::processReceivedMessageFragment(const VlcbMessage *frame
             _incoming_message_length = (frame->data[3] << 8) + frame->data[4];
             _incoming_message_crc = (frame->data[5] << 8) + frame->data[6];
             _incoming_bytes_received = 0;
-            memset(_receive_buffer, 0, _receive_buffer_len);
+            if (_receive_buffer != NULL)
+            {
+              memset(_receive_buffer, 0, _receive_buffer_len);
+            }
             _receive_buffer_index = 0;
             _expected_next_receive_sequence_num = 0;
             // DEBUG_SERIAL << F("> L: received header packet for stream id = ") << _receive_stream_id << F(", message length = ") << _incoming_message_length << F(", user buffer len = ") << _receive_buffer_len << endl;
@@ -207,44 +406,56 @@ void LongMessageService::processReceivedMessageFragment(const VlcbMessage *frame
 
         // DEBUG_SERIAL << F("> L: received continuation packet, seq = ") << _expected_next_receive_sequence_num << endl;
 
-        // for each of the maximum five payload bytes, up to the total message length and the user buffer length
-        for (j = 0; j < 5; j++)
+        if (_streamhandler != NULL)
         {
-          _receive_buffer[_receive_buffer_index] = frame->data[j + 3];                // take the next byte
-          ++_receive_buffer_index;                                                    // increment the buffer index
-          ++_incoming_bytes_received;
-          // DEBUG_SERIAL << F("> L: processing received data byte = ") << (char)frame->data[j + 3] << endl;
-
-          // if we have read the entire message
-          if (_incoming_bytes_received >= _incoming_message_length)
+          // hand the data in this fragment straight to the user's handler
+          unsigned int remaining = _incoming_message_length - _incoming_bytes_received;
+          unsigned int len = remaining < 5 ? remaining : 5;
+          unsigned int offset = _incoming_bytes_received;
+          _incoming_bytes_received += len;
+          (*_streamhandler)(&frame->data[3], len, offset, _incoming_message_length, _receive_stream_id,
+                            _incoming_bytes_received >= _incoming_message_length ? LONG_MESSAGE_COMPLETE : LONG_MESSAGE_INCOMPLETE);
+        }
+        else
+        {
+          // for each of the maximum five payload bytes, up to the total message length and the user buffer length
+          for (j = 0; j < 5; j++)
           {
-            // DEBUG_SERIAL << F("> L: bytes processed = ") << _incoming_bytes_received << F(", message data has been fully consumed") << endl;
-            (void) (*_messagehandler)(_receive_buffer, _receive_buffer_index, _receive_stream_id,
-                                      LONG_MESSAGE_COMPLETE);
-            _receive_buffer_index = 0;
-            memset(_receive_buffer, 0, _receive_buffer_len);
-            break;
+            _receive_buffer[_receive_buffer_index] = frame->data[j + 3];                // take the next byte
+            ++_receive_buffer_index;                                                    // increment the buffer index
+            ++_incoming_bytes_received;
+            // DEBUG_SERIAL << F("> L: processing received data byte = ") << (char)frame->data[j + 3] << endl;
 
-            // if the user buffer is full, give the user what we have so far
-          }
-          else if (_receive_buffer_index >= _receive_buffer_len)
-          {
-            // DEBUG_SERIAL << F("> L: user buffer is full") << endl;
-            (void) (*_messagehandler)(_receive_buffer, _receive_buffer_index, _receive_stream_id,
-                                      LONG_MESSAGE_INCOMPLETE);
-            _receive_buffer_index = 0;
-            memset(_receive_buffer, 0, _receive_buffer_len);
+            // if we have read the entire message
+            if (_incoming_bytes_received >= _incoming_message_length)
+            {
+              // DEBUG_SERIAL << F("> L: bytes processed = ") << _incoming_bytes_received << F(", message data has been fully consumed") << endl;
+              (void) (*_messagehandler)(_receive_buffer, _receive_buffer_index, _receive_stream_id,
+                                        LONG_MESSAGE_COMPLETE);
+              // the buffer is not cleared here so that the handler can reuse it, e.g. for a reply
+              _receive_buffer_index = 0;
+              break;
+
+              // if the user buffer is full, give the user what we have so far
+            }
+            else if (_receive_buffer_index >= _receive_buffer_len)
+            {
+              // DEBUG_SERIAL << F("> L: user buffer is full") << endl;
+              (void) (*_messagehandler)(_receive_buffer, _receive_buffer_index, _receive_stream_id,
+                                        LONG_MESSAGE_INCOMPLETE);
+              _receive_buffer_index = 0;
+              memset(_receive_buffer, 0, _receive_buffer_len);
+            }
           }
         }
-
       }
       else
       {
         // it's the wrong sequence id
 
         // DEBUG_SERIAL << F("> L: ERROR: expected receive sequence num = ") << _expected_next_receive_sequence_num << F(" but got = ") << frame->data[2] << endl;
-        (void) (*_messagehandler)(_receive_buffer, _receive_buffer_index, _receive_stream_id,
-                                  LONG_MESSAGE_SEQUENCE_ERROR);
+        reportReceiveError(_receive_buffer, _receive_buffer_index, _incoming_bytes_received, _incoming_message_length,
+                           _receive_stream_id, LONG_MESSAGE_SEQUENCE_ERROR);
         _incoming_message_length = 0;
         _incoming_bytes_received = 0;
         _is_receiving = false;
@@ -313,6 +524,19 @@ void LongMessageService::setDelay(byte delay_in_millis)
 	_msg_delay = delay_in_millis;
 }
 
+//
+/// pace fragments by how busy the transport is instead of a fixed delay
+/// fragments are sent back to back while the transport's transmit buffer is empty
+/// and up to max_interval milliseconds apart as it fills up
+/// the intervals are used for new messages, LongMessageServiceEx can change them per stream
+//
+void LongMessageService::setAdaptivePacing(Transport *transport, byte min_interval, byte max_interval)
+{
+	_pacing_transport = transport;
+	_min_interval = min_interval;
+	_max_interval = max_interval;
+}
+
 //
 /// set the receive timeout
 /// if an expected next fragment is not received, the user's handler function
@@ -332,62 +556,111 @@ void LongMessageService::setTimeout(unsigned int timeout_in_millis)
 
 //
 /// allocate memory for receive and send contexts
+/// all contexts and receive buffers are carved from a single allocation to avoid fragmenting the heap
+/// use a receive_buffer_len of 0 with subscribeStreaming() as no receive buffers are needed
+/// returns false and leaves no contexts in use if the memory cannot be allocated
 //
 bool LongMessageServiceEx::allocateContexts(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts)
 {
-	byte i;
+	size_t arena_len = longMessageArenaSize(num_receive_contexts, receive_buffer_len, num_send_contexts);
+	byte *arena = (byte *)malloc(arena_len);
 
-	// DEBUG_SERIAL << F("> receive_context_t * = ") << sizeof(receive_context_t *) << F(", receive_context_t = ") << sizeof(receive_context_t) << endl;
-
-	_num_receive_contexts = num_receive_contexts;
-	_receive_buffer_len = receive_buffer_len;
-	_num_send_contexts = num_send_contexts;
-
-	// allocate receive contexts
-	if ((_receive_context = (receive_context_t **)malloc(sizeof(receive_context_t *) * _num_receive_contexts)) == NULL)
-  {
+	if (arena == NULL)
+	{
+		releaseContexts();
 		return false;
 	}
 
-	for (i = 0; i < _num_receive_contexts; i++) {
-		if ((_receive_context[i] = (receive_context_t *)malloc(sizeof(receive_context_t))) == NULL)
-    {
-			return false;
-		}
+	if (!allocateContexts(arena, arena_len, num_receive_contexts, receive_buffer_len, num_send_contexts))
+	{
+		free(arena);
+		return false;
+	}
+	_owned_arena = arena;
+	return true;
+}
 
-		if ((_receive_context[i]->buffer = (byte *)malloc(receive_buffer_len * sizeof(byte))) == NULL)
-    {
-			return false;
-		}
+//
+/// use memory provided by the caller for receive and send contexts
+/// the arena must be aligned for the context structs and be at least longMessageArenaSize() bytes long
+/// a LongMessageArena declared with the same sizes meets both requirements
+/// returns false and leaves no contexts in use if the arena is too small or badly aligned
+//
+bool LongMessageServiceEx::allocateContexts(void *arena, size_t arena_len, byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts)
+{
+	byte i;
 
-		_receive_context[i]->in_use = false;
-	}
+	releaseContexts();
 
-	// allocate send contexts - user code provides the buffer when sending
-	if ((_send_context = (send_context_t **)malloc(sizeof(send_context_t *) * _num_send_contexts)) == NULL)
-  {
+	if (arena == NULL
+	    || arena_len < longMessageArenaSize(num_receive_contexts, receive_buffer_len, num_send_contexts)
+	    || ((uintptr_t)arena % alignof(receive_context_t)) != 0)
+	{
 		return false;
 	}
 
-	for (i = 0; i < _num_send_contexts; i++) {
-		if ((_send_context[i] = (send_context_t *)malloc(sizeof(send_context_t))) == NULL)
-    {
-			return false;
-		}
+	// the arena holds the receive contexts, then the send contexts, then the receive buffers
+	_receive_context = (receive_context_t *)arena;
+	_send_context = (send_context_t *)(_receive_context + num_receive_contexts);
+	byte *receive_buffers = (byte *)(_send_context + num_send_contexts);
 
-		_send_context[i]->in_use = false;
+	for (i = 0; i < num_receive_contexts; i++)
+	{
+		// no receive buffers are needed when streaming
+		_receive_context[i].buffer = receive_buffer_len > 0 ? receive_buffers + i * receive_buffer_len : NULL;
+		_receive_context[i].in_use = false;
 	}
 
+	// user code provides the buffer when sending
+	for (i = 0; i < num_send_contexts; i++)
+	{
+		_send_context[i].buffer = NULL;
+		_send_context[i].in_use = false;
+	}
+
+	_num_receive_contexts = num_receive_contexts;
+	_context_buffer_len = receive_buffer_len;
+	_num_send_contexts = num_send_contexts;
+	_next_send_context = 0;
+
 	// DEBUG_SERIAL << F("> Lex: allocated send and receive contexts ok") << endl;
 	return true;
 }
 
+//
+/// release any contexts from an earlier allocation
+//
+void LongMessageServiceEx::releaseContexts()
+{
+	for (byte i = 0; i < _num_send_contexts; i++)
+	{
+		if (_send_context[i].in_use)
+		{
+			free(_send_context[i].buffer);
+		}
+	}
+
+	_num_receive_contexts = 0;
+	_num_send_contexts = 0;
+	_context_buffer_len = 0;
+	_receive_context = NULL;
+	_send_context = NULL;
+
+	free(_owned_arena);
+	_owned_arena = NULL;
+}
+
+LongMessageServiceEx::~LongMessageServiceEx()
+{
+	releaseContexts();
+}
+
 //
 /// initiate sending of a long message
 /// this method sends the first message - the header packet
 /// the remainder of the message is sent in fragments from the process() method
 //
-bool LongMessageServiceEx::sendLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id)
+bool LongMessageServiceEx::startLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, void (*completion)(const byte stream_id, const byte status))
 {
 	byte i;
 	uint16_t msg_crc = 0;
@@ -398,7 +671,7 @@ bool LongMessageServiceEx::sendLongMessage(const void *msg, const unsigned int m
 	// ensure we aren't already sending a message with this stream ID
 	for (i = 0; i < _num_send_contexts; i++)
   {
-		if (_send_context[i]->in_use && _send_context[i]->send_stream_id == stream_id)
+		if (_send_context[i].in_use && _send_context[i].send_stream_id == stream_id)
     {
 			// DEBUG_SERIAL << F("> Lex: ERROR: already sending this stream ID") << endl;
 			return false;
@@ -408,13 +681,13 @@ bool LongMessageServiceEx::sendLongMessage(const void *msg, const unsigned int m
 	// find a free send context
 	for (i = 0; i < _num_send_contexts; i++)
   {
-		if (!_send_context[i]->in_use)
+		if (!_send_context[i].in_use)
     {
 			break;
 		}
 	}
 
-	if (i > _num_send_contexts)
+	if (i >= _num_send_contexts)
   {
 		// DEBUG_SERIAL << F("> Lex: ERROR: unable to find free send context") << endl;
 		return false;
@@ -422,31 +695,66 @@ bool LongMessageServiceEx::sendLongMessage(const void *msg, const unsigned int m
 
 	// DEBUG_SERIAL << F("> Lex: using send context = ") << i << endl;
 
+	// copy the message to the send context, will free later
+	byte *buffer = (byte *)malloc(msg_len > 0 ? msg_len : 1);
+	if (buffer == NULL)
+	{
+		return false;
+	}
+
+	// compress the message if that makes it shorter, otherwise send it as it is
+	unsigned int send_len = 0;
+	byte flags = 0;
+	if (_use_compression && msg_len > COMPRESSION_MIN_MATCH)
+	{
+		send_len = compress((const byte *)msg, msg_len, buffer, msg_len - 1);
+	}
+	if (send_len > 0)
+	{
+		flags = LONG_MESSAGE_FLAG_COMPRESSED;
+		_compression_savings += msg_len - send_len;
+	}
+	else
+	{
+		send_len = msg_len;
+		memcpy(buffer, msg, msg_len);
+	}
+
 	// initialise context
-	_send_context[i]->in_use = true;
-	// _send_context[i]->buffer = (byte *)msg;
-	_send_context[i]->buffer = (byte *)strdup((char *)msg);														// copy the message to the send content, will free later
-	_send_context[i]->send_buffer_len = msg_len;
-	_send_context[i]->send_stream_id = stream_id;
-  _send_context[i]->send_buffer_index = 0;
-
-	// calc CRC
+	_send_context[i].in_use = true;
+	_send_context[i].buffer = buffer;
+	_send_context[i].completion = completion;
+	_send_context[i].num_resend = 0;
+	_send_context[i].send_buffer_len = send_len;
+	_send_context[i].send_stream_id = stream_id;
+  _send_context[i].send_buffer_index = 0;
+	_send_context[i].min_interval = _min_interval;
+	_send_context[i].max_interval = _max_interval;
+	_send_context[i].start_time = controller->getClock()->getMillis();
+	_send_context[i].last_fragment_sent = _send_context[i].start_time;
+
+	send_stream_t *stream = findStream(stream_id, false);
+	_send_context[i].priority = stream != NULL ? stream->priority : LONG_MESSAGE_DEFAULT_PRIORITY;
+	_send_context[i].weight = stream != NULL ? stream->weight : 1;
+	_send_context[i].deficit = 0;
+
+	// calc CRC of the uncompressed message
 	if (_use_crc)
   {
-		msg_crc = crc16((uint8_t *)msg, msg_len);
+		msg_crc = crc16((const byte *)msg, msg_len);
 	}
 
 	// send the first fragment which forms the header message
-	frame.data[1] = _send_context[i]->send_stream_id;																	// the stream id
+	frame.data[1] = _send_context[i].send_stream_id;																	// the stream id
 	frame.data[2] = 0;																																// sequence number, 0 = header packet
-	frame.data[3] = highByte(_send_context[i]->send_buffer_len);										  // the message length
-	frame.data[4] = lowByte(_send_context[i]->send_buffer_len);
+	frame.data[3] = highByte(_send_context[i].send_buffer_len);										  // the message length
+	frame.data[4] = lowByte(_send_context[i].send_buffer_len);
 	frame.data[5] = highByte(msg_crc);																							  // CRC, zero if not implemented
 	frame.data[6] = lowByte(msg_crc);
-	frame.data[7] = 0;																																// flags - 0 = standard data message
+	frame.data[7] = flags;																														// flags - 0 = standard data message
 
 	bool ret = sendMessageFragment(&frame);					// send the header packet
-	_send_context[i]->send_sequence_num = 1;																	  			// the next send sequence number - it's fine if it wraps around
+	_send_context[i].send_sequence_num = 1;																	  			// the next send sequence number - it's fine if it wraps around
 
 	// DEBUG_SERIAL << F("> Lex: message header sent, stream id = ") << stream_id << F(", message length = ") << msg_len << F(", ret = ") << ret << endl;
 	return (ret);
@@ -459,63 +767,212 @@ bool LongMessageServiceEx::sendLongMessage(const void *msg, const unsigned int m
 void LongMessageServiceEx::process()
 {
 	byte i;
-	VlcbMessage frame;
-
-	static byte context = 0;				// we round-robin the context list when sending
 
 	/// check receive timeout for each active context
 
 	for (i = 0; i < _num_receive_contexts; i++)
   {
-		if (_receive_context[i]->in_use && (millis() - _receive_context[i]->last_fragment_received >= _receive_timeout))
+		if (_receive_context[i].in_use && (controller->getClock()->getMillis() - _receive_context[i].last_fragment_received >= _receive_timeout))
     {
 			// DEBUG_SERIAL << F("> Lex: ERROR: timed out waiting for continuation packet in context = ") << i << F(", timeout = ") << _receive_timeout << endl;
-			(void)(*_messagehandler)(_receive_context[i]->buffer, _receive_context[i]->receive_buffer_index, _receive_context[i]->receive_stream_id, LONG_MESSAGE_TIMEOUT_ERROR);
-			_receive_context[i]->in_use = false;
-			// _receive_context[i]->incoming_message_length = 0;
-			// _receive_context[i]->incoming_bytes_received = 0;
+			reportReceiveError(_receive_context[i].buffer, _receive_context[i].receive_buffer_index, _receive_context[i].incoming_bytes_received,
+			                   _receive_context[i].incoming_message_length, _receive_context[i].receive_stream_id, LONG_MESSAGE_TIMEOUT_ERROR);
+			_receive_context[i].in_use = false;
+			// _receive_context[i].incoming_message_length = 0;
+			// _receive_context[i].incoming_bytes_received = 0;
 		}
 	}
 
-	/// send the next outgoing fragment from each active context, after a configurable delay to avoid flooding the bus
-	/// concurrent streams will be interleaved
-	if (_send_context[context]->in_use && millis() - _send_context[context]->last_fragment_sent >= _msg_delay)
-  {
-		// DEBUG_SERIAL << F("> Lex: processing send context = ") << context << endl;
+	/// request missing fragments again if they have not arrived, this also finds fragments lost at the end of a message
+	for (i = 0; i < _num_receive_contexts; i++)
+	{
+		unsigned long now = controller->getClock()->getMillis();
+		if (_receive_context[i].in_use && _receive_context[i].recovering
+		    && now - _receive_context[i].last_fragment_received >= _nack_interval
+		    && now - _receive_context[i].last_nack_sent >= _nack_interval)
+		{
+			sendNack(&_receive_context[i], now);
+		}
+	}
 
-		memset(&frame.data, 0, sizeof(frame.data));
-		frame.data[1] = _send_context[context]->send_stream_id;
-		frame.data[2] = _send_context[context]->send_sequence_num;
+	/// release sent messages kept for recovery once no more fragments have been requested for a while
+	for (i = 0; i < _num_send_contexts; i++)
+	{
+		send_context_t *context = &_send_context[i];
+		if (context->in_use && context->send_buffer_index >= context->send_buffer_len && context->num_resend == 0
+		    && controller->getClock()->getMillis() - context->last_fragment_sent >= _recovery_window)
+		{
+			releaseSendContext(context);
+		}
+	}
 
-		/// only the last fragment is potentially less than 5 bytes long
-    for (i = 0; i < 5 && _send_context[context]->send_buffer_index < _send_context[context]->send_buffer_len; i++)  // for up to 5 bytes of payload
-    {
-			frame.data[i + 3] = _send_context[context]->buffer[_send_context[context]->send_buffer_index];																// take the next byte
-			// DEBUG_SERIAL << F("> Lex: consumed data byte = ") << (char)_send_context[context]->buffer[_send_context[context]->send_buffer_index] << endl;
-			++_send_context[context]->send_buffer_index;
+	/// start queued messages in any free send contexts
+	sendQueuedMessages();
+
+	/// send the next outgoing fragments, after a configurable delay per context to avoid flooding the bus
+	/// concurrent streams are interleaved by priority and weight
+	for (byte count = 0; count < maxBurst() && canSendFragment(); ++count)
+	{
+		unsigned long now = controller->getClock()->getMillis();
+		send_context_t *context = nextScheduledContext(now);
+		if (context == NULL)
+		{
+			break;
 		}
 
-		sendMessageFragment(&frame);																												// send the data packet
-		// DEBUG_SERIAL << F("> Lex: process: sent message fragment, seq = ") << _send_context[context]->send_sequence_num << F(", size = ") << i << F(", ret  = ") << ret << endl;
+		countPacingBackoff(context->min_interval, context->max_interval);
+		sendNextFragment(context, now);
+	}
+}
 
-		// release context once message content exhausted
-		if (_send_context[context]->send_buffer_index >= _send_context[context]->send_buffer_len)
-    {
-			_send_context[context]->in_use = false;
-			_send_context[context]->send_buffer_len = 0;
-			free(_send_context[context]->buffer);
-			// DEBUG_SERIAL << F("> Lex: message complete, context released") << endl;
-    }
-    else
-    {
-			++_send_context[context]->send_sequence_num;
-			_send_context[context]->last_fragment_sent = millis();
+//
+/// choose the send context for the next fragment
+/// only contexts of the most urgent priority with a fragment due take part
+/// these share the bus by deficit round robin, i.e. each gets fragments worth weight * 5 bytes in turn
+//
+send_context_t *LongMessageServiceEx::nextScheduledContext(unsigned long now)
+{
+	byte i, priority = 255;
+	bool found = false;
+
+	for (i = 0; i < _num_send_contexts; i++)
+	{
+		send_context_t *context = &_send_context[i];
+		if (context->in_use && (context->send_buffer_index < context->send_buffer_len || context->num_resend > 0)
+		    && context->priority <= priority
+		    && isFragmentDue(context->last_fragment_sent, context->min_interval, context->max_interval, now))
+		{
+			priority = context->priority;
+			found = true;
+		}
+	}
+
+	if (!found)
+	{
+		return NULL;
+	}
+
+	// each waiting context gets at least one quantum in two rounds so this always finds a context
+	for (unsigned int tries = 0; tries < 2U * _num_send_contexts; tries++)
+	{
+		send_context_t *context = &_send_context[_next_send_context];
+
+		if (context->in_use && (context->send_buffer_index < context->send_buffer_len || context->num_resend > 0)
+		    && context->priority == priority
+		    && isFragmentDue(context->last_fragment_sent, context->min_interval, context->max_interval, now))
+		{
+			unsigned int remaining = context->send_buffer_len - context->send_buffer_index;
+			int cost = remaining > 0 && remaining < 5 ? remaining : 5;
+			if (context->deficit >= cost)
+			{
+				// stay on this context while it has deficit left
+				context->deficit -= cost;
+				return context;
+			}
+			context->deficit += 5 * context->weight;
+		}
+
+		_next_send_context = (_next_send_context + 1) % _num_send_contexts;
+	}
+
+	return NULL;
+}
+
+//
+/// send the next fragment of a context if it is due
+//
+void LongMessageServiceEx::sendNextFragment(send_context_t *context, unsigned long now)
+{
+	if (context->send_buffer_index >= context->send_buffer_len)
+	{
+		resendFragment(context, now);
+		return;
+	}
+
+	unsigned int index = context->send_buffer_index;
+	sendDataFragment(context->send_stream_id, context->send_sequence_num, context->buffer, context->send_buffer_index, context->send_buffer_len);
+	// DEBUG_SERIAL << F("> Lex: process: sent message fragment, seq = ") << context->send_sequence_num << endl;
+
+	// statistics are only kept for streams that have been given a priority
+	send_stream_t *stream = findStream(context->send_stream_id, false);
+	if (stream != NULL)
+	{
+		stream->bytes_sent += context->send_buffer_index - index;
+	}
+
+	// release context once message content exhausted
+	if (context->send_buffer_index >= context->send_buffer_len)
+	{
+		recordThroughput(context->send_buffer_len, context->start_time, now);
+		if (stream != NULL)
+		{
+			stream->last_latency = now - context->start_time;
+		}
+		if (_use_recovery)
+		{
+			// keep the message for resending fragments that receivers report missing
+			++context->send_sequence_num;
+			context->last_fragment_sent = now;
+			return;
 		}
+		releaseSendContext(context);
+	}
+	else
+	{
+		++context->send_sequence_num;
+		context->last_fragment_sent = now;
+	}
+}
+
+//
+/// resend the first fragment that a receiver has reported missing
+//
+void LongMessageServiceEx::resendFragment(send_context_t *context, unsigned long now)
+{
+	unsigned int fragment = context->resend[0];
+	--context->num_resend;
+	memmove(&context->resend[0], &context->resend[1], context->num_resend * sizeof(context->resend[0]));
+
+	unsigned int index = (fragment - 1) * 5;
+	sendDataFragment(context->send_stream_id, fragment, context->buffer, index, context->send_buffer_len);
+	++_fragments_resent;
+	context->last_fragment_sent = now;
+	// DEBUG_SERIAL << F("> Lex: resent message fragment, seq = ") << fragment << endl;
+}
+
+//
+/// free a send context once its message has been sent
+//
+void LongMessageServiceEx::releaseSendContext(send_context_t *context)
+{
+	context->in_use = false;
+	context->deficit = 0;
+	context->send_buffer_len = 0;
+	context->num_resend = 0;
+	free(context->buffer);
+	// DEBUG_SERIAL << F("> Lex: message complete, context released") << endl;
+	if (context->completion != NULL)
+	{
+		(*context->completion)(context->send_stream_id, LONG_MESSAGE_COMPLETE);
 	}
+}
 
-	// increment context counter and wrap
-	++context;
-	context = (context >= _num_send_contexts) ? 0 : context;
+//
+/// change the pacing intervals of a stream that is being sent
+/// returns false if the stream is not being sent
+//
+bool LongMessageServiceEx::setStreamPacing(byte stream_id, byte min_interval, byte max_interval)
+{
+	for (byte i = 0; i < _num_send_contexts; i++)
+	{
+		if (_send_context[i].in_use && _send_context[i].send_stream_id == stream_id)
+		{
+			_send_context[i].min_interval = min_interval;
+			_send_context[i].max_interval = max_interval;
+			return true;
+		}
+	}
+	return false;
 }
 
 //
@@ -526,6 +983,7 @@ void LongMessageServiceEx::subscribe(byte *stream_ids, const byte num_stream_ids
 	_stream_ids = stream_ids;
 	_num_stream_ids = num_stream_ids;
 	_messagehandler = messagehandler;
+	_streamhandler = NULL;
 
 	// DEBUG_SERIAL << F("> Lex: subscribe: num_stream_ids = ") << num_stream_ids << endl;
 }
@@ -540,7 +998,7 @@ byte LongMessageServiceEx::is_sending()
 
 	for (i = 0, num_streams = 0; i < _num_send_contexts; i++)
   {
-    if (_send_context[i]->in_use)
+    if (_send_context[i].in_use)
     {
       ++num_streams;
 		}
@@ -549,25 +1007,97 @@ byte LongMessageServiceEx::is_sending()
 	return num_streams;
 }
 
+//
+/// set the send priority and weight for a stream
+/// lower priority values are more urgent. Fragments of a less urgent stream are only sent
+/// when no more urgent stream has a fragment due
+/// streams with the same priority share the bus in proportion to their weights
+/// returns false if there is no room for more streams
+//
+bool LongMessageServiceEx::setStreamPriority(byte stream_id, byte priority, byte weight)
+{
+	send_stream_t *stream = findStream(stream_id, true);
+	if (stream == NULL)
+	{
+		return false;
+	}
+
+	stream->priority = priority;
+	stream->weight = weight > 0 ? weight : 1;
+
+	// also apply to a message already being sent
+	for (byte i = 0; i < _num_send_contexts; i++)
+	{
+		if (_send_context[i].in_use && _send_context[i].send_stream_id == stream_id)
+		{
+			_send_context[i].priority = stream->priority;
+			_send_context[i].weight = stream->weight;
+		}
+	}
+	return true;
+}
+
+unsigned long LongMessageServiceEx::getStreamBytesSent(byte stream_id)
+{
+	send_stream_t *stream = findStream(stream_id, false);
+	return stream != NULL ? stream->bytes_sent : 0;
+}
+
+unsigned long LongMessageServiceEx::getStreamLatency(byte stream_id)
+{
+	send_stream_t *stream = findStream(stream_id, false);
+	return stream != NULL ? stream->last_latency : 0;
+}
+
+//
+/// find the priority and statistics for a stream, optionally adding the stream if it is new
+//
+send_stream_t *LongMessageServiceEx::findStream(byte stream_id, bool create)
+{
+	for (byte i = 0; i < _num_streams; i++)
+	{
+		if (_streams[i].stream_id == stream_id)
+		{
+			return &_streams[i];
+		}
+	}
+
+	if (!create || _num_streams >= LONG_MESSAGE_MAX_STREAMS)
+	{
+		return NULL;
+	}
+
+	send_stream_t *stream = &_streams[_num_streams++];
+	stream->stream_id = stream_id;
+	stream->priority = LONG_MESSAGE_DEFAULT_PRIORITY;
+	stream->weight = 1;
+	stream->bytes_sent = 0;
+	stream->last_latency = 0;
+	return stream;
+}
+
 //
 /// handle an incoming long message Controller message fragment
 //
 void LongMessageServiceEx::processReceivedMessageFragment(const VlcbMessage *frame)
 {
 	byte i, j, status;
-	uint16_t tmpcrc = 0;
 
 	// DEBUG_SERIAL << F("> Lex: handling incoming message fragment") << endl;
 	// DEBUG_SERIAL.flush();
 
-  if (frame->data[2] == 0)
+  if (frame->data[2] == 0 && frame->data[7] == LONG_MESSAGE_FLAG_NACK)
+  {
+    // a receiver of a message we are sending is missing some fragments
+    handleNack(frame);
+  }
+  else if (frame->data[2] == 0)
   {
     // sequence zero = a header packet with start of new stream
 
-    if (frame->data[7] == 0)
+    // flags = 0, standard message. Compressed messages are decompressed into the receive buffer
+    if (frame->data[7] == 0 || (frame->data[7] == LONG_MESSAGE_FLAG_COMPRESSED && _streamhandler == NULL))
     {
-      // flags = 0, standard message
-
       // DEBUG_SERIAL << F("> Lex: this is a data message header packet") << endl;
 
       for (i = 0; i < _num_stream_ids; i++)
@@ -581,7 +1111,7 @@ void LongMessageServiceEx::processReceivedMessageFragment(const VlcbMessage *fra
           // find a free receive context
           for (i = 0; i < _num_receive_contexts; i++)
           {
-            if (!_receive_context[i]->in_use)
+            if (!_receive_context[i].in_use)
             {
               // DEBUG_SERIAL << F("> Lex: using receive context = ") << i << endl;
               break;
@@ -590,16 +1120,29 @@ void LongMessageServiceEx::processReceivedMessageFragment(const VlcbMessage *fra
 
           if (i < _num_receive_contexts)
           {
-            _receive_context[i]->in_use = true;
-            _receive_context[i]->receive_stream_id = frame->data[1];
-            _receive_context[i]->incoming_message_length = (frame->data[3] << 8) + frame->data[4];
-            _receive_context[i]->incoming_message_crc = (frame->data[5] << 8) + frame->data[6];
-            _receive_context[i]->incoming_bytes_received = 0;
-            memset(_receive_context[i]->buffer, 0, _receive_buffer_len);
-            _receive_context[i]->receive_buffer_index = 0;
-            _receive_context[i]->expected_next_receive_sequence_num = 1;
-            _receive_context[i]->last_fragment_received = millis();
-            // DEBUG_SERIAL << F("> Lex: received header packet for stream id = ") << _receive_context[i]->receive_stream_id << F(", message length = ") << _receive_context[i]->incoming_message_length << endl;
+            _receive_context[i].in_use = true;
+            _receive_context[i].receive_stream_id = frame->data[1];
+            _receive_context[i].incoming_message_length = (frame->data[3] << 8) + frame->data[4];
+            _receive_context[i].incoming_message_crc = (frame->data[5] << 8) + frame->data[6];
+            _receive_context[i].running_crc = CRC16_INIT;
+            _receive_context[i].incoming_bytes_received = 0;
+            if (_receive_context[i].buffer != NULL)
+            {
+              memset(_receive_context[i].buffer, 0, _context_buffer_len);
+            }
+            _receive_context[i].receive_buffer_index = 0;
+            _receive_context[i].expected_next_receive_sequence_num = 1;
+            _receive_context[i].last_fragment_received = controller->getClock()->getMillis();
+            _receive_context[i].compressed = frame->data[7] == LONG_MESSAGE_FLAG_COMPRESSED;
+            _receive_context[i].decompressor = Decompressor();
+            // fragments can only be put in place as they arrive if the whole message fits in the buffer
+            // sequence numbers must not wrap to 0 as a NACK cannot request such fragments
+            _receive_context[i].recovering = _use_recovery && !_receive_context[i].compressed && _streamhandler == NULL
+                                             && _receive_context[i].incoming_message_length <= _context_buffer_len
+                                             && _receive_context[i].incoming_message_length <= LONG_MESSAGE_MAX_RECOVERY_LEN;
+            _receive_context[i].num_missing = 0;
+            _receive_context[i].last_nack_sent = _receive_context[i].last_fragment_received;
+            // DEBUG_SERIAL << F("> Lex: received header packet for stream id = ") << _receive_context[i].receive_stream_id << F(", message length = ") << _receive_context[i].incoming_message_length << endl;
           }
           else
           {
@@ -624,7 +1167,7 @@ void LongMessageServiceEx::processReceivedMessageFragment(const VlcbMessage *fra
     // find a matching receive context, using the stream ID and sender CANID
     for (i = 0; i < _num_receive_contexts; i++)
     {
-      if (_receive_context[i]->in_use && _receive_context[i]->receive_stream_id == frame->data[1])
+      if (_receive_context[i].in_use && _receive_context[i].receive_stream_id == frame->data[1])
       {
         // DEBUG_SERIAL << F("> Lex: found matching receive context = ") << i << endl;
         break;
@@ -638,13 +1181,53 @@ void LongMessageServiceEx::processReceivedMessageFragment(const VlcbMessage *fra
       return;
     }
 
+    if (_receive_context[i].recovering)
+    {
+      processRecoveryFragment(&_receive_context[i], frame);
+      return;
+    }
+
     // error if out of sequence
-    if (frame->data[2] != _receive_context[i]->expected_next_receive_sequence_num)
+    if (frame->data[2] != _receive_context[i].expected_next_receive_sequence_num)
+    {
+      // DEBUG_SERIAL << F("> Lex: ERROR: expected receive sequence num = ") << _receive_context[i].expected_next_receive_sequence_num << F(" but got = ") << frame->data[2] << endl;
+      reportReceiveError(_receive_context[i].buffer, _receive_context[i].receive_buffer_index, _receive_context[i].incoming_bytes_received,
+                         _receive_context[i].incoming_message_length, _receive_context[i].receive_stream_id, LONG_MESSAGE_SEQUENCE_ERROR);
+      _receive_context[i].in_use = false;
+      return;
+    }
+
+    if (_receive_context[i].compressed)
+    {
+      processCompressedFragment(&_receive_context[i], frame);
+      return;
+    }
+
+    // update the CRC as each fragment arrives so that there is little work left when the message is complete
+    if (_use_crc)
+    {
+      unsigned int remaining = _receive_context[i].incoming_message_length - _receive_context[i].incoming_bytes_received;
+      _receive_context[i].running_crc = crc16Update(_receive_context[i].running_crc, &frame->data[3], remaining < 5 ? remaining : 5);
+    }
+
+    if (_streamhandler != NULL)
     {
-      // DEBUG_SERIAL << F("> Lex: ERROR: expected receive sequence num = ") << _receive_context[i]->expected_next_receive_sequence_num << F(" but got = ") << frame->data[2] << endl;
-      (void) (*_messagehandler)(_receive_context[i]->buffer, _receive_context[i]->receive_buffer_index,
-                                _receive_context[i]->receive_stream_id, LONG_MESSAGE_SEQUENCE_ERROR);
-      _receive_context[i]->in_use = false;
+      // hand the data in this fragment straight to the user's handler
+      unsigned int remaining = _receive_context[i].incoming_message_length - _receive_context[i].incoming_bytes_received;
+      unsigned int len = remaining < 5 ? remaining : 5;
+      unsigned int offset = _receive_context[i].incoming_bytes_received;
+      _receive_context[i].incoming_bytes_received += len;
+      _receive_context[i].last_fragment_received = controller->getClock()->getMillis();
+
+      status = LONG_MESSAGE_INCOMPLETE;
+      if (_receive_context[i].incoming_bytes_received >= _receive_context[i].incoming_message_length)
+      {
+        status = checkReceivedCrc(&_receive_context[i]);
+        _receive_context[i].in_use = false;
+      }
+      (*_streamhandler)(&frame->data[3], len, offset, _receive_context[i].incoming_message_length,
+                        _receive_context[i].receive_stream_id, status);
+      ++_receive_context[i].expected_next_receive_sequence_num;
       return;
     }
 
@@ -652,51 +1235,37 @@ void LongMessageServiceEx::processReceivedMessageFragment(const VlcbMessage *fra
     for (j = 0; j < 5; j++)
     {
       // DEBUG_SERIAL << F("> Lex: consuming received data byte = ") << (char)frame->data[j + 3] << endl;
-      _receive_context[i]->buffer[_receive_context[i]->receive_buffer_index] = frame->data[j + 3];
-      ++_receive_context[i]->receive_buffer_index;
-      ++_receive_context[i]->incoming_bytes_received;
-      _receive_context[i]->last_fragment_received = millis();
+      _receive_context[i].buffer[_receive_context[i].receive_buffer_index] = frame->data[j + 3];
+      ++_receive_context[i].receive_buffer_index;
+      ++_receive_context[i].incoming_bytes_received;
+      _receive_context[i].last_fragment_received = controller->getClock()->getMillis();
 
       // if we have consumed the entire message, surface it to the user's handler
-      if (_receive_context[i]->incoming_bytes_received >= _receive_context[i]->incoming_message_length)
+      if (_receive_context[i].incoming_bytes_received >= _receive_context[i].incoming_message_length)
       {
         // DEBUG_SERIAL << F("> Lex: message data has been fully consumed") << endl;
 
-        if (_use_crc && _receive_context[i]->incoming_message_crc != 0)
-        {
-          // DEBUG_SERIAL << F("> Lex: calculating CRC16") << endl;
-          tmpcrc = crc16((uint8_t *) _receive_context[i]->buffer, _receive_context[i]->receive_buffer_index);
-        }
-
-        if (_receive_context[i]->incoming_message_crc != tmpcrc)
-        {
-          // DEBUG_SERIAL << F("> Lex: message CRC error, expected = ") << _receive_context[i]->incoming_message_crc << F(", calculated = ") << tmpcrc << endl;
-          status = LONG_MESSAGE_CRC_ERROR;
-        }
-        else
-        {
-          status = LONG_MESSAGE_COMPLETE;
-        }
+        status = checkReceivedCrc(&_receive_context[i]);
 
-        (void) (*_messagehandler)(_receive_context[i]->buffer, _receive_context[i]->receive_buffer_index,
-                                  _receive_context[i]->receive_stream_id, status);
-        _receive_context[i]->in_use = false;
+        (void) (*_messagehandler)(_receive_context[i].buffer, _receive_context[i].receive_buffer_index,
+                                  _receive_context[i].receive_stream_id, status);
+        _receive_context[i].in_use = false;
         break;
 
         // if the buffer is now full, give the user what we have with an error status
       }
-      else if (_receive_context[i]->receive_buffer_index >= _receive_buffer_len)
+      else if (_receive_context[i].receive_buffer_index >= _context_buffer_len)
       {
         // DEBUG_SERIAL << F("> Lex: buffer is now full, message truncated") << endl;
-        (void) (*_messagehandler)(_receive_context[i]->buffer, _receive_context[i]->receive_buffer_index,
-                                  _receive_context[i]->receive_stream_id, LONG_MESSAGE_TRUNCATED);
-        _receive_context[i]->in_use = false;
+        (void) (*_messagehandler)(_receive_context[i].buffer, _receive_context[i].receive_buffer_index,
+                                  _receive_context[i].receive_stream_id, LONG_MESSAGE_TRUNCATED);
+        _receive_context[i].in_use = false;
         break;
       }
     }
 
     // increment the expected next sequence number for this stream context
-    ++_receive_context[i]->expected_next_receive_sequence_num;
+    ++_receive_context[i].expected_next_receive_sequence_num;
 	}
 }
 
@@ -708,72 +1277,245 @@ void LongMessageServiceEx::use_crc(bool use_crc)
 	_use_crc = use_crc;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-//////// CRC implementations
-static uint32_t crc32(const byte *s, size_t n)
+//
+/// set whether to compress sent messages
+/// only use this if all receivers of the streams can decompress messages
+/// as other receivers ignore compressed messages
+//
+void LongMessageServiceEx::use_compression(bool use_compression)
 {
-	uint32_t crc = 0xFFFFFFFF;
+	_use_compression = use_compression;
+}
 
-  for (size_t i = 0; i < n; i++)
-  {
-    uint8_t ch = s[i];
-    for (size_t j = 0; j < 8; j++)
-    {
-      uint32_t b = (ch ^ crc) & 1;
-      crc >>= 1;
-      if (b)
-      { crc = crc ^ 0xEDB88320; }
-      ch >>= 1;
-    }
-  }
+//
+/// set whether to recover lost fragments
+/// a receiver requests missing fragments with a NACK message, i.e. a header message with the NACK flag
+/// that lists up to 4 missing sequence numbers. A sender keeps each message for recovery_window milliseconds
+/// after the last fragment to resend the requested fragments
+/// fragments are only resent after all fragments have been sent once, so receivers without recovery
+/// have finished with the message before any fragments are resent
+/// while a sent message is kept, another message on the same stream cannot be sent and the completion
+/// function of queued messages is called only when the message is released
+/// a receiver sends a NACK once the last fragment has arrived, so that receivers without recovery are not
+/// interrupted while they receive the message, or when no fragment has arrived for nack_interval milliseconds.
+/// This must be longer than the time between fragments from the sender, including any pacing delay, or
+/// fragments that are merely late are requested again. It should also be shorter than the receive timeout
+/// messages longer than LONG_MESSAGE_MAX_RECOVERY_LEN are not recovered as their sequence numbers wrap
+//
+void LongMessageServiceEx::use_recovery(bool use_recovery, unsigned int recovery_window, unsigned int nack_interval)
+{
+	_use_recovery = use_recovery;
+	_recovery_window = recovery_window;
+	_nack_interval = nack_interval;
+}
 
-  return ~crc;
+//
+/// put the data of a fragment in place in the receive buffer
+/// fragments may arrive out of order and any gaps are requested from the sender after the last fragment
+//
+void LongMessageServiceEx::processRecoveryFragment(receive_context_t *context, const VlcbMessage *frame)
+{
+	unsigned long now = controller->getClock()->getMillis();
+	unsigned int num_fragments = (context->incoming_message_length + 4) / 5;
+	unsigned int fragment;
+	byte ahead = frame->data[2] - lowByte(context->expected_next_receive_sequence_num);
+	context->last_fragment_received = now;
+
+	if (ahead < 128)
+	{
+		// a new fragment, any fragments skipped over are missing
+		fragment = context->expected_next_receive_sequence_num + ahead;
+		if (fragment > num_fragments)
+		{
+			return;
+		}
+		if (context->num_missing + ahead > LONG_MESSAGE_MAX_MISSING)
+		{
+			// DEBUG_SERIAL << F("> Lex: ERROR: too many missing fragments") << endl;
+			(void) (*_messagehandler)(context->buffer, context->receive_buffer_index, context->receive_stream_id, LONG_MESSAGE_SEQUENCE_ERROR);
+			context->in_use = false;
+			return;
+		}
+		for (unsigned int m = context->expected_next_receive_sequence_num; m < fragment; m++)
+		{
+			context->missing[context->num_missing++] = m;
+		}
+		context->expected_next_receive_sequence_num = fragment + 1;
+		// a NACK is a header message on the same stream, so wait until the sender has sent all fragments
+		// as a plain receiver still receiving the message would take it as a sequence error
+		if (fragment == num_fragments && context->num_missing > 0)
+		{
+			sendNack(context, now);
+		}
+	}
+	else
+	{
+		// a resent fragment, ignore it unless it is missing
+		fragment = context->expected_next_receive_sequence_num - (256 - ahead);
+		byte m;
+		for (m = 0; m < context->num_missing && context->missing[m] != fragment; m++)
+		{
+		}
+		if (m >= context->num_missing)
+		{
+			return;
+		}
+		--context->num_missing;
+		memmove(&context->missing[m], &context->missing[m + 1], (context->num_missing - m) * sizeof(context->missing[0]));
+	}
+
+	unsigned int offset = (fragment - 1) * 5;
+	unsigned int remaining = context->incoming_message_length - offset;
+	unsigned int len = remaining < 5 ? remaining : 5;
+	memcpy(context->buffer + offset, &frame->data[3], len);
+	context->incoming_bytes_received += len;
+
+	if (context->incoming_bytes_received >= context->incoming_message_length)
+	{
+		context->receive_buffer_index = context->incoming_message_length;
+		if (_use_crc)
+		{
+			context->running_crc = crc16Update(CRC16_INIT, context->buffer, context->receive_buffer_index);
+		}
+		(void) (*_messagehandler)(context->buffer, context->receive_buffer_index, context->receive_stream_id, checkReceivedCrc(context));
+		context->in_use = false;
+	}
+}
+
+//
+/// ask the sender to resend missing fragments, including any at the end of the message
+//
+void LongMessageServiceEx::sendNack(receive_context_t *context, unsigned long now)
+{
+	unsigned int num_fragments = (context->incoming_message_length + 4) / 5;
+	while (context->expected_next_receive_sequence_num <= num_fragments && context->num_missing < LONG_MESSAGE_MAX_MISSING
+	       && now - context->last_fragment_received >= _nack_interval)
+	{
+		context->missing[context->num_missing++] = context->expected_next_receive_sequence_num++;
+	}
+
+	for (byte m = 0; m < context->num_missing; m += 4)
+	{
+		VlcbMessage frame;
+		memset(&frame.data, 0, sizeof(frame.data));
+		frame.data[1] = context->receive_stream_id;
+		frame.data[2] = 0;
+		for (byte j = 0; j < 4 && m + j < context->num_missing; j++)
+		{
+			frame.data[j + 3] = lowByte(context->missing[m + j]);
+		}
+		frame.data[7] = LONG_MESSAGE_FLAG_NACK;
+		sendMessageFragment(&frame);
+		++_nacks_sent;
+	}
+	context->last_nack_sent = now;
 }
 
-/*
-//                                      16   12   5
-// this is the CCITT CRC 16 polynomial X  + X  + X  + 1.
-// This works out to be 0x1021, but the way the algorithm works
-// lets us use 0x8408 (the reverse of the bit pattern).  The high
-// bit is always assumed to be set, thus we only use 16 bits to
-// represent the 17 bit value.
-*/
+//
+/// queue the fragments a receiver is missing for resending
+//
+void LongMessageServiceEx::handleNack(const VlcbMessage *frame)
+{
+	if (!_use_recovery)
+	{
+		return;
+	}
 
-// http://stjarnhimlen.se/snippets/crc-16.c
+	for (byte i = 0; i < _num_send_contexts; i++)
+	{
+		send_context_t *context = &_send_context[i];
+		if (!context->in_use || context->send_stream_id != frame->data[1])
+		{
+			continue;
+		}
 
-#define POLY 0x8408
+		unsigned int num_fragments = (context->send_buffer_len + 4) / 5;
+		unsigned int num_sent = context->send_sequence_num - 1;
+		if (context->send_buffer_len > LONG_MESSAGE_MAX_RECOVERY_LEN)
+		{
+			// receivers do not recover messages with wrapped sequence numbers
+			continue;
+		}
+		for (byte j = 3; j < 7; j++)
+		{
+			if (frame->data[j] == 0)
+			{
+				continue;
+			}
+			// the most recently sent fragment with this sequence number
+			unsigned int fragment = num_sent - lowByte(num_sent - frame->data[j]);
+			if (fragment == 0 || fragment > num_fragments || context->num_resend >= LONG_MESSAGE_MAX_MISSING)
+			{
+				continue;
+			}
+			byte r;
+			for (r = 0; r < context->num_resend && context->resend[r] != fragment; r++)
+			{
+			}
+			if (r >= context->num_resend)
+			{
+				context->resend[context->num_resend++] = fragment;
+			}
+		}
+		return;
+	}
+}
 
-uint16_t crc16(uint8_t *data_p, uint16_t length)
+//
+/// decompress the data of a fragment into the receive buffer
+/// the header message length is the compressed length
+//
+void LongMessageServiceEx::processCompressedFragment(receive_context_t *context, const VlcbMessage *frame)
 {
-	uint8_t i;
-	uint16_t data;
-	uint16_t crc = 0xffff;
+	context->last_fragment_received = controller->getClock()->getMillis();
+	++context->expected_next_receive_sequence_num;
+
+	for (byte j = 0; j < 5 && context->incoming_bytes_received < context->incoming_message_length; j++)
+	{
+		++context->incoming_bytes_received;
+		if (!context->decompressor.put(frame->data[j + 3], context->buffer, _context_buffer_len))
+		{
+			// corrupt data is reported like a CRC error, otherwise the decompressed message does not fit the buffer
+			// DEBUG_SERIAL << F("> Lex: decompression failed") << endl;
+			byte status = context->decompressor.corrupt ? LONG_MESSAGE_CRC_ERROR : LONG_MESSAGE_TRUNCATED;
+			(void) (*_messagehandler)(context->buffer, context->decompressor.outIndex, context->receive_stream_id, status);
+			context->in_use = false;
+			return;
+		}
+	}
+	context->receive_buffer_index = context->decompressor.outIndex;
+
+	if (context->incoming_bytes_received >= context->incoming_message_length)
+	{
+		// the CRC is of the uncompressed message
+		context->running_crc = crc16Update(CRC16_INIT, context->buffer, context->receive_buffer_index);
+		byte status = context->decompressor.isComplete() ? checkReceivedCrc(context) : (byte)LONG_MESSAGE_CRC_ERROR;
+		(void) (*_messagehandler)(context->buffer, context->receive_buffer_index, context->receive_stream_id, status);
+		context->in_use = false;
+	}
+}
 
-  if (length == 0)
-  {
-    return (~crc);
-  }
+//
+/// check the CRC of a completely received message
+/// returns the status to give to the user's handler
+//
+byte LongMessageServiceEx::checkReceivedCrc(receive_context_t *context)
+{
+	uint16_t tmpcrc = 0;
 
-  do
-  {
-    for (i = 0, data = (uint16_t) 0xff & *data_p++;
-         i < 8;
-         i++, data >>= 1)
-    {
-      if ((crc & 0x0001) ^ (data & 0x0001))
-      {
-        crc = (crc >> 1) ^ POLY;
-      }
-      else
-      { crc >>= 1; }
-    }
-  } while (--length);
+	if (_use_crc && context->incoming_message_crc != 0)
+	{
+		// DEBUG_SERIAL << F("> Lex: calculating CRC16") << endl;
+		tmpcrc = crc16Final(context->running_crc);
+	}
 
-  crc = ~crc;
-  data = crc;
-  crc = (crc << 8) | (data >> 8 & 0xff);
+	if (context->incoming_message_crc != tmpcrc)
+	{
+		// DEBUG_SERIAL << F("> Lex: message CRC error, expected = ") << context->incoming_message_crc << F(", calculated = ") << tmpcrc << endl;
+		return LONG_MESSAGE_CRC_ERROR;
+	}
 
-  return (crc);
+	return LONG_MESSAGE_COMPLETE;
 }
 
-}
\ No newline at end of file
+}
@@ -6,6 +6,8 @@
 #pragma once
 
 #include "Service.h"
+#include "Transport.h"
+#include "Compression.h"
 #include <vlcbdefs.hpp>
 
 namespace VLCB
@@ -15,6 +17,15 @@ const int LONG_MESSAGE_DEFAULT_DELAY = 20;      // delay in milliseconds between
 const int LONG_MESSAGE_RECEIVE_TIMEOUT = 5000;  // timeout waiting for next long message packet
 const int NUM_EX_CONTEXTS = 4;                  // number of send and receive contexts for extended implementation = number of concurrent messages
 const int EX_BUFFER_LEN = 64;                   // size of extended send and receive buffers
+const byte LONG_MESSAGE_MAX_BURST = 4;          // max number of fragments sent in each call to process() with adaptive pacing
+const byte LONG_MESSAGE_MAX_STREAMS = 8;        // number of send streams with their own priority and statistics in the extended implementation
+const byte LONG_MESSAGE_DEFAULT_PRIORITY = 1;   // send priority, lower values are more urgent
+const byte LONG_MESSAGE_FLAG_COMPRESSED = 0x01; // header flag for a compressed message, see Compression.h
+const byte LONG_MESSAGE_FLAG_NACK = 0x80;       // header flag for a request to resend missing fragments
+const byte LONG_MESSAGE_MAX_MISSING = 8;        // number of missing fragments tracked per message with recovery
+const int LONG_MESSAGE_NACK_INTERVAL = 100;     // milliseconds without fragments before missing fragments are requested again
+const int LONG_MESSAGE_RECOVERY_WINDOW = 500;   // milliseconds a sent message is kept for resending missing fragments
+const unsigned int LONG_MESSAGE_MAX_RECOVERY_LEN = 255 * 5;  // longest message that can be recovered, sequence number 0 is only used by headers
 
 //
 /// Controller long message status codes
@@ -31,6 +42,18 @@ enum {
 
 struct VlcbMessage;
 
+//
+/// an entry in the queue of long messages waiting to be sent
+/// the message buffer must remain valid until the completion function has been called
+//
+
+struct send_queue_entry_t {
+  const void *buffer;
+  unsigned int length;
+  byte stream_id;
+  void (*completion)(const byte stream_id, const byte status);
+};
+
 //
 /// a basic class to send and receive Controller long messages per MERG RFC 0005
 /// See https://www.merg.org.uk/merg_wiki/doku.php?id=rfc:longmessageprotocol
@@ -45,11 +68,22 @@ public:
   virtual void process() override;
   virtual void processAction(const Action &action) override;
   bool sendLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id);
+  void setSendQueue(send_queue_entry_t *entries, const byte depth);
+  bool queueLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, void (*completion)(const byte stream_id, const byte status) = NULL);
+  byte getSendQueueUsage() const { return _send_queue_count; }
   void subscribe(byte *stream_ids, const byte num_stream_ids, void *receive_buffer, const unsigned int receive_buffer_len, void (*messagehandler)(void *fragment, const unsigned int fragment_len, const byte stream_id, const byte status));
+  void subscribeStreaming(byte *stream_ids, const byte num_stream_ids, void (*streamhandler)(const void *data, const unsigned int data_len, const unsigned int offset, const unsigned int message_len, const byte stream_id, const byte status));
   virtual void processReceivedMessageFragment(const VlcbMessage *frame);
   bool is_sending();
   void setDelay(byte delay_in_millis);
   void setTimeout(unsigned int timeout_in_millis);
+  void setAdaptivePacing(Transport *transport, byte min_interval = 0, byte max_interval = LONG_MESSAGE_DEFAULT_DELAY);
+
+  // statistics for sent messages
+  unsigned long getBytesSent() const { return _bytes_sent; }
+  unsigned int getFragmentsSent() const { return _fragments_sent; }
+  unsigned int getPacingBackoffs() const { return _pacing_backoffs; }
+  unsigned long getLastThroughput() const { return _last_throughput; }    // bytes per second for the last completed message
 
   virtual VlcbServiceTypes getServiceID() const override { return SERVICE_ID_STREAMING; }
   virtual byte getServiceVersionID() const override { return 1; }
@@ -57,7 +91,17 @@ public:
 protected:
 
   void handleMessage(const VlcbMessage *msg);
+  virtual bool startLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, void (*completion)(const byte stream_id, const byte status));
+  void sendQueuedMessages();
   bool sendMessageFragment(VlcbMessage *frame);
+  bool canSendFragment();
+  byte maxBurst();
+  unsigned int pacingInterval(byte min_interval, byte max_interval);
+  bool isFragmentDue(unsigned long last_fragment_sent, byte min_interval, byte max_interval, unsigned long now);
+  void countPacingBackoff(byte min_interval, byte max_interval);
+  void sendDataFragment(byte stream_id, byte sequence_num, const byte *buffer, unsigned int &buffer_index, unsigned int buffer_len);
+  void recordThroughput(unsigned int msg_len, unsigned long start_time, unsigned long now);
+  void reportReceiveError(byte *buffer, unsigned int buffer_index, unsigned int bytes_received, unsigned int message_len, byte stream_id, byte status);
 
   bool _is_receiving = false;
   byte *_send_buffer, *_receive_buffer;
@@ -66,9 +110,19 @@ protected:
   unsigned int _send_buffer_len = 0, _incoming_message_length = 0, _receive_buffer_len = 0, _receive_buffer_index = 0;
   unsigned int _send_buffer_index = 0, _incoming_message_crc = 0, _incoming_bytes_received = 0;
   unsigned int _receive_timeout = LONG_MESSAGE_RECEIVE_TIMEOUT, _send_sequence_num = 0, _expected_next_receive_sequence_num = 0;
-  unsigned long _last_fragment_sent = 0UL, _last_fragment_received = 0UL;
+  unsigned long _last_fragment_sent = 0UL, _last_fragment_received = 0UL, _send_start_time = 0UL;
+
+  Transport *_pacing_transport = NULL;
+  byte _min_interval = 0, _max_interval = LONG_MESSAGE_DEFAULT_DELAY;
+  unsigned long _bytes_sent = 0UL, _last_throughput = 0UL;
+  unsigned int _fragments_sent = 0, _pacing_backoffs = 0;
+
+  void (*_send_completion)(const byte stream_id, const byte status) = NULL;
+  send_queue_entry_t *_send_queue = NULL;
+  byte _send_queue_depth = 0, _send_queue_head = 0, _send_queue_count = 0;
 
   void (*_messagehandler)(void *fragment, const unsigned int fragment_len, const byte stream_id, const byte status);        // user callback function to receive long message fragments
+  void (*_streamhandler)(const void *data, const unsigned int data_len, const unsigned int offset, const unsigned int message_len, const byte stream_id, const byte status) = NULL;  // user callback function for each received fragment when streaming
 };
 
 
@@ -81,15 +135,52 @@ struct receive_context_t {
   byte receive_stream_id;
   byte *buffer;
   unsigned int receive_buffer_index, incoming_bytes_received, incoming_message_length, expected_next_receive_sequence_num, incoming_message_crc;
+  uint16_t running_crc;
   unsigned long last_fragment_received;
+  bool compressed;
+  Decompressor decompressor;
+  bool recovering;
+  byte num_missing;
+  unsigned int missing[LONG_MESSAGE_MAX_MISSING];
+  unsigned long last_nack_sent;
 };
 
 struct send_context_t {
   bool in_use;
-  byte send_stream_id, msg_delay;
+  byte send_stream_id, min_interval, max_interval;
+  byte priority, weight;
+  int deficit;
   byte *buffer;
   unsigned int send_buffer_len, send_buffer_index, send_sequence_num;
-  unsigned long last_fragment_sent;
+  unsigned long last_fragment_sent, start_time;
+  void (*completion)(const byte stream_id, const byte status);
+  byte num_resend;
+  unsigned int resend[LONG_MESSAGE_MAX_MISSING];
+};
+
+// send priority, weight and statistics per stream
+
+struct send_stream_t {
+  byte stream_id, priority, weight;
+  unsigned long bytes_sent, last_latency;
+};
+
+//
+/// number of bytes needed for LongMessageServiceEx contexts and receive buffers
+//
+constexpr size_t longMessageArenaSize(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts)
+{
+  return num_receive_contexts * (sizeof(receive_context_t) + receive_buffer_len) + num_send_contexts * sizeof(send_context_t);
+}
+
+//
+/// statically allocated memory for LongMessageServiceEx contexts, sized at compile time
+/// e.g. static LongMessageArena<4, 64, 4> arena; then call allocateContexts(arena)
+//
+template <byte NUM_RECEIVE_CONTEXTS, unsigned int RECEIVE_BUFFER_LEN, byte NUM_SEND_CONTEXTS>
+struct LongMessageArena
+{
+  alignas(receive_context_t) byte data[longMessageArenaSize(NUM_RECEIVE_CONTEXTS, RECEIVE_BUFFER_LEN, NUM_SEND_CONTEXTS)];
 };
 
 //
@@ -99,20 +190,66 @@ class LongMessageServiceEx : public LongMessageService
 {
 public:
 
+  virtual ~LongMessageServiceEx();
+
   bool allocateContexts(byte num_receive_contexts = NUM_EX_CONTEXTS, unsigned int receive_buffer_len = EX_BUFFER_LEN, byte num_send_contexts = NUM_EX_CONTEXTS);
-  bool sendLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id);
+  bool allocateContexts(void *arena, size_t arena_len, byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts);
+  template <byte NUM_RECEIVE_CONTEXTS, unsigned int RECEIVE_BUFFER_LEN, byte NUM_SEND_CONTEXTS>
+  bool allocateContexts(LongMessageArena<NUM_RECEIVE_CONTEXTS, RECEIVE_BUFFER_LEN, NUM_SEND_CONTEXTS> &arena)
+  {
+    return allocateContexts(arena.data, sizeof(arena.data), NUM_RECEIVE_CONTEXTS, RECEIVE_BUFFER_LEN, NUM_SEND_CONTEXTS);
+  }
   virtual void process() override;
   void subscribe(byte *stream_ids, const byte num_stream_ids, void (*messagehandler)(void *msg, unsigned int msg_len, byte stream_id, byte status));
   virtual void processReceivedMessageFragment(const VlcbMessage *frame);
   byte is_sending();
   void use_crc(bool use_crc);
+  void use_compression(bool use_compression);
+  unsigned long getCompressionSavings() const { return _compression_savings; }    // bytes not sent thanks to compression
+  void use_recovery(bool use_recovery, unsigned int recovery_window = LONG_MESSAGE_RECOVERY_WINDOW,
+                    unsigned int nack_interval = LONG_MESSAGE_NACK_INTERVAL);
+  unsigned int getFragmentsResent() const { return _fragments_resent; }
+  unsigned int getNacksSent() const { return _nacks_sent; }
+  bool setStreamPacing(byte stream_id, byte min_interval, byte max_interval);
+  bool setStreamPriority(byte stream_id, byte priority, byte weight = 1);
+
+  // statistics per sent stream, kept for streams given a priority with setStreamPriority()
+  unsigned long getStreamBytesSent(byte stream_id);
+  unsigned long getStreamLatency(byte stream_id);     // milliseconds from start to end of the last completed message
+
+protected:
+
+  virtual bool startLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, void (*completion)(const byte stream_id, const byte status)) override;
 
 private:
 
+  void releaseContexts();
+  send_context_t *nextScheduledContext(unsigned long now);
+  void sendNextFragment(send_context_t *context, unsigned long now);
+  void resendFragment(send_context_t *context, unsigned long now);
+  void releaseSendContext(send_context_t *context);
+  send_stream_t *findStream(byte stream_id, bool create);
+  byte checkReceivedCrc(receive_context_t *context);
+  void processCompressedFragment(receive_context_t *context, const VlcbMessage *frame);
+  void processRecoveryFragment(receive_context_t *context, const VlcbMessage *frame);
+  void sendNack(receive_context_t *context, unsigned long now);
+  void handleNack(const VlcbMessage *frame);
+
   bool _use_crc = false;
-  byte _num_receive_contexts = NUM_EX_CONTEXTS, _num_send_contexts = NUM_EX_CONTEXTS;
-  receive_context_t **_receive_context = NULL;
-  send_context_t **_send_context = NULL;
+  bool _use_compression = false;
+  unsigned long _compression_savings = 0UL;
+  bool _use_recovery = false;
+  unsigned int _recovery_window = LONG_MESSAGE_RECOVERY_WINDOW;
+  unsigned int _nack_interval = LONG_MESSAGE_NACK_INTERVAL;
+  unsigned int _fragments_resent = 0, _nacks_sent = 0;
+  byte _num_receive_contexts = 0, _num_send_contexts = 0;
+  unsigned int _context_buffer_len = 0;    // length of each receive context buffer, the subscribed receive buffer is not used
+  receive_context_t *_receive_context = NULL;
+  send_context_t *_send_context = NULL;
+  byte *_owned_arena = NULL;
+  byte _next_send_context = 0;
+  send_stream_t _streams[LONG_MESSAGE_MAX_STREAMS];
+  byte _num_streams = 0;
 };
 
 }
\ No newline at end of file
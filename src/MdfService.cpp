@@ -0,0 +1,81 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#include "MdfService.h"
+#include "Controller.h"
+#include "LongMessageService.h"
+
+namespace VLCB
+{
+
+MdfService::MdfService(LongMessageDispatcher & dispatcher, const byte *mdf, unsigned int mdfLen, MdfFormat format,
+                       byte *buffer, unsigned int bufferLen, byte streamId)
+  : dispatcher(dispatcher)
+  , longMessageService(dispatcher.getLongMessageService())
+  , mdf(mdf)
+  , mdfLen(mdfLen)
+  , format(format)
+  , buffer(buffer)
+  , bufferLen(bufferLen)
+  , streamId(streamId)
+{
+}
+
+void MdfService::begin()
+{
+  dispatcher.registerHandler(streamId, this);
+}
+
+void MdfService::handleLongMessage(const void *msg, unsigned int msgLen, byte status)
+{
+  const byte *data = (const byte *)msg;
+  if (status != LONG_MESSAGE_COMPLETE || msgLen < 3 || data[0] != MDF_CMD_READ
+      || !isThisNodeNumber(Configuration::getTwoBytes(&data[1])))
+  {
+    return;
+  }
+
+  nextOffset = msgLen >= 5 ? Configuration::getTwoBytes(&data[3]) : 0;
+  if (nextOffset > mdfLen)
+  {
+    nextOffset = mdfLen;
+  }
+  sending = bufferLen > MDF_MESSAGE_HEADER_LEN;
+  ++requestCount;
+}
+
+void MdfService::process()
+{
+  // The plain LongMessageService sends straight from the buffer so wait until it is done.
+  // LongMessageServiceEx copies the message and is never busy here.
+  // A message in the send queue is still in the buffer.
+  if (!sending || longMessageService.is_sending() || longMessageService.getSendQueueUsage() > 0)
+  {
+    return;
+  }
+
+  unsigned int len = mdfLen - nextOffset;
+  if (len > bufferLen - MDF_MESSAGE_HEADER_LEN)
+  {
+    len = bufferLen - MDF_MESSAGE_HEADER_LEN;
+  }
+
+  buffer[0] = MDF_CMD_DATA;
+  Configuration::setTwoBytes(&buffer[1], controller->getModuleConfig()->nodeNum);
+  buffer[3] = format;
+  Configuration::setTwoBytes(&buffer[4], nextOffset);
+  Configuration::setTwoBytes(&buffer[6], mdfLen);
+  memcpy_P(buffer + MDF_MESSAGE_HEADER_LEN, mdf + nextOffset, len);
+
+  // Try again later if the long message service has no free send context.
+  if (longMessageService.sendLongMessage(buffer, MDF_MESSAGE_HEADER_LEN + len, streamId))
+  {
+    nextOffset += len;
+    ++partsSent;
+    sending = nextOffset < mdfLen;
+  }
+}
+
+}
@@ -0,0 +1,90 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#pragma once
+
+#include "Service.h"
+#include "LongMessageDispatcher.h"
+#include <vlcbdefs.hpp>
+
+namespace VLCB
+{
+
+// Default long message stream ID used for module data files.
+const byte MDF_STREAM_ID = 0xC1;
+// Bytes before the data in a data message: command, node number, format, offset and total length.
+const byte MDF_MESSAGE_HEADER_LEN = 8;
+
+/// Commands in the first byte of a module data file message.
+/// The command is followed by the node number of the module.
+enum MdfCommand : byte
+{
+  MDF_CMD_READ = 1,   ///< Request the module data file, optionally followed by a start offset.
+  MDF_CMD_DATA = 2    ///< A part of the module data file sent by the module.
+};
+
+/// Format of the module data file as stored in the module.
+enum MdfFormat : byte
+{
+  MDF_FORMAT_JSON = 0,            ///< Plain JSON text.
+  MDF_FORMAT_COMPRESSED_JSON = 1  ///< JSON text compressed with VLCB::compress(), see Compression.h.
+};
+
+/// @brief Service that sends the module data file (MDF) to a configuration tool.
+///
+/// The MDF describes the NVs and events of the module. Configuration tools use it
+/// to build their user interface. With this service the tool can read the MDF from
+/// the module itself instead of looking it up by module ID and version.
+///
+/// The MDF is stored in program memory (PROGMEM) so that it uses no RAM, normally
+/// compressed to save flash and transfer time. Use the host tool mdfToProgmem to
+/// convert an MDF JSON file to a C array.
+///
+/// Messages are sent on one long message stream. A tool requests the MDF with
+/// MDF_CMD_READ and the node number, optionally followed by a two byte offset to
+/// continue an earlier transfer. The module sends the MDF in parts that fit the buffer.
+/// Each part is a message with:
+/// * MDF_CMD_DATA, node number, MdfFormat
+/// * offset of this part and total length of the stored MDF, two bytes each
+/// * the data
+class MdfService : public Service, public LongMessageHandler
+{
+public:
+  MdfService(LongMessageDispatcher & dispatcher, const byte *mdf, unsigned int mdfLen, MdfFormat format,
+             byte *buffer, unsigned int bufferLen, byte streamId = MDF_STREAM_ID);
+
+  /// Handle a complete long message for the MDF stream.
+  virtual void handleLongMessage(const void *msg, unsigned int msgLen, byte status) override;
+  /// True while parts of the MDF remain to be sent.
+  bool isSending() const { return sending; }
+
+  unsigned int getRequestCount() const { return requestCount; }
+  unsigned int getPartsSent() const { return partsSent; }
+
+  /// @cond LIBRARY
+  virtual void begin() override;
+  virtual void process() override;
+  virtual VlcbServiceTypes getServiceID() const override { return SERVICE_ID_NONE; }
+  virtual byte getServiceVersionID() const override { return 1; }
+  /// @endcond
+
+private:
+  LongMessageDispatcher & dispatcher;
+  LongMessageService & longMessageService;
+  const byte *mdf;
+  unsigned int mdfLen;
+  MdfFormat format;
+  byte *buffer;
+  unsigned int bufferLen;
+  byte streamId;
+
+  bool sending = false;
+  unsigned int nextOffset = 0;
+
+  unsigned int requestCount = 0;
+  unsigned int partsSent = 0;
+};
+
+}
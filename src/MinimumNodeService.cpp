@@ -102,12 +102,13 @@ void MinimumNodeService::heartbeat()
 {
   if ((controller->getModuleConfig()->currentMode == MODE_NORMAL) && !noHeartbeat && instantMode != MODE_SETUP)
   {
-    if ((millis() - lastHeartbeat) > heartRate)
+    unsigned long now = controller->getClock()->getMillis();
+    if ((now - lastHeartbeat) > heartRate)
     {
       //DEBUG_SERIAL << F("> HeartBeat = ") << heartbeatSequence << endl;
       controller->sendMessageWithNN(OPC_HEARTB, heartbeatSequence, 0, 0);  // 0 to be replaced by diagnostic status      
       heartbeatSequence++;
-      lastHeartbeat = millis();
+      lastHeartbeat = now;
     }
   }  
 }
@@ -338,7 +339,10 @@ void MinimumNodeService::handleRequestNodeParameter(const VlcbMessage *msg, unsi
 
     if ((paran == 0) && notFcuCompatible)
     {
-      controller->addTimedResponseTask(new RespondParam(controller));
+      if (!controller->addTimedResponseTask<RespondParam>(controller))
+      {
+        controller->deferRequest(this, msg);
+      }
     }
     else if (paran <= controller->getParam(PAR_NUM))
     {
@@ -430,12 +434,17 @@ void MinimumNodeService::handleRequestServiceDefinitions(const VlcbMessage *msg,
   byte serviceIndex = msg->data[3];
   if (serviceIndex == 0)
   {
-    // Request for summary of services. First a service count
+    // Request for summary of services. Details of each service are sent by a task.
+    // The task is added first so that nothing is sent if the request must be deferred.
+    if (!controller->addTimedResponseTask<RespondService>(controller))
+    {
+      controller->deferRequest(this, msg);
+      return;
+    }
+
+    // First a service count.
     int serviceCount = countServices(controller->getServices());
     controller->sendMessageWithNN(OPC_SD, 0, 0, serviceCount);
-
-    // and then details of each service.
-    controller->addTimedResponseTask(new RespondService(controller));
   }
   else if (serviceIndex <= controller->getServices().size())
   {
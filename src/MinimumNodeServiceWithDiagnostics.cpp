@@ -51,7 +51,8 @@ public:
 class AllServiceDiagnosticsResponse : public TimedResponse::Task
 {
   int serviceIndex;
-  ServiceDiagnosticsResponse * svcResponder = nullptr;
+  int diagnosticCount = 0; // Number of diagnostics for current service. 0 when service is not started.
+  int diagnosticIndex = 0; // Index of next diagnostic to report for current service.
 public:
   AllServiceDiagnosticsResponse(Controller * controller) 
     : Task(controller), serviceIndex(0)
@@ -59,6 +60,8 @@ public:
 
   TimedResponse::Result nextService()
   {
+    diagnosticCount = 0;
+    diagnosticIndex = 0;
     if (++serviceIndex >= controller->getServices().size())
     {
       return TimedResponse::FINISHED;
@@ -68,20 +71,19 @@ public:
 
   TimedResponse::Result runStep() override
   {
-    if (svcResponder == nullptr)
+    Service * svc = controller->getServices()[serviceIndex];
+    if (diagnosticCount == 0)
     {
-      Service * svc = controller->getServices()[serviceIndex];
       if (svc->getServiceID() == 0)
       {
         // Not a real service, skip it.
         return nextService();
       }
-      int diagnosticCount = svc->getDiagnosticCount();
+      diagnosticCount = svc->getDiagnosticCount();
       controller->sendDGN(serviceIndex + 1, 0, diagnosticCount);
       if (diagnosticCount > 0)
       {
-        // Create a responder for this service.
-        svcResponder = new ServiceDiagnosticsResponse(controller, svc, serviceIndex + 1, diagnosticCount);
+        // Report the diagnostics for this service in the following steps.
         return TimedResponse::PROGRESS;
       }
       else
@@ -90,25 +92,13 @@ public:
         return nextService();
       }
     }
-    TimedResponse::Result result = svcResponder->runStep();
-    switch (result)
+    svc->reportDiagnostics(serviceIndex + 1, ++diagnosticIndex);
+    if (diagnosticIndex >= diagnosticCount)
     {
-      case TimedResponse::RETRY:
-        return TimedResponse::RETRY;
-        
-      case TimedResponse::PROGRESS:
-        // Move on to next diagnostic.
-        svcResponder->sequence++;
-        return TimedResponse::PROGRESS;
-
-      case TimedResponse::FINISHED:
-        // This service is complete. Go to next service.
-        delete svcResponder;
-        svcResponder = nullptr;
-        return nextService();
+      // This service is complete. Go to next service.
+      return nextService();
     }
-    // Shouldn't happen. Keep the warnings quiet.
-    return result;
+    return TimedResponse::PROGRESS;
   }
 };
 
@@ -136,7 +126,10 @@ void MinimumNodeServiceWithDiagnostics::handleRequestDiagnostics(const VlcbMessa
   if (serviceIndex == 0)
   {
     // Request for diagnostics for all services.
-    controller->addTimedResponseTask(new AllServiceDiagnosticsResponse(controller));
+    if (!controller->addTimedResponseTask<AllServiceDiagnosticsResponse>(controller))
+    {
+      controller->deferRequest(this, msg);
+    }
   }
   else
   {
@@ -152,11 +145,14 @@ void MinimumNodeServiceWithDiagnostics::handleRequestDiagnostics(const VlcbMessa
     if (diagnosticCode == 0)
     {
       int diagnosticCount = svc->getDiagnosticCount();
-      controller->sendDGN(serviceIndex, 0, diagnosticCount);
-      if (diagnosticCount > 0)
+      // The task is added before the count is sent so that nothing is sent if the request is deferred.
+      if (diagnosticCount > 0
+          && !controller->addTimedResponseTask<ServiceDiagnosticsResponse>(controller, svc, serviceIndex, diagnosticCount))
       {
-        controller->addTimedResponseTask(new ServiceDiagnosticsResponse(controller, svc, serviceIndex, diagnosticCount));
+        controller->deferRequest(this, msg);
+        return;
       }
+      controller->sendDGN(serviceIndex, 0, diagnosticCount);
     }
     else
     {
@@ -171,10 +167,10 @@ void MinimumNodeServiceWithDiagnostics::reportDiagnostics(byte serviceIndex, byt
   switch (diagnosticsCode)
   {
     case 0x02: // Uptime upper word
-      diagnosticsValue = ((millis() / 1000) >> 16) & 0xFFFF;
+      diagnosticsValue = ((controller->getClock()->getMillis() / 1000) >> 16) & 0xFFFF;
       break;
     case 0x03: // Uptime lower word
-      diagnosticsValue = (millis() / 1000) & 0xFFFF;
+      diagnosticsValue = (controller->getClock()->getMillis() / 1000) & 0xFFFF;
       break;
     case 0x05: // Node Number changes
       diagnosticsValue = diagNodeNumberChanges;
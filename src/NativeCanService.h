@@ -0,0 +1,58 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#pragma once
+
+#include "CanService.h"
+#include "NativeCanTransport.h"
+
+namespace VLCB
+{
+
+/// @brief CanService that works directly with the frame type of a NativeCanTransport.
+///
+/// Incoming frames are copied straight from the transport's receive buffer to
+/// the VlcbMessage on the action queue.
+/// Outgoing frames are built directly in the transport's frame type.
+/// This avoids the intermediate CANFrame copy of CanService.
+/// Frames are read in an inlined loop so there is no virtual call per frame.
+///
+/// Use the Base parameter to add diagnostics:
+/// ~~~
+/// NativeCanService<CANMessage, CanServiceWithDiagnostics> canService(&transport);
+/// ~~~
+template <typename Frame, typename Base = CanService, typename Traits = CanFrameTraits<Frame> >
+class NativeCanService : public Base
+{
+public:
+  NativeCanService(NativeCanTransport<Frame, Traits> * tpt) : Base(tpt), nativeTransport(tpt) {}
+
+protected:
+  /// @cond LIBRARY
+  virtual void checkIncomingCanFrames() override
+  {
+    this->readIncomingFrames([this]()
+    {
+      const Frame * frame = nativeTransport->peekNativeFrame();
+      bool activity = this->handleIncomingFrame(Traits::id(*frame), Traits::ext(*frame), Traits::rtr(*frame),
+                                                Traits::len(*frame), Traits::data(*frame));
+      nativeTransport->popNativeFrame();
+      return activity;
+    });
+  }
+
+  virtual bool transmitFrame(uint32_t id, bool rtr, byte len, const byte *data) override
+  {
+    Frame frame;
+    Traits::set(frame, id, rtr, len, data);
+    return nativeTransport->sendNativeFrame(frame);
+  }
+  /// @endcond
+
+private:
+  NativeCanTransport<Frame, Traits> * nativeTransport;
+};
+
+}
@@ -0,0 +1,82 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#pragma once
+
+#include <string.h>
+#include "CanTransport.h"
+
+namespace VLCB
+{
+
+/// @cond LIBRARY
+/// @brief Access to the fields of a CAN frame type used by a CAN driver.
+///
+/// This default works for any frame type with the members id, ext, rtr, len and data,
+/// such as CANFrame and the CANMessage class of the ACAN libraries.
+/// Specialise this template for frame types with other members.
+template <typename Frame>
+struct CanFrameTraits
+{
+  static uint32_t id(const Frame & frame) { return frame.id; }
+  static bool ext(const Frame & frame) { return frame.ext; }
+  static bool rtr(const Frame & frame) { return frame.rtr; }
+  static uint8_t len(const Frame & frame) { return frame.len; }
+  static const uint8_t * data(const Frame & frame) { return frame.data; }
+
+  /// Fill in a standard frame.
+  static void set(Frame & frame, uint32_t id, bool rtr, uint8_t len, const uint8_t * data)
+  {
+    frame.id = id;
+    frame.ext = false;
+    frame.rtr = rtr;
+    frame.len = len;
+    memcpy(frame.data, data, len);
+  }
+};
+
+/// @brief Base class for CAN transports that give access to frames in their own frame type.
+///
+/// Used together with NativeCanService, incoming frames are read directly from
+/// the driver's receive buffer and outgoing frames are built directly in the
+/// driver's frame type without going through CANFrame.
+///
+/// The CanTransport functions that use CANFrame are implemented here so that
+/// a NativeCanTransport can also be used with a plain CanService.
+template <typename Frame, typename Traits = CanFrameTraits<Frame> >
+class NativeCanTransport : public CanTransport
+{
+public:
+  /// Get the next incoming frame without removing it from the receive buffer.
+  /// Call available() first to ensure there is a frame.
+  virtual const Frame * peekNativeFrame() = 0;
+  /// Remove the frame returned by peekNativeFrame() from the receive buffer.
+  virtual void popNativeFrame() = 0;
+  /// Send a frame to the CAN bus. Returns false if the frame cannot be accepted.
+  virtual bool sendNativeFrame(const Frame & frame) = 0;
+
+  virtual CANFrame getNextCanFrame() override
+  {
+    const Frame * frame = peekNativeFrame();
+    CANFrame canFrame;
+    canFrame.id = Traits::id(*frame);
+    canFrame.ext = Traits::ext(*frame);
+    canFrame.rtr = Traits::rtr(*frame);
+    canFrame.len = Traits::len(*frame);
+    memcpy(canFrame.data, Traits::data(*frame), canFrame.len);
+    popNativeFrame();
+    return canFrame;
+  }
+
+  virtual bool sendCanFrame(CANFrame *msg) override
+  {
+    Frame frame;
+    Traits::set(frame, msg->id, msg->rtr, msg->len, msg->data);
+    return sendNativeFrame(frame);
+  }
+};
+/// @endcond
+
+}
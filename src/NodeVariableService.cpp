@@ -90,11 +90,13 @@ void NodeVariableService::handleReadNV(const VlcbMessage *msg, unsigned int nn)
 
   if (nvindex == 0)
   {
-    controller->sendMessageWithNN(OPC_NVANS, nvindex, module_config->getNumNodeVariables());
-    if (!module_config->fcuCompatible)
+    // The task is added before the first response so that nothing is sent if the request is deferred.
+    if (!module_config->fcuCompatible && !controller->addTimedResponseTask<RespondNodeVar>(controller))
     {
-      controller->addTimedResponseTask(new RespondNodeVar(controller));
+      controller->deferRequest(this, msg);
+      return;
     }
+    controller->sendMessageWithNN(OPC_NVANS, nvindex, module_config->getNumNodeVariables());
   }
   else
   {
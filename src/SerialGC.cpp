@@ -26,88 +26,146 @@ namespace VLCB
 
 
   //
-  // parse incoming characters & assemble message
-  // return true if valid message assembled & ready
+  // parse all incoming characters that have arrived & assemble messages
+  // return true if one or more valid messages are ready
   //
   bool SerialGC::available()
   {
-    bool result = false;
-    static int rxIndex = 0;
-    if (serial.available())
-    {     
-      char c = serial.read();
-      c = toupper(c);
+    writeQueuedFrames();
+
+    // Stop reading when the frame queue is full and leave the rest in the serial buffer.
+    for (int count = serial.available(); count > 0 && rxQueue.bufUse() < RX_FRAME_QUEUE_SIZE; --count)
+    {
+      parseCharacter(toupper(serial.read()));
+    }
+    return rxQueue.available();
+  }
+
+  //
+  // feed one character to the GridConnect parser
+  // a decoded frame is put on the frame queue
+  //
+  void SerialGC::parseCharacter(char c)
+  {
+    //
+    // if 'start of message' already seen, save the character, and check for 'end of message'
+    if (rxIndex > 0)
+    {
+      rxBuffer[rxIndex++] = c;
       //
-      // if 'start of message' already seen, save the character, and check for 'end of message'
-      if (rxIndex > 0) 
+      // check for 'end of message'
+      if (c == ';')
       {
-        rxBuffer[rxIndex++] = c;
-        // check if end of buffer reached, and restart if so
-        if (rxIndex >= RXBUFFERSIZE) 
+        rxBuffer[rxIndex] = '\0';     // null terminate
+        rxIndex = 0;
+        // We have received a message between a ':' and a ';', so increment count
+        receivedCount++;
+        CANFrame frame;
+        if (decodeGridConnect(rxBuffer, &frame))
         {
-          rxIndex = 0;
+          rxQueue.put(frame);
         }
-        //
-        // check for 'end of message'
-        if (c == ';')
+        else
         {
-          rxBuffer[rxIndex++] = '\0';     // null terminate
-          rxIndex = 0;
-          result = true;
+          // must have been an error in the message, so increment error counter
+          receiveErrorCount++;
         }
+        return;
       }
-      //
-      // always check for 'start of message'
-      if (c == ':') 
+      // check if end of buffer reached, and restart if so
+      if (rxIndex >= RXBUFFERSIZE - 1)
       {
-        rxIndex = 0;                    // restart at beginning of buffer
-        rxBuffer[rxIndex++] = c;
+        rxIndex = 0;
       }
     }
     //
-    if (result) 
+    // always check for 'start of message'
+    if (c == ':')
     {
-      // We have received a message between a ':' and a ';', so increment count
-      receivedCount++;
-      result = decodeGridConnect(rxBuffer, &rxCANFrame);
-      if (!result)
-      {
-        // must have been an error in the message, so increment error counter
-        receiveErrorCount++;
-      }
+      rxIndex = 0;                    // restart at beginning of buffer
+      rxBuffer[rxIndex++] = c;
     }
-    return result;
   }
 
 
   //
-  /// get the available CANMessage
+  /// get the next available CANMessage
   /// must call available first to ensure there is something to get
   //
   CANFrame SerialGC::getNextCanFrame()
   {
-    return rxCANFrame;
+    return rxQueue.pop();
   }
 
 
   //
-  /// send a CANMessage message in GridConnect format
+  /// queue a CANMessage message in GridConnect format for sending
+  /// returns false if the transmit queue is full
   // see Gridconnect format at beginning of file for byte positions
   //
   bool SerialGC::sendCanFrame(CANFrame *frame)
   {
+    writeQueuedFrames();
+    if (txQueue.bufUse() >= TX_FRAME_QUEUE_SIZE)
+    {
+      return false;
+    }
+
     transmitCount++;
-    bool result = encodeGridConnect(txBuffer, frame);
+    GcFrame gcFrame;
+    bool result = encodeGridConnect(gcFrame.text, frame);
     if (result)
     {
-      // output the message
-      serial.print(txBuffer);
+      txQueue.put(gcFrame);
+      writeQueuedFrames();
     }
     else
     {
       transmitErrorCount++;
     }
-   return result;
+    return result;
+  }
+
+  //
+  // write as much of the queued frames as the serial port can take without blocking
+  // if the port reports no room for TX_STALL_TIMEOUT ms then write one frame per call anyway,
+  // as many Arduino cores do not implement availableForWrite() and always return 0
+  //
+  void SerialGC::writeQueuedFrames()
+  {
+    while (txQueue.available())
+    {
+      const char * text = txQueue.peek()->text + txOffset;
+      size_t length = strlen(text);
+      int room = serial.availableForWrite();
+      if (room <= 0)
+      {
+        if (!txStalled)
+        {
+          txStalled = true;
+          txStallStart = millis();
+        }
+        else if (millis() - txStallStart >= TX_STALL_TIMEOUT)
+        {
+          // this write may block
+          serial.write(text, length);
+          txQueue.pop();
+          txOffset = 0;
+        }
+        return;
+      }
+      txStalled = false;
+      if ((size_t)room < length)
+      {
+        // write what fits now and the rest later
+        serial.write(text, room);
+        txOffset += room;
+        return;
+      }
+      serial.write(text, length);
+      txQueue.pop();
+      txOffset = 0;
+    }
   }
 
   //
@@ -115,5 +173,10 @@ namespace VLCB
   //
   void SerialGC::reset()
   {
+    rxIndex = 0;
+    rxQueue.clear();
+    txQueue.clear();
+    txOffset = 0;
+    txStalled = false;
   }
 }
\ No newline at end of file
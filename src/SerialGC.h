@@ -11,6 +11,7 @@
 #include <Controller.h>
 #include <CanTransport.h>
 #include <GridConnect.h>
+#include <CircularBuffer.h>
 
 namespace VLCB
 {
@@ -19,9 +20,20 @@ namespace VLCB
 
   // grid connect should be 28 characters maximum
   static const int RXBUFFERSIZE = 30;
+  // number of decoded frames waiting to be read
+  static const int RX_FRAME_QUEUE_SIZE = 4;
+  // number of encoded frames waiting to be written to the serial port
+  static const int TX_FRAME_QUEUE_SIZE = 4;
+  // milliseconds the serial port may report no room before a frame is written anyway
+  static const unsigned int TX_STALL_TIMEOUT = 20;
 
   /// @brief Implementation of the Transport interface class
   /// to support the gridconnect protocol over serial connection
+  ///
+  /// Outgoing frames are written when serial.availableForWrite() reports room.
+  /// If it reports no room for TX_STALL_TIMEOUT ms, one frame is written per call
+  /// regardless, which may block. This keeps frames flowing on cores that do not
+  /// implement availableForWrite().
   class SerialGC : public CanTransport
   {
   public:
@@ -37,29 +49,41 @@ namespace VLCB
 
     virtual unsigned int receiveCounter() override { return receivedCount; }
     virtual unsigned int transmitCounter() override { return transmitCount; }
-    virtual unsigned int receiveBufferSize() override { return RXBUFFERSIZE; }
-    virtual unsigned int transmitBufferSize() override { return RXBUFFERSIZE; }
+    virtual unsigned int receiveBufferSize() override { return RX_FRAME_QUEUE_SIZE; }
+    virtual unsigned int transmitBufferSize() override { return TX_FRAME_QUEUE_SIZE; }
     virtual unsigned int receiveErrorCounter() override { return receiveErrorCount; }
     virtual unsigned int transmitErrorCounter() override { return transmitErrorCount; }
-    virtual unsigned int receiveBufferUsage() override { return 0; };
-    virtual unsigned int transmitBufferUsage() override { return 0; };
-    virtual unsigned int receiveBufferPeak() override { return 0; };
-    virtual unsigned int transmitBufferPeak() override { return 0; };
+    virtual unsigned int receiveBufferUsage() override { return rxQueue.bufUse(); };
+    virtual unsigned int transmitBufferUsage() override { return txQueue.bufUse(); };
+    virtual unsigned int receiveBufferPeak() override { return rxQueue.getHighWaterMark(); };
+    virtual unsigned int transmitBufferPeak() override { return txQueue.getHighWaterMark(); };
     virtual unsigned int errorStatus() override { return 0; }
     /// @endcond
 
   private:
+    // A GridConnect frame as text
+    struct GcFrame
+    {
+      char text[RXBUFFERSIZE];
+    };
+
     Stream& serial;
 	
     char rxBuffer[RXBUFFERSIZE]; // Define a byte array to store the incoming data
-    char txBuffer[RXBUFFERSIZE]; // Define a byte array to store the outgoing data
-    CANFrame rxCANFrame;
+    byte rxIndex = 0;            // Next position in rxBuffer, 0 when waiting for start of message
+    CircularBuffer<GcFrame, TX_FRAME_QUEUE_SIZE> txQueue;
+    byte txOffset = 0;           // Characters of the first frame in txQueue already written
+    bool txStalled = false;      // Serial port has reported no room since txStallStart
+    unsigned long txStallStart = 0;
+    CircularBuffer<CANFrame, RX_FRAME_QUEUE_SIZE> rxQueue;
 
     unsigned int receivedCount = 0;
     unsigned int transmitCount = 0;
     unsigned int receiveErrorCount = 0;
     unsigned int transmitErrorCount = 0;
 
+    void parseCharacter(char c);
+    void writeQueuedFrames();
     void debugCANMessage(CANFrame frame);
 
   };
@@ -73,8 +73,8 @@ void Switch::run()
 
     _lastState = _currentState;
     _prevStateDuration = _lastStateDuration;
-    _lastStateDuration = millis() - _lastStateChangeTime;
-    _lastStateChangeTime = millis();
+    _lastStateDuration = _clock->getMillis() - _lastStateChangeTime;
+    _lastStateChangeTime = _clock->getMillis();
     _stateChanged = true;
 
     if (_currentState == _pressedState)
@@ -127,7 +127,7 @@ unsigned long Switch::getCurrentStateDuration()
 {
   // how long has the switch been in its current state ?
   // DEBUG_SERIAL << F("  -- current state duration = ") << (millis() - _lastStateChangeTime) << endl;
-  return (millis() - _lastStateChangeTime);
+  return (_clock->getMillis() - _lastStateChangeTime);
 }
 
 unsigned long Switch::getLastStateDuration()
@@ -147,7 +147,7 @@ unsigned long Switch::getLastStateChangeTime()
 void Switch::resetCurrentDuration()
 {
   // reset the state duration counter
-  _lastStateChangeTime = millis();
+  _lastStateChangeTime = _clock->getMillis();
 }
 
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 #endif
 
 #include <Arduino.h>            // for definition of byte datatype
+#include "Clock.h"
 
 namespace VLCB
 {
@@ -32,6 +33,9 @@ public:
   unsigned long getLastStateChangeTime();
   void resetCurrentDuration();
 
+  /// Set the clock used to time state durations.
+  void setClock(Clock * clock) { _clock = clock; }
+
 protected:
   byte readPin();
   byte _pin;
@@ -43,6 +47,7 @@ protected:
   unsigned long _lastStateDuration;
   unsigned long _prevReleaseTime;
   unsigned long _prevStateDuration;
+  Clock * _clock = getDefaultClock();
 };
 
 }
\ No newline at end of file
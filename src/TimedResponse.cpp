@@ -11,9 +11,9 @@ namespace VLCB
 
 static const int TASK_INTERVAL = 5; // Same interval as VLCBlib_PIC
 
-void TimedResponse::process()
+void TimedResponse::process(unsigned long now)
 {
-  if (lastTaskTime + TASK_INTERVAL > millis())
+  if (lastTaskTime + TASK_INTERVAL > now)
   {
     // Not time yet for next task step.
     return;
@@ -23,7 +23,7 @@ void TimedResponse::process()
   {
     Task * task = *tasks.peek();
     Result result = task->runStep();
-    lastTaskTime = millis();
+    lastTaskTime = now;
 
     switch (result)
     {
@@ -36,11 +36,46 @@ void TimedResponse::process()
         break;
 
       case FINISHED:
-        delete task;
         tasks.pop();
+        releaseTask(task);
         break;
     }
   }
 }
 
-}
\ No newline at end of file
+void * TimedResponse::allocateSlot()
+{
+  for (uint8_t i = 0; i < TIMED_RESPONSE_POOL_SIZE; ++i)
+  {
+    if (!bitRead(slotInUse, i))
+    {
+      bitSet(slotInUse, i);
+      if (++slotsUsed > slotsHighWaterMark)
+      {
+        slotsHighWaterMark = slotsUsed;
+      }
+      return slots[i].bytes;
+    }
+  }
+
+  ++allocationFailures;
+  return nullptr;
+}
+
+void TimedResponse::releaseTask(Task * task)
+{
+  // The task object may not start at the beginning of its slot, so find the slot that contains it.
+  unsigned char * p = reinterpret_cast<unsigned char *>(task);
+  task->~Task();
+  for (uint8_t i = 0; i < TIMED_RESPONSE_POOL_SIZE; ++i)
+  {
+    if (p >= slots[i].bytes && p < slots[i].bytes + TASK_SLOT_SIZE)
+    {
+      bitClear(slotInUse, i);
+      --slotsUsed;
+      return;
+    }
+  }
+}
+
+}
@@ -5,23 +5,38 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#ifdef ARDUINO_ARCH_AVR
+#include <new.h>
+#else
+#include <new>
+#endif
 #include "CircularBuffer.h"
+#include "VlcbMessage.h"
 
 namespace VLCB
 {
 
 class Controller;
 
+// Number of tasks that can be queued at the same time.
+const int TIMED_RESPONSE_POOL_SIZE = 4;
+
 /// @brief Manage tasks that respond with messages at timed intervals
-/// 
+///
 /// Users of this class add a task that sends a response message each time
 /// it is called.
 /// This avoids sending messages faster than the transport object can send them.
+///
+/// Tasks are constructed in a fixed size pool of slots to avoid heap usage.
+/// Each slot is large enough for the largest task type in the library.
+/// Adding a task type that doesn't fit a slot gives a compile error.
 class TimedResponse
 {
 public:
   enum Result { PROGRESS, RETRY, FINISHED };
-  
+
   class Task
   {
   public:
@@ -33,21 +48,64 @@ public:
   protected:
     Controller *controller;
   };
-  
-  void add(Task * task)
+
+  // Layout of the largest task type in the library, RespondEV in EventTeachingService.
+  // It is only used to size the pool slots and is never instantiated.
+  struct LargestTask : Task
   {
-    tasks.put(task);
+    void * configuration;
+    VlcbMessage response;
+    uint8_t eventIndex;
+  };
+  static const size_t TASK_SLOT_SIZE = sizeof(LargestTask);
+
+  /// Create a task of type T in a free pool slot and queue it.
+  /// The arguments are passed on to the constructor of T.
+  /// Returns false if there is no free slot.
+  template <typename T, typename... Args>
+  bool add(Args &&... args)
+  {
+    static_assert(sizeof(T) <= TASK_SLOT_SIZE, "Task type is too large for a TimedResponse pool slot");
+    void * slot = allocateSlot();
+    if (slot == nullptr)
+    {
+      return false;
+    }
+    tasks.put(new (slot) T(static_cast<Args &&>(args)...));
+    return true;
   }
-  
-  void process();
-  
+
+  /// Run the next step of the first task if it is time. now is the current time in milliseconds.
+  void process(unsigned long now);
+
   bool pendingTasks() const
   {
     return tasks.available();
   }
 
+  // Diagnostic metrics access
+  unsigned int getPoolUsage() const { return slotsUsed; }
+  unsigned int getPoolHighWaterMark() const { return slotsHighWaterMark; }
+  unsigned int getAllocationFailures() const { return allocationFailures; }
+
 private:
-  CircularBuffer<Task *> tasks;
+  void * allocateSlot();
+  void releaseTask(Task * task);
+
+  union Slot
+  {
+    unsigned char bytes[TASK_SLOT_SIZE];
+    void * alignPointer;
+    long alignLong;
+  };
+
+  Slot slots[TIMED_RESPONSE_POOL_SIZE];
+  uint8_t slotInUse = 0; // Bitmask of used slots.
+  uint8_t slotsUsed = 0;
+  uint8_t slotsHighWaterMark = 0;
+  unsigned int allocationFailures = 0;
+
+  CircularBuffer<Task *, TIMED_RESPONSE_POOL_SIZE> tasks;
   unsigned long lastTaskTime = 0;
 };
 
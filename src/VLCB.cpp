@@ -163,9 +163,9 @@ bool sendMessageWithNN(VlcbOpCodes opc, byte b1, byte b2, byte b3, byte b4, byte
   return controller.sendMessageWithNN(opc, b1, b2, b3, b4, b5);
 }
 
-void addTimedResponseTask(TimedResponse::Task *task)
+Controller & getController()
 {
-  controller.addTimedResponseTask(task);
+  return controller;
 }
 
 unsigned int getFreeEEPROMbase()
@@ -21,6 +21,9 @@
 #include <EventTeachingServiceWithDiagnostics.h>
 #include <EventSlotTeachingService.h>
 #include <LongMessageService.h>
+#include <LongMessageDispatcher.h>
+#include <ConfigTransferService.h>
+#include <MdfService.h>
 #include <SerialUserInterface.h>
 
 /// # VLCB API
@@ -134,7 +137,16 @@ bool sendMessageWithNN(VlcbOpCodes opc, byte b1, byte b2, byte b3);
 bool sendMessageWithNN(VlcbOpCodes opc, byte b1, byte b2, byte b3, byte b4);
 bool sendMessageWithNN(VlcbOpCodes opc, byte b1, byte b2, byte b3, byte b4, byte b5);
 
-void addTimedResponseTask(TimedResponse::Task * task);
+/// Access to the Controller object that is used by the VLCB functions.
+Controller & getController();
+
+/// Create a task of type `T` that sends messages at timed intervals.
+/// The arguments are passed on to the constructor of `T`.
+template <typename T, typename... Args>
+bool addTimedResponseTask(Args &&... args)
+{
+  return getController().addTimedResponseTask<T>(static_cast<Args &&>(args)...);
+}
 
 void resetModule();
 
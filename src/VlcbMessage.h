@@ -0,0 +1,22 @@
+// Copyright (C) Sven Rosvall (sven@rosvall.ie)
+// This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+// Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+// The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace VLCB
+{
+
+//
+/// CAN/Controller message type
+//
+struct VlcbMessage
+{
+  uint8_t len; // Value 0-7 or FF for messages handled in CanTransport
+  uint8_t data[8];
+};
+
+}
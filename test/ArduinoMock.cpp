@@ -37,17 +37,21 @@ PinState getDigitalWrite(int pin)
         return digitalWrittenValues[pin];
 }
 
-unsigned long nextMillis;
+unsigned long nextMicros;
 void addMillis(unsigned long newMillis)
 {
-        nextMillis += newMillis;
+        nextMicros += newMillis * 1000;
+}
+void addMicros(unsigned long newMicros)
+{
+        nextMicros += newMicros;
 }
 
 void clearArduinoValues()
 {
         digitalReadValues.clear();
         analogWrittenValues.clear();
-        nextMillis = 0L;
+        nextMicros = 0L;
 }
 
 /* Arduino methods */
@@ -77,11 +81,15 @@ void pinMode(int pin, PinMode mode)
 
 unsigned long millis()
 {
-        return nextMillis;
+        return nextMicros / 1000;
+}
+unsigned long micros()
+{
+        return nextMicros;
 }
 void delay(unsigned int delayMillis)
 {
-  nextMillis += delayMillis;
+  nextMicros += delayMillis * 1000UL;
 }
 
 int map(int value, int fromLower, int fromUpper, int toLower, int toUpper)
@@ -107,9 +115,9 @@ void Stream::begin(int baudRate)
 {
 }
 
-bool Stream::available()
+int Stream::available()
 {
-        return true;
+        return 1;
 }
 
 char Stream::read()
@@ -117,6 +125,16 @@ char Stream::read()
         return ' ';
 }
 
+int Stream::availableForWrite()
+{
+        return 64;
+}
+
+size_t Stream::write(const char *, size_t size)
+{
+        return size;
+}
+
 void Stream::print(const char *)
 {
 }
@@ -6,5 +6,6 @@ int getAnalogWrite(int pin);
 PinState getDigitalWrite(int pin);
 
 void addMillis(unsigned long millis);
+void addMicros(unsigned long micros);
 
 void clearArduinoValues();
@@ -21,6 +21,19 @@ VLCB::CANFrame MockCanTransport::getNextCanFrame()
 
 bool MockCanTransport::sendCanFrame(VLCB::CANFrame *frame)
 {
+  if (rejectSentFrames)
+  {
+    return false;
+  }
+  if (sentFrameLossPercent > 0)
+  {
+    lossSeed = lossSeed * 1103515245UL + 12345UL;
+    if ((lossSeed >> 16) % 100 < sentFrameLossPercent)
+    {
+      ++lostSentFrames;
+      return true;
+    }
+  }
   sent_frames.push_back(*frame);
   return true;
 }
@@ -32,6 +45,11 @@ void MockCanTransport::reset()
 
 void MockCanTransport::setNextMessage(VLCB::CANFrame frame)
 {
+  if (receiveBufferLimit > 0 && incoming_frames.size() >= receiveBufferLimit)
+  {
+    ++receiveOverruns;
+    return;
+  }
   incoming_frames.push_back(frame);
 }
 
@@ -29,9 +29,9 @@ public:
   virtual unsigned int receiveErrorCounter() override { return 0; }
   virtual unsigned int transmitErrorCounter() override { return 0; }
   virtual unsigned int receiveBufferSize() override { return 0; };
-  virtual unsigned int transmitBufferSize() override { return 0; };
+  virtual unsigned int transmitBufferSize() override { return transmitBufferSizeValue; };
   virtual unsigned int receiveBufferUsage() override { return 0; };
-  virtual unsigned int transmitBufferUsage() override { return 0; };
+  virtual unsigned int transmitBufferUsage() override { return transmitBufferUsageValue; };
   virtual unsigned int receiveBufferPeak() override { return 0; };
   virtual unsigned int transmitBufferPeak() override { return 0; };
   virtual unsigned int errorStatus() override { return 0; }
@@ -39,6 +39,25 @@ public:
   void setNextMessage(VLCB::CANFrame frame);
   void clearMessages();
 
+  // Simulate a receive buffer of limited size in the CAN driver.
+  // Frames arriving when the buffer is full are dropped and counted as overruns.
+  // Size 0 means unlimited.
+  unsigned int receiveBufferLimit = 0;
+  unsigned int receiveOverruns = 0;
+
+  // Simulate a full transmit buffer in the CAN driver. Sent frames are rejected while set.
+  bool rejectSentFrames = false;
+
+  // Simulate frames lost on the bus. Each sent frame is lost with this probability
+  // using a repeatable pseudo random sequence. Lost frames are not added to sent_frames.
+  unsigned int sentFrameLossPercent = 0;
+  unsigned int lostSentFrames = 0;
+  unsigned long lossSeed = 1;
+
+  // Reported transmit buffer size and usage.
+  unsigned int transmitBufferSizeValue = 0;
+  unsigned int transmitBufferUsageValue = 0;
+
   std::deque<VLCB::CANFrame> incoming_frames;
   std::vector<VLCB::CANFrame> sent_frames;
 };
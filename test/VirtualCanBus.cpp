@@ -0,0 +1,282 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#include <algorithm>
+#include <string.h>
+#include "VirtualCanBus.h"
+#include "ArduinoMock.hpp"
+#include "Parameters.h"
+
+VirtualCanTransport::VirtualCanTransport(VirtualCanBus & bus, unsigned int rxBufferSize, unsigned int txBufferSize)
+  : bus(bus), rxBufferSize(rxBufferSize), txBufferSize(txBufferSize)
+{
+  bus.attach(this);
+}
+
+VLCB::CANFrame VirtualCanTransport::getNextCanFrame()
+{
+  VLCB::CANFrame frame = rxFrames.front();
+  rxFrames.pop_front();
+  return frame;
+}
+
+bool VirtualCanTransport::sendCanFrame(VLCB::CANFrame *frame)
+{
+  if (txFrames.size() >= txBufferSize)
+  {
+    ++transmitRejects;
+    return false;
+  }
+  txFrames.push_back({*frame, micros()});
+  if (txFrames.size() > txPeak)
+  {
+    txPeak = txFrames.size();
+  }
+  return true;
+}
+
+void VirtualCanTransport::reset()
+{
+  rxFrames.clear();
+  txFrames.clear();
+}
+
+void VirtualCanTransport::deliver(const VLCB::CANFrame & frame)
+{
+  if (rxFrames.size() >= rxBufferSize)
+  {
+    ++receiveOverruns;
+    return;
+  }
+  rxFrames.push_back(frame);
+  ++received;
+  if (rxFrames.size() > rxPeak)
+  {
+    rxPeak = rxFrames.size();
+  }
+}
+
+VirtualCanNode::VirtualCanNode(VirtualCanBus & bus, unsigned int nodeNumber, byte canId, unsigned long loopPeriod)
+  : configuration(&storage)
+  , transport(bus)
+  , canService(&transport)
+  , controller(&configuration)
+  , loopPeriod(loopPeriod)
+{
+  configuration.EE_NVS_START = 10;
+  configuration.setNumNodeVariables(4);
+  configuration.EE_EVENTS_START = 20;
+  configuration.setNumEvents(20);
+  configuration.setNumEVs(2);
+  configuration.begin();
+  configuration.setModuleNormalMode(nodeNumber);
+  configuration.setCANID(canId);
+  // Scenarios send their own traffic.
+  configuration.setHeartbeat(false);
+
+  controller.setServices({&minimumNodeService, &canService});
+  controller.getParams().setVersion(1, 1, 'a');
+  controller.getParams().setModuleId(253);
+  controller.updateParamFlags();
+  controller.begin();
+}
+
+VirtualCanBus::VirtualCanBus(unsigned long bitrate, unsigned long loopPeriod)
+  : bitrate(bitrate), loopPeriod(loopPeriod)
+{
+}
+
+VirtualCanNode & VirtualCanBus::addNode(unsigned int nodeNumber, byte canId)
+{
+  // Spread the loop periods by up to 10% so that nodes drift relative to each other.
+  unsigned long period = loopPeriod + (nodes.size() * 37) % (loopPeriod / 10 + 1);
+  nodes.emplace_back(new VirtualCanNode(*this, nodeNumber, canId, period));
+  nodes.back()->nextLoop = micros();
+  return *nodes.back();
+}
+
+void VirtualCanBus::run(unsigned long duration)
+{
+  unsigned long end = micros() + duration;
+  while (micros() < end)
+  {
+    step();
+  }
+}
+
+bool VirtualCanBus::runUntilIdle(unsigned long maxDuration)
+{
+  unsigned long end = micros() + maxDuration;
+  while (micros() < end)
+  {
+    step();
+    if (!busy && !framesPending())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned int VirtualCanBus::frameBits(const VLCB::CANFrame & frame)
+{
+  // SOF, arbitration, control, data, CRC, ACK and EOF fields.
+  unsigned int dataBits = frame.rtr ? 0 : 8 * frame.len;
+  unsigned int bits = (frame.ext ? 64 : 44) + dataBits;
+  // Bit stuffing applies from SOF to the end of the CRC. Worst case is one stuff bit per 4 bits.
+  unsigned int stuffedBits = (frame.ext ? 54 : 34) + dataBits;
+  // Inter frame space.
+  return bits + (stuffedBits - 1) / 4 + 3;
+}
+
+unsigned long VirtualCanBus::frameTime(const VLCB::CANFrame & frame) const
+{
+  return (frameBits(frame) * 1000000UL + bitrate - 1) / bitrate;
+}
+
+bool VirtualCanBus::framesPending() const
+{
+  for (VirtualCanTransport * transport : transports)
+  {
+    if (!transport->txFrames.empty())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Advance time to the next thing that happens on the bus or in a node.
+void VirtualCanBus::step()
+{
+  unsigned long now = micros();
+  if (busy && now >= current.completedAt)
+  {
+    completeFrame();
+  }
+
+  for (auto & node : nodes)
+  {
+    if (now >= node->nextLoop)
+    {
+      node->controller.process();
+      node->nextLoop = now + node->loopPeriod;
+    }
+  }
+
+  if (!busy)
+  {
+    startFrame(now);
+  }
+
+  unsigned long next = now + loopPeriod;
+  for (auto & node : nodes)
+  {
+    if (node->nextLoop < next)
+    {
+      next = node->nextLoop;
+    }
+  }
+  if (busy && current.completedAt < next)
+  {
+    next = current.completedAt;
+  }
+  addMicros(next > now ? next - now : 1);
+}
+
+// Compare two frames as CAN arbitration does. Returns negative if a wins.
+static int arbitrate(const VLCB::CANFrame & a, const VLCB::CANFrame & b)
+{
+  if (a.id != b.id)
+  {
+    return a.id < b.id ? -1 : 1;
+  }
+  // Same ID. A data frame wins over a remote frame.
+  if (a.rtr != b.rtr)
+  {
+    return a.rtr ? 1 : -1;
+  }
+  // On real hardware different frames with the same ID cause bit errors and
+  // retransmissions. This simulation lets the frame with the lower content win.
+  if (a.len != b.len)
+  {
+    return a.len < b.len ? -1 : 1;
+  }
+  return a.rtr ? 0 : memcmp(a.data, b.data, a.len);
+}
+
+void VirtualCanBus::startFrame(unsigned long now)
+{
+  currentSenders.clear();
+  for (VirtualCanTransport * transport : transports)
+  {
+    if (transport->txFrames.empty())
+    {
+      continue;
+    }
+    const VLCB::CANFrame & frame = transport->txFrames.front().frame;
+    int order = currentSenders.empty() ? -1 : arbitrate(frame, current.frame);
+    if (order < 0)
+    {
+      if (!currentSenders.empty() && frame.id == current.frame.id)
+      {
+        ++idCollisions;
+      }
+      currentSenders.clear();
+      current.frame = frame;
+      current.sender = transport;
+      current.queuedAt = transport->txFrames.front().queuedAt;
+    }
+    else if (order > 0 && frame.id == current.frame.id)
+    {
+      ++idCollisions;
+    }
+    if (order <= 0)
+    {
+      currentSenders.push_back(transport);
+    }
+  }
+  if (currentSenders.empty())
+  {
+    return;
+  }
+
+  for (VirtualCanTransport * transport : transports)
+  {
+    if (!transport->txFrames.empty()
+        && std::find(currentSenders.begin(), currentSenders.end(), transport) == currentSenders.end())
+    {
+      ++transport->arbitrationLosses;
+    }
+  }
+
+  busy = true;
+  current.startedAt = now;
+  current.completedAt = now + frameTime(current.frame);
+}
+
+void VirtualCanBus::completeFrame()
+{
+  busy = false;
+  ++framesTransmitted;
+  busyTime += current.completedAt - current.startedAt;
+
+  for (VirtualCanTransport * sender : currentSenders)
+  {
+    sender->txFrames.pop_front();
+    ++sender->transmitted;
+  }
+  for (VirtualCanTransport * transport : transports)
+  {
+    if (std::find(currentSenders.begin(), currentSenders.end(), transport) == currentSenders.end())
+    {
+      transport->deliver(current.frame);
+    }
+  }
+  if (frameObserver)
+  {
+    frameObserver(current);
+  }
+}
@@ -0,0 +1,175 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "CanTransport.h"
+#include "CanService.h"
+#include "Configuration.h"
+#include "Controller.h"
+#include "MinimumNodeService.h"
+#include "MockStorage.h"
+
+// Simulation of a CAN bus with many VLCB nodes in one process.
+//
+// Time is virtual. The bus advances the mocked micros()/millis() clock from one
+// event to the next, i.e. when a frame has been transmitted or when a node shall
+// run its loop. Nothing depends on wall clock time so results are deterministic and
+// a simulated second takes much less than a real second.
+//
+// The bus models:
+// * Arbitration on the 11 bit ID. The lowest ID wins. Frames with equal IDs from
+//   different transmitters continue arbitration on RTR, length and data.
+//   Identical frames from several transmitters are sent as one frame.
+// * Frame timing from the bitrate and the number of bits in the frame including
+//   worst case bit stuffing.
+// * Receive and transmit buffers of limited size in each CAN controller.
+
+class VirtualCanBus;
+
+// A CAN controller attached to the virtual bus.
+// Use it directly to inject and inspect frames, or use it as transport in a VirtualCanNode.
+class VirtualCanTransport : public VLCB::CanTransport
+{
+public:
+  VirtualCanTransport(VirtualCanBus & bus, unsigned int rxBufferSize = 2, unsigned int txBufferSize = 3);
+
+  virtual bool available() override { return !rxFrames.empty(); }
+  virtual VLCB::CANFrame getNextCanFrame() override;
+  virtual bool sendCanFrame(VLCB::CANFrame *frame) override;
+  virtual byte getHardwareType() override { return 0; }
+
+  virtual void reset() override;
+
+  virtual unsigned int receiveCounter() override { return received; }
+  virtual unsigned int transmitCounter() override { return transmitted; }
+  virtual unsigned int receiveErrorCounter() override { return receiveOverruns; }
+  virtual unsigned int transmitErrorCounter() override { return transmitRejects; }
+  virtual unsigned int receiveBufferSize() override { return rxBufferSize; }
+  virtual unsigned int transmitBufferSize() override { return txBufferSize; }
+  virtual unsigned int receiveBufferUsage() override { return rxFrames.size(); }
+  virtual unsigned int transmitBufferUsage() override { return txFrames.size(); }
+  virtual unsigned int receiveBufferPeak() override { return rxPeak; }
+  virtual unsigned int transmitBufferPeak() override { return txPeak; }
+  virtual unsigned int errorStatus() override { return 0; }
+
+  // Number of times this controller had a frame ready but another frame won the bus.
+  unsigned int getArbitrationLosses() const { return arbitrationLosses; }
+
+private:
+  friend class VirtualCanBus;
+
+  struct PendingFrame
+  {
+    VLCB::CANFrame frame;
+    unsigned long queuedAt;
+  };
+
+  VirtualCanBus & bus;
+  unsigned int rxBufferSize;
+  unsigned int txBufferSize;
+  std::deque<VLCB::CANFrame> rxFrames;
+  std::deque<PendingFrame> txFrames;
+
+  unsigned int received = 0;
+  unsigned int transmitted = 0;
+  unsigned int receiveOverruns = 0;
+  unsigned int transmitRejects = 0;
+  unsigned int rxPeak = 0;
+  unsigned int txPeak = 0;
+  unsigned int arbitrationLosses = 0;
+
+  void deliver(const VLCB::CANFrame & frame);
+};
+
+// A VLCB node with its own configuration and storage on the virtual bus.
+// It has a CanService and a MinimumNodeService. Tests may add more services
+// with controller.setServices().
+struct VirtualCanNode
+{
+  VirtualCanNode(VirtualCanBus & bus, unsigned int nodeNumber, byte canId, unsigned long loopPeriod);
+
+  MockStorage storage;
+  VLCB::Configuration configuration;
+  VirtualCanTransport transport;
+  VLCB::CanService canService;
+  VLCB::MinimumNodeService minimumNodeService;
+  VLCB::Controller controller;
+
+  // Time between calls to controller.process().
+  unsigned long loopPeriod;
+  unsigned long nextLoop = 0;
+};
+
+// A frame that has been transmitted on the bus.
+struct BusFrame
+{
+  VLCB::CANFrame frame;
+  VirtualCanTransport * sender;
+  unsigned long queuedAt;    // When the frame was given to the CAN controller.
+  unsigned long startedAt;   // When the frame won arbitration.
+  unsigned long completedAt; // When the frame was received by the other controllers.
+};
+
+class VirtualCanBus
+{
+public:
+  // Nodes run their loop every loopPeriod microseconds. Each node gets a slightly
+  // different period so that they do not run in lockstep.
+  explicit VirtualCanBus(unsigned long bitrate = 125000, unsigned long loopPeriod = 200);
+
+  // Create a node and start it.
+  VirtualCanNode & addNode(unsigned int nodeNumber, byte canId);
+  VirtualCanNode & getNode(unsigned int index) { return *nodes[index]; }
+  unsigned int getNodeCount() const { return nodes.size(); }
+
+  // Called for each frame that has been transmitted on the bus.
+  void setFrameObserver(std::function<void(const BusFrame &)> observer) { frameObserver = observer; }
+
+  // Run the simulation for the given number of microseconds.
+  void run(unsigned long duration);
+  // Run until no frames are waiting to be sent, or at most the given number of microseconds.
+  // Returns true if the bus became idle.
+  bool runUntilIdle(unsigned long maxDuration);
+
+  // Number of bits on the bus for a frame including worst case stuff bits and inter frame space.
+  static unsigned int frameBits(const VLCB::CANFrame & frame);
+  // Time in microseconds to transmit a frame.
+  unsigned long frameTime(const VLCB::CANFrame & frame) const;
+
+  unsigned int getFramesTransmitted() const { return framesTransmitted; }
+  // Number of arbitrations where different frames had the same 11 bit ID.
+  unsigned int getIdCollisions() const { return idCollisions; }
+  // Time in microseconds that the bus has been busy.
+  unsigned long getBusyTime() const { return busyTime; }
+
+private:
+  friend class VirtualCanTransport;
+
+  void attach(VirtualCanTransport * transport) { transports.push_back(transport); }
+  void step();
+  void startFrame(unsigned long now);
+  void completeFrame();
+  bool framesPending() const;
+
+  unsigned long bitrate;
+  unsigned long loopPeriod;
+  std::vector<VirtualCanTransport *> transports;
+  std::vector<std::unique_ptr<VirtualCanNode>> nodes;
+  std::function<void(const BusFrame &)> frameObserver;
+
+  // Frame currently on the bus, and all transmitters sending an identical frame.
+  bool busy = false;
+  BusFrame current;
+  std::vector<VirtualCanTransport *> currentSenders;
+
+  unsigned int framesTransmitted = 0;
+  unsigned int idCollisions = 0;
+  unsigned long busyTime = 0;
+};
@@ -0,0 +1,158 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+// Host benchmark of long message compression. Reports the compression ratio,
+// the number of CAN frames needed and the time to compress and decompress for
+// a configuration image and the example MDF files.
+// The incompressible input shows the worst case time of compress(), which runs
+// synchronously in LongMessageServiceEx::sendLongMessage(). For this input an
+// estimate of the time on a 16MHz AVR is also reported.
+// Run with an optional iteration count and MDF directory:
+//   benchmarkCompression [iterations [mdfDirectory]]
+
+#include <chrono>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "Compression.h"
+
+#ifndef MDF_DIR
+#define MDF_DIR "examples/MDF"
+#endif
+
+namespace
+{
+
+// Number of CAN frames for a long message: one header and 5 bytes per fragment.
+unsigned int frames(unsigned int len)
+{
+  return 1 + (len + 4) / 5;
+}
+
+// A configuration image like ConfigTransferService makes with a few events stored
+// and unused NVs left as 0xFF.
+std::vector<byte> makeConfigImage()
+{
+  std::vector<byte> image = {1, 16, 32, 4};
+  for (int nv = 0; nv < 16; ++nv)
+  {
+    image.push_back(nv < 6 ? nv * 3 : 0xFF);
+  }
+  image.push_back(6);
+  for (int e = 0; e < 6; ++e)
+  {
+    image.insert(image.end(), {(byte)e, 0x01, 0x04, 0x00, (byte)(e + 1), 1, 0, 0xFF, 0xFF});
+  }
+  image.insert(image.end(), {0x12, 0x34});
+  return image;
+}
+
+// Pseudo random bytes that do not compress. This is the slowest input for compress()
+// as it searches the whole window at each position without finding a match.
+std::vector<byte> makeIncompressible(unsigned int len)
+{
+  std::vector<byte> data;
+  uint32_t x = 2463534242UL;
+  for (unsigned int i = 0; i < len; ++i)
+  {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    data.push_back(x);
+  }
+  return data;
+}
+
+// Number of window positions compress() tries for input with no matches.
+unsigned long searchSteps(unsigned int len)
+{
+  unsigned long steps = 0;
+  for (unsigned int in = 0; in < len; ++in)
+  {
+    steps += in < VLCB::COMPRESSION_WINDOW ? in : VLCB::COMPRESSION_WINDOW;
+  }
+  return steps;
+}
+
+// Rough cost of one window position in the compress() search loop on AVR.
+const unsigned long AVR_CYCLES_PER_STEP = 20;
+const unsigned long AVR_CLOCK_MHZ = 16;
+
+std::vector<byte> readFile(const std::string &path)
+{
+  std::ifstream in(path, std::ios::binary);
+  return std::vector<byte>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+template <typename F>
+double microseconds(long iterations, F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; ++i)
+  {
+    f();
+  }
+  std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+void report(const std::string &name, const std::vector<byte> &data, long iterations)
+{
+  if (data.empty())
+  {
+    std::cout << name << ": not found" << std::endl;
+    return;
+  }
+
+  std::vector<byte> compressed(data.size());
+  std::vector<byte> decompressed(data.size());
+  unsigned int compressedLen = 0;
+  unsigned int decompressedLen = 0;
+  double compressTime = microseconds(iterations, [&]() {
+    compressedLen = VLCB::compress(data.data(), data.size(), compressed.data(), compressed.size());
+  });
+  double decompressTime = microseconds(iterations, [&]() {
+    decompressedLen = VLCB::decompress(compressed.data(), compressedLen, decompressed.data(), decompressed.size());
+  });
+  if (compressedLen == 0)
+  {
+    unsigned long steps = searchSteps(data.size());
+    std::cout << name << ": " << data.size() << " bytes do not compress, "
+              << "compress " << compressTime << " us, "
+              << steps << " search steps, about " << steps * AVR_CYCLES_PER_STEP / AVR_CLOCK_MHZ / 1000
+              << " ms on a " << AVR_CLOCK_MHZ << "MHz AVR" << std::endl;
+    return;
+  }
+  if (decompressedLen != data.size() || decompressed != data)
+  {
+    std::cout << name << ": decompressed data differs" << std::endl;
+    return;
+  }
+
+  std::cout << name << ": " << data.size() << " -> " << compressedLen << " bytes ("
+            << 100 * compressedLen / data.size() << "%), "
+            << frames(data.size()) << " -> " << frames(compressedLen) << " frames, "
+            << "compress " << compressTime << " us, decompress " << decompressTime << " us" << std::endl;
+}
+
+}
+
+int main(int argc, const char * const * argv)
+{
+  long iterations = argc > 1 ? atol(argv[1]) : 1000;
+  std::string mdfDir = argc > 2 ? argv[2] : MDF_DIR;
+
+  report("config image", makeConfigImage(), iterations);
+  report("incompressible 1 KB", makeIncompressible(1024), iterations);
+  for (const char *file : {"CAN1IN1OUT-0D63-1a.json", "CAN4I4O_S-0D53-1b.json", "CAN4IN4OUT-0D52-1b.json"})
+  {
+    report(file, readFile(mdfDir + "/" + file), iterations);
+  }
+
+  return 0;
+}
@@ -0,0 +1,276 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+// Host benchmark comparing GridConnect encoding and decoding with the
+// earlier implementation that used sprintf() and strtol().
+// Run with an optional iteration count: benchmarkGridConnect [iterations]
+
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include "GridConnect.h"
+
+using VLCB::CANFrame;
+
+namespace
+{
+
+// Earlier implementation, kept here for comparison.
+  bool legacyEncodeGridConnect(char * gcBuffer, CANFrame *frame)
+  {
+      byte offset = 0;
+      gcBuffer[0] = 0;  // null terminate buffer to start with
+      // set starting character & standard or extended CAN identifier
+      if (frame->ext)
+      {
+        if (frame->id > 0x1FFFFFFF)
+        {
+          // id is greater than 29 bits, so fail the encoding
+          return false;
+        }
+        // mark as extended frame
+        strcpy (gcBuffer,":X");
+        // extended 29 bit CAN idenfier in bytes 2 to 9
+        // chars 2 & 3 are ID bits 21 to 28
+        sprintf(gcBuffer + 2, "%02X", (frame->id) >> 21);
+        // char 4 -  bits 1 to 3 are ID bits 18 to 20
+        sprintf(gcBuffer + 4, "%01X", ((frame->id) >> 17) & 0xE);
+        // char 5 -  bits 0 to 1 are ID bits 16 & 17
+        sprintf(gcBuffer + 5, "%01X", ((frame->id) >> 16) & 0x3);
+        // chars 6 to 9 are ID bits 0 to 15
+        sprintf(gcBuffer + 6, "%04X", frame->id & 0xFFFF);
+        offset = 10;
+      } 
+      else
+      {
+        // mark sas standard frame
+        if (frame->id > 0x7FF)
+        {
+          // id is greater than 11 bits, so fail the encoding
+          return false;
+        }
+        strcpy (gcBuffer,":S");
+        // standard 11 bit CAN idenfier in bytes 2 to 5, left shifted 5 to occupy highest bits
+        sprintf(gcBuffer + 2, "%04X", frame->id << 5);
+        offset = 6;
+      }
+      // set RTR or normal - byte 6 or 10
+      strcpy(gcBuffer + offset++, frame->rtr ? "R" : "N");
+      if (frame->len > 8)
+      { 
+        // if greater than 8 then faulty frame
+        gcBuffer[0] = 0;
+        return false;
+      }
+      //now add hex data from byte 7 if len > 0
+      for (int i=0; i < frame->len; i++)
+      {
+        sprintf(gcBuffer + offset, "%02X", frame->data[i]);
+        offset += 2;
+      }
+      // add terminator
+      strcpy (gcBuffer + offset,";");
+      return true;
+  }
+
+  // Function to convert a pair of hexadecimal characters to a byte value
+  //
+  static int ascii_pair_to_byte(const char *pair)
+  {
+      unsigned char* data = (unsigned char*)pair;
+      int result;
+      if (data[1] < 'A') { result = data[1] - '0'; }
+      else { result = data[1] - 'A' + 10; }
+      if (data[0] < 'A') { result += (data[0] - '0') << 4; }
+      else { result += (data[0] - 'A' + 10) << 4; }
+      return result;
+  }
+
+
+  // check supplied array is comprised of only hexadecimal characters
+  //
+  static bool checkHexChars(const char *charBuff, int count)
+  {
+    for (int i = 0 ; i< count; i++)
+    {
+      // must be upper case, so fail if lower case
+      if (islower(charBuff[i]))
+      {
+        return false;
+      }
+      if (!isxdigit(charBuff[i]))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  // convert a gridconnect message to CANFrame object
+  // see Gridconnect format at beginning of file for byte positions
+  //
+  bool legacyDecodeGridConnect(const char * gcBuffer, CANFrame *frame) 
+  {
+    int gcIndex = 0;                          // index used to 'walk' gc frame
+    int gcBufferLength = strlen(gcBuffer);    // save for later use
+
+    // must have start of frame character
+    if (gcBuffer[gcIndex++] != ':') 
+    {
+      return false;
+    }
+    //
+    // do CAN Identifier, must be either 'X' or 'S'
+    if (gcBuffer[gcIndex] == 'X') 
+    {
+      frame->ext = true;
+      // now get 29 bit ID - convert from hex, but check they are all hex first
+      if (checkHexChars(&gcBuffer[2], 8) == false)
+      {
+        return false;
+      }
+      // ok, all hex, so build up id from characters 2 to 9
+      // chars 2 & 3 are bits 21 to 28
+      frame->id = uint32_t(ascii_pair_to_byte(&gcBuffer[2])) << 21;
+      // chars 4 & 5 -  bits 5 to 7 are bits 18 to 20
+      frame->id += uint32_t(ascii_pair_to_byte(&gcBuffer[4]) & 0xE0) << 13;
+      // chars 4 & 5 -  bits 0 to 1 are bits 16 & 17
+      frame->id += uint32_t(ascii_pair_to_byte(&gcBuffer[4]) & 0x3) << 16;
+      // chars 6 & 7 are bits 8 to 15
+      frame->id += uint32_t(ascii_pair_to_byte(&gcBuffer[6])) << 8;
+      // chars 8 & 9 are bits 0 to 7 
+      frame->id += ascii_pair_to_byte(&gcBuffer[8]);
+      gcIndex = 10;
+    }
+    else if (gcBuffer[gcIndex] == 'S') 
+    {
+      frame->ext = false;
+      // now get 11 bit ID - convert from hex, but check they are all hex first
+      if (checkHexChars(&gcBuffer[2], 4) == false)
+      {
+        return false;
+      }
+      // 11 bit identifier needs to be shifted right by 5
+      frame->id = strtol(&gcBuffer[2], NULL, 16) >> 5;
+      gcIndex = 6;
+    } 
+    else 
+    {
+      return false;
+    }
+    //
+    // do RTR flag
+    if (gcBuffer[gcIndex] == 'R') 
+    {
+      frame->rtr = true;
+    } 
+    else if (gcBuffer[gcIndex] == 'N')
+    {
+      frame->rtr = false;
+    } 
+    else 
+    {
+      return false;
+    }
+    gcIndex++;  // set to next character afert RTR flag
+    //
+    // Do data segment - convert hex array to byte array
+    // find out how many chars in data segment (0 to 16, in multiples of 2) 
+    // should be gcBufferLength minus gcIndex as it is now (after RTR flag), minus 1
+    int dataLength = gcBufferLength - gcIndex - 1;
+    // must be even number of hex characters, and no more than 16
+    if ((dataLength % 2 ) || (dataLength > 16 )) 
+    {
+      return false;
+    } 
+    // set length of data segment
+    frame->len = dataLength / 2;
+    // now convert hex data into bytes
+    for (int i = 0; i < dataLength/2; i++) 
+    {
+      // check they are hex chars first
+      if (checkHexChars(&gcBuffer[gcIndex], 2) == false)
+      {
+        return false;
+      }
+      frame->data[i] = ascii_pair_to_byte(&gcBuffer[gcIndex]);
+      gcIndex += 2;
+    }
+    //
+    // must have end of frame character
+    if (gcBuffer[gcBufferLength-1] != ';') 
+    {
+      return false;
+    }
+    //
+    return true; 
+  }
+
+const int NUM_FRAMES = 4;
+
+void makeFrames(CANFrame * frames)
+{
+  for (int i = 0; i < NUM_FRAMES; ++i)
+  {
+    frames[i].id = i & 1 ? 0x1ABCDE0 + i : 0x70 + i;
+    frames[i].ext = i & 1;
+    frames[i].rtr = false;
+    frames[i].len = 2 + 2 * i;
+    for (int d = 0; d < 8; ++d)
+    {
+      frames[i].data[d] = 0x91 + d * 17;
+    }
+  }
+}
+
+template <typename F>
+double framesPerSecond(long iterations, F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; ++i)
+  {
+    f(i % NUM_FRAMES);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return iterations / elapsed.count();
+}
+
+void report(const char * name, double legacy, double current)
+{
+  std::cout << name << ": legacy " << (long)legacy << " frames/s, current " << (long)current
+            << " frames/s (" << current / legacy << "x)" << std::endl;
+}
+
+}
+
+int main(int argc, const char * const * argv)
+{
+  long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+
+  CANFrame frames[NUM_FRAMES];
+  makeFrames(frames);
+  char messages[NUM_FRAMES][30];
+  for (int i = 0; i < NUM_FRAMES; ++i)
+  {
+    VLCB::encodeGridConnect(messages[i], &frames[i]);
+  }
+
+  char buffer[30];
+  volatile unsigned sink = 0;
+  double legacyEncode = framesPerSecond(iterations, [&](int i) { legacyEncodeGridConnect(buffer, &frames[i]); sink += buffer[7]; });
+  double currentEncode = framesPerSecond(iterations, [&](int i) { VLCB::encodeGridConnect(buffer, &frames[i]); sink += buffer[7]; });
+  report("encode", legacyEncode, currentEncode);
+
+  CANFrame frame;
+  double legacyDecode = framesPerSecond(iterations, [&](int i) { legacyDecodeGridConnect(messages[i], &frame); sink += frame.id; });
+  double currentDecode = framesPerSecond(iterations, [&](int i) { VLCB::decodeGridConnect(messages[i], &frame); sink += frame.id; });
+  report("decode", legacyDecode, currentDecode);
+
+  return 0;
+}
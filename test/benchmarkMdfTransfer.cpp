@@ -0,0 +1,135 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+// Host benchmark of reading the example MDF files from a module with MdfService.
+// A module and a configuration tool run on a simulated 125kbit/s CAN bus. Reports
+// the simulated transfer time and number of frames for plain and compressed MDFs,
+// with the default fragment delay and with adaptive pacing.
+// Run with an optional MDF directory: benchmarkMdfTransfer [mdfDirectory]
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "ArduinoMock.hpp"
+#include "VirtualCanBus.h"
+#include "LongMessageService.h"
+#include "LongMessageDispatcher.h"
+#include "MdfService.h"
+#include "Compression.h"
+
+#ifndef MDF_DIR
+#define MDF_DIR "examples/MDF"
+#endif
+
+namespace
+{
+
+const unsigned int MODULE_NN = 256;
+const unsigned int BUFFER_LEN = 64;
+
+// What the tool has received.
+unsigned int receivedBytes = 0;
+unsigned int totalBytes = 0;
+bool complete = false;
+
+void toolHandler(void *msg, unsigned int msgLen, byte, byte status)
+{
+  const byte *data = (const byte *)msg;
+  if (status != VLCB::LONG_MESSAGE_COMPLETE || msgLen < VLCB::MDF_MESSAGE_HEADER_LEN || data[0] != VLCB::MDF_CMD_DATA)
+  {
+    return;
+  }
+  totalBytes = (data[6] << 8) + data[7];
+  receivedBytes += msgLen - VLCB::MDF_MESSAGE_HEADER_LEN;
+  complete = receivedBytes >= totalBytes;
+}
+
+struct Transfer
+{
+  bool complete;
+  double seconds;
+  unsigned int frames;
+};
+
+Transfer transfer(const std::vector<byte> &mdf, VLCB::MdfFormat format, bool adaptivePacing)
+{
+  VirtualCanBus bus(125000);
+
+  VirtualCanNode &module = bus.addNode(MODULE_NN, 1);
+  VLCB::LongMessageService moduleLongMessages;
+  byte receiveBuffer[8];
+  VLCB::LongMessageDispatcher dispatcher(moduleLongMessages, receiveBuffer, sizeof(receiveBuffer));
+  byte buffer[BUFFER_LEN];
+  VLCB::MdfService mdfService(dispatcher, mdf.data(), mdf.size(), format, buffer, sizeof(buffer));
+  module.controller.setServices({&module.minimumNodeService, &module.canService, &moduleLongMessages, &mdfService});
+  module.controller.begin();
+  if (adaptivePacing)
+  {
+    moduleLongMessages.setAdaptivePacing(&module.transport, 0, VLCB::LONG_MESSAGE_DEFAULT_DELAY);
+  }
+
+  VirtualCanNode &tool = bus.addNode(257, 2);
+  VLCB::LongMessageServiceEx toolLongMessages;
+  toolLongMessages.allocateContexts(1, BUFFER_LEN, 1);
+  byte streams[] = {VLCB::MDF_STREAM_ID};
+  tool.controller.setServices({&tool.minimumNodeService, &tool.canService, &toolLongMessages});
+  tool.controller.begin();
+  toolLongMessages.subscribe(streams, sizeof(streams), toolHandler);
+
+  receivedBytes = 0;
+  totalBytes = 0;
+  complete = false;
+  unsigned long start = micros();
+  byte request[] = {VLCB::MDF_CMD_READ, highByte(MODULE_NN), lowByte(MODULE_NN)};
+  toolLongMessages.sendLongMessage(request, sizeof(request), VLCB::MDF_STREAM_ID);
+
+  // Give up after a simulated minute.
+  for (int i = 0; i < 60000 && !complete; ++i)
+  {
+    bus.run(1000);
+  }
+  return {complete, (micros() - start) / 1000000.0, bus.getFramesTransmitted()};
+}
+
+void report(const char *name, const Transfer &plain, const Transfer &compressed)
+{
+  std::cout << "  " << name << ": json " << plain.seconds << " s, " << plain.frames << " frames; "
+            << "compressed " << compressed.seconds << " s, " << compressed.frames << " frames";
+  if (!plain.complete || !compressed.complete)
+  {
+    std::cout << " (incomplete)";
+  }
+  std::cout << std::endl;
+}
+
+}
+
+int main(int argc, const char * const * argv)
+{
+  std::string mdfDir = argc > 1 ? argv[1] : MDF_DIR;
+
+  for (const char *file : {"CAN1IN1OUT-0D63-1a.json", "CAN4I4O_S-0D53-1b.json", "CAN4IN4OUT-0D52-1b.json"})
+  {
+    std::ifstream in(mdfDir + "/" + file, std::ios::binary);
+    std::vector<byte> json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (json.empty())
+    {
+      std::cout << file << ": not found" << std::endl;
+      continue;
+    }
+    std::vector<byte> compressed(json.size());
+    compressed.resize(VLCB::compress(json.data(), json.size(), compressed.data(), compressed.size()));
+
+    std::cout << file << ": " << json.size() << " bytes, compressed " << compressed.size() << " bytes" << std::endl;
+    report("default delay  ", transfer(json, VLCB::MDF_FORMAT_JSON, false),
+           transfer(compressed, VLCB::MDF_FORMAT_COMPRESSED_JSON, false));
+    report("adaptive pacing", transfer(json, VLCB::MDF_FORMAT_JSON, true),
+           transfer(compressed, VLCB::MDF_FORMAT_COMPRESSED_JSON, true));
+  }
+
+  return 0;
+}
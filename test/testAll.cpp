@@ -16,13 +16,19 @@ void testConfiguration();
 void testMinimumNodeService();
 void testNodeVariableService();
 void testCanService();
+void testCanBridgeService();
 void testEventProducerService();
 void testEventConsumerService();
 void testEventTeachingService();
 void testConsumeOwnEventsService();
 void testLongMessageService();
+void testConfigTransferService();
+void testCompression();
+void testMdfService();
 void testGridConnect();
 void testTimedResponse();
+void testSerialGC();
+void testVirtualCanBus();
 
 // Remaining services to implement
 //Bootloader (the CBUS PIC version) service #10
@@ -37,13 +43,19 @@ std::map<std::string, void (*)()> suites = {
         {"MinimumNodeService", testMinimumNodeService},
         {"NodeVariableService", testNodeVariableService},
         {"CanService", testCanService},
+        {"CanBridgeService", testCanBridgeService},
         {"EventProducerService", testEventProducerService},
         {"EventConsumerService", testEventConsumerService},
         {"EventTeachingService", testEventTeachingService},
         {"ConsumeOwnEventsService", testConsumeOwnEventsService},
         {"LongMessageService", testLongMessageService},
+        {"ConfigTransferService", testConfigTransferService},
+        {"Compression", testCompression},
+        {"MdfService", testMdfService},
         {"GridConnect", testGridConnect},
-        {"TimedResponse", testTimedResponse}
+        {"TimedResponse", testTimedResponse},
+        {"SerialGC", testSerialGC},
+        {"VirtualCanBus", testVirtualCanBus}
 };
 
 int main(int argc, const char * const * argv)
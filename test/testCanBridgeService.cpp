@@ -0,0 +1,204 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+// Test cases for CanBridgeService.
+
+#include <memory>
+#include "TestTools.hpp"
+#include "ArduinoMock.hpp"
+#include "Controller.h"
+#include "CanBridgeService.h"
+#include "CanService.h"
+#include "VlcbCommon.h"
+#include "MockCanTransport.h"
+
+namespace
+{
+std::unique_ptr<MockCanTransport> busA;
+std::unique_ptr<MockCanTransport> busB;
+std::unique_ptr<VLCB::CanBridgeService> bridge;
+
+VLCB::Controller createController()
+{
+  busA.reset(new MockCanTransport);
+  busB.reset(new MockCanTransport);
+  bridge.reset(new VLCB::CanBridgeService(busA.get(), busB.get()));
+
+  VLCB::Controller controller = ::createController({bridge.get()});
+  controller.begin();
+  return controller;
+}
+
+VLCB::CANFrame makeFrame(byte canId, byte opCode, byte eventNumber)
+{
+  VLCB::CANFrame frame = {};
+  frame.id = (VLCB::CAN_PRIORITY_ABOVE << 7) | canId;
+  frame.len = 5;
+  frame.data[0] = opCode;
+  frame.data[1] = 0x01;
+  frame.data[2] = 0x04;
+  frame.data[3] = 0;
+  frame.data[4] = eventNumber;
+  return frame;
+}
+
+void testForwardBothWays()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  busA->setNextMessage(makeFrame(3, OPC_ACON, 1));
+  busB->setNextMessage(makeFrame(4, OPC_ACOF, 2));
+
+  process(controller);
+
+  assertEquals(1, busB->sent_frames.size());
+  assertEquals(3, busB->sent_frames[0].id & 0x7F);
+  assertEquals(OPC_ACON, busB->sent_frames[0].data[0]);
+  assertEquals(1, busA->sent_frames.size());
+  assertEquals(4, busA->sent_frames[0].id & 0x7F);
+  assertEquals(OPC_ACOF, busA->sent_frames[0].data[0]);
+  assertEquals(1, bridge->getForwardedCount(VLCB::CanBridgeService::A_TO_B));
+  assertEquals(1, bridge->getForwardedCount(VLCB::CanBridgeService::B_TO_A));
+}
+
+void testFilter()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  // Only pass accessory events from A to B.
+  bridge->setFilter([](VLCB::CanBridgeService::Direction direction, const VLCB::CANFrame & frame)
+  {
+    return direction == VLCB::CanBridgeService::B_TO_A || frame.data[0] == OPC_ACON || frame.data[0] == OPC_ACOF;
+  });
+
+  busA->setNextMessage(makeFrame(3, OPC_ACON, 1));
+  busA->setNextMessage(makeFrame(3, OPC_ASON, 2));
+  busB->setNextMessage(makeFrame(4, OPC_ASON, 3));
+
+  process(controller);
+
+  assertEquals(1, busB->sent_frames.size());
+  assertEquals(OPC_ACON, busB->sent_frames[0].data[0]);
+  assertEquals(1, busA->sent_frames.size());
+  assertEquals(1, bridge->getFilteredCount(VLCB::CanBridgeService::A_TO_B));
+  assertEquals(0, bridge->getFilteredCount(VLCB::CanBridgeService::B_TO_A));
+}
+
+void testEchoIsSuppressed()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  busA->setNextMessage(makeFrame(3, OPC_ACON, 1));
+  process(controller);
+  assertEquals(1, busB->sent_frames.size());
+
+  // Bus B returns the frame, e.g. a transport that echoes sent frames or another bridge.
+  busB->setNextMessage(busB->sent_frames[0]);
+  addMillis(10);
+  process(controller);
+
+  assertEquals(0, busA->sent_frames.size());
+  assertEquals(1, bridge->getSuppressedCount(VLCB::CanBridgeService::B_TO_A));
+
+  // The same event later is a new event.
+  addMillis(100);
+  busA->setNextMessage(makeFrame(3, OPC_ACON, 1));
+  process(controller);
+  assertEquals(2, busB->sent_frames.size());
+  assertEquals(0, bridge->getSuppressedCount(VLCB::CanBridgeService::A_TO_B));
+}
+
+void testLoopSuppressionDisabled()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  bridge->setLoopSuppressionWindow(0);
+
+  busA->setNextMessage(makeFrame(3, OPC_ACON, 1));
+  process(controller);
+  busB->setNextMessage(busB->sent_frames[0]);
+  process(controller);
+
+  assertEquals(1, busA->sent_frames.size());
+  assertEquals(0, bridge->getSuppressedCount(VLCB::CanBridgeService::B_TO_A));
+}
+
+void testQueueWhenReceiverIsBusy()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  busB->rejectSentFrames = true;
+
+  for (int i = 0; i < 3; ++i)
+  {
+    busA->setNextMessage(makeFrame(3, OPC_ACON, i));
+  }
+  process(controller);
+
+  assertEquals(0, busB->sent_frames.size());
+  assertEquals(3, bridge->getQueueUsage(VLCB::CanBridgeService::A_TO_B));
+  assertEquals(3, bridge->getQueuePeak(VLCB::CanBridgeService::A_TO_B));
+
+  busB->rejectSentFrames = false;
+  process(controller);
+
+  // Frames are sent in the order they were received.
+  assertEquals(3, busB->sent_frames.size());
+  for (int i = 0; i < 3; ++i)
+  {
+    assertEquals(i, busB->sent_frames[i].data[4]);
+  }
+  assertEquals(0, bridge->getQueueUsage(VLCB::CanBridgeService::A_TO_B));
+  assertEquals(3, bridge->getQueuePeak(VLCB::CanBridgeService::A_TO_B));
+  assertEquals(0, bridge->getDropCount(VLCB::CanBridgeService::A_TO_B));
+}
+
+void testDropWhenQueueIsFull()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  busB->rejectSentFrames = true;
+
+  const int FRAMES = VLCB::CAN_BRIDGE_QUEUE_SIZE + 2;
+  for (int i = 0; i < FRAMES; ++i)
+  {
+    busA->setNextMessage(makeFrame(3, OPC_ACON, i));
+  }
+  for (int i = 0; i < FRAMES; ++i)
+  {
+    process(controller);
+  }
+
+  assertEquals(VLCB::CAN_BRIDGE_QUEUE_SIZE, bridge->getQueueUsage(VLCB::CanBridgeService::A_TO_B));
+  assertEquals(2, bridge->getDropCount(VLCB::CanBridgeService::A_TO_B));
+
+  busB->rejectSentFrames = false;
+  process(controller);
+
+  // The oldest frames were dropped.
+  assertEquals(VLCB::CAN_BRIDGE_QUEUE_SIZE, busB->sent_frames.size());
+  assertEquals(2, busB->sent_frames[0].data[4]);
+  assertEquals(VLCB::CAN_BRIDGE_QUEUE_SIZE, bridge->getForwardedCount(VLCB::CanBridgeService::A_TO_B));
+}
+
+}
+
+void testCanBridgeService()
+{
+  testForwardBothWays();
+  testFilter();
+  testEchoIsSuppressed();
+  testLoopSuppressionDisabled();
+  testQueueWhenReceiverIsBusy();
+  testDropWhenQueueIsFull();
+}
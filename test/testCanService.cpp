@@ -7,14 +7,80 @@
 // * Service Discovery
 // * CANID enumeration
 
+#include <deque>
 #include <memory>
+#include <vector>
 #include "TestTools.hpp"
 #include "Controller.h"
 #include "MinimumNodeServiceWithDiagnostics.h"
 #include "CanServiceWithDiagnostics.h"
+#include "EventSlotTeachingService.h"
 #include "VlcbCommon.h"
 #include "ArduinoMock.hpp"
 #include "MockCanTransport.h"
+#include "NativeCanService.h"
+
+// A CAN driver frame type with other members than CANFrame.
+struct DriverFrame
+{
+  uint16_t ident;
+  uint8_t flags; // bit 0: rtr
+  uint8_t dlc;
+  uint8_t payload[8];
+};
+
+template <>
+struct VLCB::CanFrameTraits<DriverFrame>
+{
+  static uint32_t id(const DriverFrame & frame) { return frame.ident; }
+  static bool ext(const DriverFrame &) { return false; }
+  static bool rtr(const DriverFrame & frame) { return frame.flags & 1; }
+  static uint8_t len(const DriverFrame & frame) { return frame.dlc; }
+  static const uint8_t * data(const DriverFrame & frame) { return frame.payload; }
+  static void set(DriverFrame & frame, uint32_t id, bool rtr, uint8_t len, const uint8_t * data)
+  {
+    frame.ident = id;
+    frame.flags = rtr ? 1 : 0;
+    frame.dlc = len;
+    memcpy(frame.payload, data, len);
+  }
+};
+
+// Mocks a CAN driver that keeps frames in its own buffers.
+class MockNativeCanTransport : public VLCB::NativeCanTransport<DriverFrame>
+{
+public:
+  bool available() override { return !incoming_frames.empty(); }
+  const DriverFrame * peekNativeFrame() override { return &incoming_frames.front(); }
+  void popNativeFrame() override { incoming_frames.pop_front(); }
+  bool sendNativeFrame(const DriverFrame & frame) override
+  {
+    sent_frames.push_back(frame);
+    return true;
+  }
+  bool sendCanFrame(VLCB::CANFrame *msg) override
+  {
+    ++can_frames_sent;
+    return NativeCanTransport::sendCanFrame(msg);
+  }
+
+  void reset() override {}
+  unsigned int receiveCounter() override { return 0; }
+  unsigned int transmitCounter() override { return 0; }
+  unsigned int receiveErrorCounter() override { return 0; }
+  unsigned int transmitErrorCounter() override { return 0; }
+  unsigned int receiveBufferSize() override { return 0; };
+  unsigned int transmitBufferSize() override { return 0; };
+  unsigned int receiveBufferUsage() override { return 0; };
+  unsigned int transmitBufferUsage() override { return 0; };
+  unsigned int receiveBufferPeak() override { return 0; };
+  unsigned int transmitBufferPeak() override { return 0; };
+  unsigned int errorStatus() override { return 0; }
+
+  std::deque<DriverFrame> incoming_frames;
+  std::vector<DriverFrame> sent_frames;
+  int can_frames_sent = 0;
+};
 
 namespace
 {
@@ -22,6 +88,7 @@ std::unique_ptr<VLCB::MinimumNodeService> minimumNodeService;
 
 // Use MockCanTransport to test CanTransport class.
 std::unique_ptr<MockCanTransport> mockCanTransport;
+std::unique_ptr<VLCB::CanService> canService;
 
 VLCB::Controller createController(VlcbModeParams startupMode = MODE_NORMAL)
 {
@@ -29,7 +96,6 @@ VLCB::Controller createController(VlcbModeParams startupMode = MODE_NORMAL)
 
   mockCanTransport.reset(new MockCanTransport);
 
-  static std::unique_ptr<VLCB::CanService> canService;
   canService.reset(new VLCB::CanServiceWithDiagnostics(mockCanTransport.get()));
 
   VLCB::Controller controller = ::createController(startupMode, {minimumNodeService.get(), canService.get()});
@@ -210,6 +276,83 @@ void testCanidEnumerationOnConflict()
   assertEquals(1, controller.getModuleCANID());
 }
 
+void testEnumerationDiagnostics()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  controller.getModuleConfig()->setCANID(3);
+
+  // Two frames from another module with the same CANID.
+  VLCB::CANFrame msg = {3, false, false, 1, {OPC_RQNP}};
+  mockCanTransport->setNextMessage(msg);
+  mockCanTransport->setNextMessage(msg);
+  process(controller);
+
+  // Another module responds with its CANID.
+  msg = {1, false, false, 0, {}};
+  mockCanTransport->setNextMessage(msg);
+  process(controller);
+
+  // Process the enumeration a bit late.
+  addMillis(120);
+  process(controller);
+  assertEquals(2, controller.getModuleCANID());
+
+  assertEquals(1, canService->getEnumerationCount());
+  assertEquals(2, canService->getCanIdConflictCount());
+  assertEquals(1, canService->getCanIdChangeCount());
+  assertEquals(0, canService->getEnumerationFailureCount());
+  assertEquals(120, canService->getLastEnumerationDuration());
+  assertEquals(120, canService->getTotalEnumerationDuration());
+
+  // Report them as diagnostics 0x0D to 0x10.
+  mockCanTransport->clearMessages();
+  const byte serviceIndex = 2;
+  for (byte code = 0x0D; code <= 0x10; ++code)
+  {
+    msg = {0x11, false, false, 5, {OPC_RDGN, 0x01, 0x04, serviceIndex, code}};
+    mockCanTransport->setNextMessage(msg);
+  }
+  process(controller);
+
+  assertEquals(4, mockCanTransport->sent_frames.size());
+  const byte expected[] = {1, 2, 1, 0};
+  for (int i = 0; i < 4; ++i)
+  {
+    assertEquals(OPC_DGN, mockCanTransport->sent_frames[i].data[0]);
+    assertEquals(0x0D + i, mockCanTransport->sent_frames[i].data[4]);
+    assertEquals(0, mockCanTransport->sent_frames[i].data[5]);
+    assertEquals(expected[i], mockCanTransport->sent_frames[i].data[6]);
+  }
+}
+
+void testEnumerationFailure()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  controller.getModuleConfig()->setCANID(5);
+
+  controller.putAction({VLCB::ACT_START_CAN_ENUMERATION});
+  process(controller);
+
+  // All CANIDs are in use.
+  for (byte remoteCanid = 1 ; remoteCanid <= 127 ; ++remoteCanid)
+  {
+    VLCB::CANFrame msg = {remoteCanid, false, false, 0, {}};
+    mockCanTransport->setNextMessage(msg);
+    controller.process();
+  }
+
+  addMillis(101);
+  process(controller);
+
+  assertEquals(1, canService->getEnumerationFailureCount());
+  assertEquals(1, canService->getCanIdChangeCount());
+  assertEquals(1, controller.getModuleCANID());
+}
+
 void testRtrMessage()
 {
   test();
@@ -442,6 +585,384 @@ void testRequestAllDiagnosticsCanService()
   assertEquals(0, mockCanTransport->sent_frames[messageIndex].data[6]);
 }
 
+void testReadSeveralFramesOnBusyBus()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  controller.getModuleConfig()->setCANID(3);
+
+  // A CAN driver with room for 8 received frames.
+  mockCanTransport->receiveBufferLimit = 8;
+
+  // A saturated 125kbit/s bus delivers about one 8 byte frame per millisecond.
+  // Simulate a sketch loop that takes 4ms so that 4 frames arrive in each loop.
+  const int LOOP_TIME = 4;
+  for (int loop = 0 ; loop < 250 ; ++loop)
+  {
+    for (int i = 0 ; i < LOOP_TIME ; ++i)
+    {
+      VLCB::CANFrame frame = {0x11, false, false, 5, {OPC_ACON, 0x02, 0x00, 0x00, (byte) i}};
+      mockCanTransport->setNextMessage(frame);
+    }
+    controller.process();
+    addMillis(LOOP_TIME);
+  }
+
+  assertEquals(0, mockCanTransport->receiveOverruns);
+  assertEquals(0, controller.getActionQueue().getOverflows());
+  assertEquals(LOOP_TIME, canService->getReceivedFramesLastProcess());
+  assertEquals(LOOP_TIME, canService->getReceivedFramesPeak());
+}
+
+void testReceiveLimits()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  controller.getModuleConfig()->setCANID(3);
+  canService->setReceiveLimits(2, VLCB::CAN_RX_TIME_BUDGET);
+
+  for (int i = 0 ; i < 3 ; ++i)
+  {
+    VLCB::CANFrame frame = {0x11, false, false, 5, {OPC_ACON, 0x02, 0x00, 0x00, (byte) i}};
+    mockCanTransport->setNextMessage(frame);
+  }
+
+  controller.process();
+  assertEquals(2, canService->getReceivedFramesLastProcess());
+  assertEquals(1, mockCanTransport->incoming_frames.size());
+
+  controller.process();
+  assertEquals(1, canService->getReceivedFramesLastProcess());
+  assertEquals(0, mockCanTransport->incoming_frames.size());
+  assertEquals(2, canService->getReceivedFramesPeak());
+}
+
+void testTransmitRetry()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  // CAN driver transmit buffer is full.
+  mockCanTransport->rejectSentFrames = true;
+
+  VLCB::CANFrame msg = {0x11, false, false, 4, {OPC_RQSD, 0x01, 0x04, 2}};
+  mockCanTransport->setNextMessage(msg);
+
+  process(controller);
+
+  // The response is kept in the retry queue.
+  assertEquals(0, mockCanTransport->sent_frames.size());
+  assertEquals(1, canService->getTransmitQueueUsage());
+  unsigned int retries = canService->getTransmitRetries();
+
+  // Still busy, frame is retried and kept.
+  controller.process();
+  assertEquals(0, mockCanTransport->sent_frames.size());
+  assertEquals(1, canService->getTransmitQueueUsage());
+  assertEquals(retries + 1, canService->getTransmitRetries());
+
+  // CAN driver has free space again.
+  mockCanTransport->rejectSentFrames = false;
+  controller.process();
+
+  assertEquals(1, mockCanTransport->sent_frames.size());
+  assertEquals(OPC_ESD, mockCanTransport->sent_frames[0].data[0]);
+  assertEquals(0, canService->getTransmitQueueUsage());
+  assertEquals(retries + 2, canService->getTransmitRetries());
+  assertEquals(0, canService->getTransmitQueueOverruns());
+}
+
+void testTransmitRetryCount()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  controller.getModuleConfig()->setCANID(3);
+
+  // Frames sent straight away are not retries.
+  controller.sendMessageWithNN(OPC_ACON, 0, 1);
+  controller.process();
+  assertEquals(1, mockCanTransport->sent_frames.size());
+  assertEquals(0, canService->getTransmitRetries());
+
+  // First frame is rejected and retried once in the same call.
+  // Second frame is queued behind it without being tried.
+  mockCanTransport->rejectSentFrames = true;
+  controller.sendMessageWithNN(OPC_ACON, 0, 2);
+  controller.sendMessageWithNN(OPC_ACON, 0, 3);
+  controller.process();
+  assertEquals(2, canService->getTransmitQueueUsage());
+  assertEquals(1, canService->getTransmitRetries());
+
+  controller.process();
+  assertEquals(2, canService->getTransmitRetries());
+
+  // Only the rejected frame counts as a retry.
+  mockCanTransport->rejectSentFrames = false;
+  controller.process();
+  assertEquals(3, mockCanTransport->sent_frames.size());
+  assertEquals(3, canService->getTransmitRetries());
+}
+
+void testTransmitQueueOverrun()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  mockCanTransport->rejectSentFrames = true;
+
+  // Send one more message than the retry queue can hold.
+  for (int i = 0 ; i <= VLCB::CAN_TX_QUEUE_SIZE ; ++i)
+  {
+    controller.sendMessageWithNN(OPC_ACON, 0, i);
+  }
+  process(controller);
+
+  assertEquals(VLCB::CAN_TX_QUEUE_SIZE, canService->getTransmitQueueUsage());
+  assertEquals(1, canService->getTransmitQueueOverruns());
+
+  mockCanTransport->rejectSentFrames = false;
+  process(controller);
+
+  // The oldest message was dropped.
+  assertEquals(VLCB::CAN_TX_QUEUE_SIZE, mockCanTransport->sent_frames.size());
+  assertEquals(1, mockCanTransport->sent_frames[0].data[4]);
+  mockCanTransport->clearMessages();
+
+  // Report the overrun as diagnostic 0x05.
+  const byte serviceIndex = 2;
+  VLCB::CANFrame msg = {0x11, false, false, 5, {OPC_RDGN, 0x01, 0x04, serviceIndex, 0x05}};
+  mockCanTransport->setNextMessage(msg);
+
+  process(controller);
+
+  assertEquals(1, mockCanTransport->sent_frames.size());
+  assertEquals(OPC_DGN, mockCanTransport->sent_frames[0].data[0]);
+  assertEquals(serviceIndex, mockCanTransport->sent_frames[0].data[3]);
+  assertEquals(0x05, mockCanTransport->sent_frames[0].data[4]);
+  assertEquals(0, mockCanTransport->sent_frames[0].data[5]);
+  assertEquals(1, mockCanTransport->sent_frames[0].data[6]);
+}
+
+void testMessagePriority()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  controller.getModuleConfig()->setCANID(3);
+
+  controller.sendMessageWithNN(OPC_ACON, 0, 1);
+  controller.sendMessageWithNN(OPC_WRACK);
+  controller.sendMessageWithNN(OPC_ENRSP, 0, 1, 0, 2, 3);
+  VLCB::VlcbMessage hlt = {1, {OPC_HLT}};
+  controller.sendMessage(&hlt);
+  VLCB::VlcbMessage dspd = {3, {OPC_DSPD, 1, 0x80}};
+  controller.sendMessage(&dspd);
+  process(controller);
+
+  assertEquals(5, mockCanTransport->sent_frames.size());
+  assertEquals((VLCB::CAN_PRIORITY_NORMAL << 7) + 3, mockCanTransport->sent_frames[0].id);
+  assertEquals((VLCB::CAN_PRIORITY_NORMAL << 7) + 3, mockCanTransport->sent_frames[1].id);
+  assertEquals((VLCB::CAN_PRIORITY_LOW << 7) + 3, mockCanTransport->sent_frames[2].id);
+  assertEquals((VLCB::CAN_PRIORITY_HIGH << 7) + 3, mockCanTransport->sent_frames[3].id);
+  assertEquals((VLCB::CAN_PRIORITY_ABOVE << 7) + 3, mockCanTransport->sent_frames[4].id);
+  mockCanTransport->clearMessages();
+
+  // Override priorities from the sketch.
+  canService->setPriorityFunction([](byte opCode) -> byte { return opCode == OPC_WRACK ? VLCB::CAN_PRIORITY_HIGH : VLCB::getDefaultCanPriority(opCode); });
+  controller.sendMessageWithNN(OPC_ACON, 0, 1);
+  controller.sendMessageWithNN(OPC_WRACK);
+  process(controller);
+
+  assertEquals(2, mockCanTransport->sent_frames.size());
+  assertEquals((VLCB::CAN_PRIORITY_NORMAL << 7) + 3, mockCanTransport->sent_frames[0].id);
+  assertEquals((VLCB::CAN_PRIORITY_HIGH << 7) + 3, mockCanTransport->sent_frames[1].id);
+}
+
+// Simulate CAN arbitration between two nodes that each have frames waiting in their transmit buffers.
+// In each frame slot the frame with the lowest id wins the bus.
+// Returns the number of frame slots until the last frame of the second node is sent.
+int simulateArbitration(std::deque<VLCB::CANFrame> nodeA, std::deque<VLCB::CANFrame> nodeB)
+{
+  int slot = 0;
+  while (!nodeB.empty())
+  {
+    ++slot;
+    if (!nodeA.empty() && nodeA.front().id < nodeB.front().id)
+    {
+      nodeA.pop_front();
+    }
+    else
+    {
+      nodeB.pop_front();
+    }
+  }
+  return slot;
+}
+
+// Measure latency for an event sent by a node with CANID 10 while a node with CANID 3
+// sends a list of 8 events as a NERD response.
+int eventLatencyUnderBulkLoad(VLCB::Controller &controller)
+{
+  controller.getModuleConfig()->setCANID(3);
+  for (int i = 0 ; i < 8 ; ++i)
+  {
+    controller.sendMessageWithNN(OPC_ENRSP, 0, 1, 0, i, i);
+    process(controller);
+  }
+  std::deque<VLCB::CANFrame> bulkNode(mockCanTransport->sent_frames.begin(), mockCanTransport->sent_frames.end());
+  mockCanTransport->clearMessages();
+
+  controller.getModuleConfig()->setCANID(10);
+  controller.sendMessageWithNN(OPC_ACON, 0, 1);
+  process(controller);
+  std::deque<VLCB::CANFrame> eventNode(mockCanTransport->sent_frames.begin(), mockCanTransport->sent_frames.end());
+  mockCanTransport->clearMessages();
+
+  return simulateArbitration(bulkNode, eventNode);
+}
+
+void testEventLatencyUnderBulkLoad()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  // All messages with the same priority as before op-code based priorities.
+  canService->setPriorityFunction([](byte) -> byte { return VLCB::CAN_PRIORITY_LOW; });
+  int flatLatency = eventLatencyUnderBulkLoad(controller);
+
+  canService->setPriorityFunction(VLCB::getDefaultCanPriority);
+  int opCodeLatency = eventLatencyUnderBulkLoad(controller);
+
+  // With flat priority the lower CANID wins and the event waits for all bulk responses.
+  assertEquals(9, flatLatency);
+  // With op-code priority the event wins arbitration straight away.
+  assertEquals(1, opCodeLatency);
+}
+
+void testIngressFilter()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  controller.getModuleConfig()->setCANID(3);
+  controller.getModuleConfig()->writeEvent(2, 0x0102, 0x0003);
+  controller.getModuleConfig()->updateEvHashEntry(2);
+  canService->setIngressFilter(true);
+
+  // Taught event passes.
+  VLCB::CANFrame frame = {0x11, false, false, 5, {OPC_ACON, 0x01, 0x02, 0x00, 0x03}};
+  mockCanTransport->setNextMessage(frame);
+  // Event not taught is dropped.
+  frame = {0x11, false, false, 5, {OPC_ACON, 0x01, 0x02, 0x00, 0x04}};
+  mockCanTransport->setNextMessage(frame);
+  // Request for another node is dropped.
+  frame = {0x11, false, false, 3, {OPC_NERD, 0x01, 0x05}};
+  mockCanTransport->setNextMessage(frame);
+  // Request for this node passes.
+  frame = {0x11, false, false, 4, {OPC_RQSD, 0x01, 0x04, 2}};
+  mockCanTransport->setNextMessage(frame);
+  // Broadcast request passes.
+  frame = {0x11, false, false, 1, {OPC_QNN}};
+  mockCanTransport->setNextMessage(frame);
+  // Learn mode for another node passes as it ends learn mode in this node.
+  frame = {0x11, false, false, 3, {OPC_NNLRN, 0x01, 0x05}};
+  mockCanTransport->setNextMessage(frame);
+  // Teaching an event of another node passes.
+  frame = {0x11, false, false, 8, {OPC_EVLRNI, 0x01, 0x05, 0x00, 0x07, 2, 1, 42}};
+  mockCanTransport->setNextMessage(frame);
+
+  process(controller);
+
+  assertEquals(2, canService->getFilterDropCount());
+  assertEquals(5, canService->getFilterPassCount());
+
+  // Responses to RQSD and QNN.
+  assertEquals(2, mockCanTransport->sent_frames.size());
+  assertEquals(OPC_ESD, mockCanTransport->sent_frames[0].data[0]);
+  assertEquals(OPC_PNN, mockCanTransport->sent_frames[1].data[0]);
+}
+
+void testIngressFilterLearning()
+{
+  test();
+
+  minimumNodeService.reset(new VLCB::MinimumNodeServiceWithDiagnostics);
+  mockCanTransport.reset(new MockCanTransport);
+  canService.reset(new VLCB::CanServiceWithDiagnostics(mockCanTransport.get()));
+  VLCB::EventSlotTeachingService eventTeachingService;
+  VLCB::Controller controller = ::createController({minimumNodeService.get(), canService.get(), &eventTeachingService});
+  controller.begin();
+  controller.getModuleConfig()->setCANID(3);
+  canService->setIngressFilter(true);
+
+  VLCB::CANFrame frame = {0x11, false, false, 3, {OPC_NNLRN, 0x01, 0x04}};
+  mockCanTransport->setNextMessage(frame);
+  // Teach an event from another node by index.
+  frame = {0x11, false, false, 8, {OPC_EVLRNI, 0x01, 0x05, 0x00, 0x07, 2, 1, 42}};
+  mockCanTransport->setNextMessage(frame);
+  process(controller);
+
+  assertEquals(0, canService->getFilterDropCount());
+  assertEquals(2, controller.getModuleConfig()->findExistingEvent(0x0105, 0x0007));
+  assertEquals(42, controller.getModuleConfig()->getEventEVval(2, 1));
+
+  // Another node is put in learn mode.
+  frame = {0x11, false, false, 3, {OPC_NNLRN, 0x01, 0x05}};
+  mockCanTransport->setNextMessage(frame);
+  process(controller);
+  mockCanTransport->clearMessages();
+
+  frame = {0x11, false, false, 1, {OPC_QNN}};
+  mockCanTransport->setNextMessage(frame);
+  process(controller);
+
+  assertEquals(0, canService->getFilterDropCount());
+  assertEquals(OPC_PNN, mockCanTransport->sent_frames.back().data[0]);
+  assertEquals(0, mockCanTransport->sent_frames.back().data[5] & PF_LRN);
+}
+
+void testNativeCanService()
+{
+  test();
+
+  MockNativeCanTransport transport;
+  VLCB::NativeCanService<DriverFrame, VLCB::CanServiceWithDiagnostics> nativeCanService(&transport);
+  minimumNodeService.reset(new VLCB::MinimumNodeServiceWithDiagnostics);
+  VLCB::Controller controller = ::createController({minimumNodeService.get(), &nativeCanService});
+  controller.begin();
+  controller.getModuleConfig()->setCANID(3);
+
+  DriverFrame frame = {0x11, 0, 4, {OPC_RQSD, 0x01, 0x04, 2}};
+  transport.incoming_frames.push_back(frame);
+  // RTR frame from another node doing CANID enumeration.
+  frame = {0x12, 1, 0, {}};
+  transport.incoming_frames.push_back(frame);
+
+  process(controller);
+
+  assertEquals(0, transport.incoming_frames.size());
+  assertEquals(2, transport.sent_frames.size());
+
+  // Response to RTR is an empty frame.
+  assertEquals(0, transport.sent_frames[0].dlc);
+  assertEquals(0, transport.sent_frames[0].flags);
+  assertEquals(3, transport.sent_frames[0].ident & 0x7F);
+
+  // Response to RQSD.
+  assertEquals(8, transport.sent_frames[1].dlc);
+  assertEquals(OPC_ESD, transport.sent_frames[1].payload[0]);
+  assertEquals((VLCB::CAN_PRIORITY_LOW << 7) + 3, transport.sent_frames[1].ident);
+
+  // Frames are sent without going through CANFrame.
+  assertEquals(0, transport.can_frames_sent);
+}
+
 }
 
 void testCanService()
@@ -451,9 +972,21 @@ void testCanService()
   testCanidEnumerationOnUserAction();
   testCanidEnumerationOnSetUp();
   testCanidEnumerationOnConflict();
+  testEnumerationDiagnostics();
+  testEnumerationFailure();
   testCanidEnumerationOnENUM(); // Deprecated
   testRtrMessage();
   testFindFreeCanidOnPopulatedBus();
   testCANID(); // Deprecated
   testRequestAllDiagnosticsCanService();
+  testReadSeveralFramesOnBusyBus();
+  testReceiveLimits();
+  testTransmitRetry();
+  testTransmitRetryCount();
+  testTransmitQueueOverrun();
+  testMessagePriority();
+  testEventLatencyUnderBulkLoad();
+  testIngressFilter();
+  testIngressFilterLearning();
+  testNativeCanService();
 }
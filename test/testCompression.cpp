@@ -0,0 +1,150 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+// Test cases for long message compression.
+
+#include <string>
+#include <vector>
+#include "TestTools.hpp"
+#include "ArduinoMock.hpp"
+#include "Compression.h"
+
+namespace
+{
+
+std::vector<byte> toBytes(const std::string &s)
+{
+  return std::vector<byte>(s.begin(), s.end());
+}
+
+// Compress and decompress, returning the compressed length.
+unsigned int roundTrip(const std::vector<byte> &data)
+{
+  std::vector<byte> compressed(data.size() + data.size() / 128 + 1);
+  unsigned int compressedLen = VLCB::compress(data.data(), data.size(), compressed.data(), compressed.size());
+  assertEquals(true, compressedLen > 0);
+
+  std::vector<byte> decompressed(data.size());
+  assertEquals(data.size(), VLCB::decompress(compressed.data(), compressedLen, decompressed.data(), decompressed.size()));
+  assertEquals(true, data == decompressed);
+  return compressedLen;
+}
+
+void testRoundTrip()
+{
+  test();
+
+  roundTrip(toBytes("a"));
+  roundTrip(toBytes("abcdefgh"));
+  roundTrip(toBytes("{\"name\": \"NV1\", \"type\": \"NVBits\"}, {\"name\": \"NV2\", \"type\": \"NVBits\"}"));
+
+  // Longer than the window and than a literal run.
+  std::vector<byte> data;
+  for (int i = 0; i < 1000; ++i)
+  {
+    data.push_back((i * 7919) % 251);
+  }
+  roundTrip(data);
+}
+
+void testRunsCompress()
+{
+  test();
+
+  // Unused event slots are stored as 0xFF.
+  std::vector<byte> data(200, 0xFF);
+  data[0] = 1;
+  // Two literals and then two matches repeating the last byte.
+  assertEquals(1 + 2 + 2 * 2, roundTrip(data));
+}
+
+void testTextCompresses()
+{
+  test();
+
+  std::string text;
+  for (int i = 1; i <= 16; ++i)
+  {
+    text += "{\"name\": \"Input " + std::to_string(i) + "\", \"type\": \"Flags\"},";
+  }
+  unsigned int compressedLen = roundTrip(toBytes(text));
+  assertEquals(true, compressedLen * 3 < text.size());
+}
+
+void testDestinationTooSmall()
+{
+  test();
+
+  std::vector<byte> data = toBytes("abcdefgh");
+  byte dest[8];
+  // Random data does not compress and needs an extra byte.
+  assertEquals(0, VLCB::compress(data.data(), data.size(), dest, sizeof(dest)));
+
+  std::vector<byte> runs(100, 0);
+  byte compressed[10];
+  unsigned int compressedLen = VLCB::compress(runs.data(), runs.size(), compressed, sizeof(compressed));
+  byte out[50];
+  assertEquals(0, VLCB::decompress(compressed, compressedLen, out, sizeof(out)));
+
+  // Output overflow is not corrupt data.
+  VLCB::Decompressor decompressor;
+  for (unsigned int i = 0; i < compressedLen && decompressor.put(compressed[i], out, sizeof(out)); ++i)
+  {
+  }
+  assertEquals(false, decompressor.corrupt);
+}
+
+void testCorruptData()
+{
+  test();
+
+  byte out[20];
+  // Distance back past the start of the output.
+  byte badDistance[] = {0x00, 'a', 0x80, 0x05};
+  assertEquals(0, VLCB::decompress(badDistance, sizeof(badDistance), out, sizeof(out)));
+  VLCB::Decompressor decompressor;
+  for (byte b : badDistance)
+  {
+    if (!decompressor.put(b, out, sizeof(out)))
+    {
+      break;
+    }
+  }
+  assertEquals(true, decompressor.corrupt);
+  // Data ends in the middle of a literal run.
+  byte truncated[] = {0x03, 'a', 'b'};
+  assertEquals(0, VLCB::decompress(truncated, sizeof(truncated), out, sizeof(out)));
+}
+
+void testByteByByte()
+{
+  test();
+
+  std::vector<byte> data = toBytes("hello hello hello hello");
+  byte compressed[30];
+  unsigned int compressedLen = VLCB::compress(data.data(), data.size(), compressed, sizeof(compressed));
+
+  VLCB::Decompressor decompressor;
+  byte out[30];
+  for (unsigned int i = 0; i < compressedLen; ++i)
+  {
+    assertEquals(true, decompressor.put(compressed[i], out, sizeof(out)));
+  }
+  assertEquals(true, decompressor.isComplete());
+  assertEquals(data.size(), decompressor.outIndex);
+  assertEquals(0, memcmp(data.data(), out, data.size()));
+}
+
+}
+
+void testCompression()
+{
+  testRoundTrip();
+  testRunsCompress();
+  testTextCompresses();
+  testDestinationTooSmall();
+  testCorruptData();
+  testByteByByte();
+}
@@ -0,0 +1,409 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+// Test cases for ConfigTransferService.
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "TestTools.hpp"
+#include "ArduinoMock.hpp"
+#include "Controller.h"
+#include "LongMessageService.h"
+#include "LongMessageDispatcher.h"
+#include "ConfigTransferService.h"
+#include "MdfService.h"
+#include "Crc16.h"
+#include "VlcbCommon.h"
+#include "MockTransportService.h"
+
+namespace
+{
+std::unique_ptr<MockTransportService> mockTransportService;
+std::unique_ptr<VLCB::LongMessageService> longMessageService;
+std::unique_ptr<VLCB::LongMessageDispatcher> dispatcher;
+std::unique_ptr<VLCB::ConfigTransferService> configTransferService;
+byte buffer[64];
+byte receiveBuffer[64];
+
+VLCB::Controller createController(VLCB::LongMessageService *service = new VLCB::LongMessageService)
+{
+  mockTransportService.reset(new MockTransportService);
+  longMessageService.reset(service);
+  dispatcher.reset(new VLCB::LongMessageDispatcher(*longMessageService, receiveBuffer, sizeof(receiveBuffer)));
+  configTransferService.reset(new VLCB::ConfigTransferService(*dispatcher, buffer, sizeof(buffer)));
+
+  VLCB::Controller controller = ::createController({longMessageService.get(), configTransferService.get(), mockTransportService.get()});
+  controller.begin();
+  return controller;
+}
+
+// Set up 4 NVs and two of the 20 event slots.
+void setConfiguration()
+{
+  for (byte nv = 1; nv <= 4; ++nv)
+  {
+    configuration->writeNV(nv, 10 + nv);
+  }
+  configuration->writeEvent(3, 0x0102, 0x0304);
+  configuration->writeEventEV(3, 1, 7);
+  configuration->writeEventEV(3, 2, 8);
+  configuration->updateEvHashEntry(3);
+  configuration->writeEvent(9, 0x0506, 0x0708);
+  configuration->writeEventEV(9, 1, 9);
+  configuration->writeEventEV(9, 2, 10);
+  configuration->updateEvHashEntry(9);
+}
+
+void clearConfiguration()
+{
+  for (byte nv = 1; nv <= 4; ++nv)
+  {
+    configuration->writeNV(nv, 0);
+  }
+  for (byte i = 0; i < configuration->getNumEvents(); ++i)
+  {
+    configuration->cleareventEEPROM(i);
+    configuration->updateEvHashEntry(i);
+  }
+}
+
+// Long message fragments for a message to the module.
+void sendLongMessage(const std::vector<byte> &message, byte streamId = VLCB::CONFIG_TRANSFER_STREAM_ID)
+{
+  mockTransportService->setNextMessage({8, {OPC_DTXC, streamId, 0,
+                                            (byte)(message.size() >> 8), (byte)message.size(), 0, 0, 0}});
+  byte seq = 1;
+  for (size_t i = 0; i < message.size(); i += 5, ++seq)
+  {
+    VLCB::VlcbMessage msg = {8, {OPC_DTXC, streamId, seq}};
+    for (size_t j = 0; j < 5 && i + j < message.size(); ++j)
+    {
+      msg.data[3 + j] = message[i + j];
+    }
+    mockTransportService->setNextMessage(msg);
+  }
+}
+
+// Long messages sent by the module.
+std::vector<std::vector<byte>> sentLongMessages()
+{
+  std::vector<std::vector<byte>> messages;
+  unsigned int length = 0;
+  for (auto &msg : mockTransportService->sent_messages)
+  {
+    if (msg.data[0] != OPC_DTXC)
+    {
+      continue;
+    }
+    if (msg.data[2] == 0)
+    {
+      length = (msg.data[3] << 8) + msg.data[4];
+      messages.push_back({});
+      continue;
+    }
+    for (int j = 0; j < 5 && messages.back().size() < length; ++j)
+    {
+      messages.back().push_back(msg.data[3 + j]);
+    }
+  }
+  return messages;
+}
+
+// Process until the module has sent a whole long message and return it.
+std::vector<byte> receiveLongMessage(VLCB::Controller &controller)
+{
+  for (int i = 0; i < 50 && longMessageService->is_sending(); ++i)
+  {
+    addMillis(20);
+    process(controller);
+  }
+  process(controller);
+
+  std::vector<std::vector<byte>> messages = sentLongMessages();
+  return messages.empty() ? std::vector<byte>() : messages.back();
+}
+
+std::vector<byte> makeImage()
+{
+  std::vector<byte> image(configTransferService->imageSize());
+  configTransferService->exportImage(image.data(), image.size());
+  return image;
+}
+
+std::vector<byte> makeWriteMessage(const std::vector<byte> &image)
+{
+  std::vector<byte> message = {VLCB::CONFIG_CMD_WRITE, 0x01, 0x04};
+  message.insert(message.end(), image.begin(), image.end());
+  return message;
+}
+
+void testExportImage()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  setConfiguration();
+
+  // Header, 4 NVs, event count, 2 events with index, NN, EN and 2 EVs, CRC.
+  assertEquals(4 + 4 + 1 + 2 * 7 + 2, configTransferService->imageSize());
+
+  std::vector<byte> image = makeImage();
+  assertEquals(VLCB::CONFIG_IMAGE_VERSION, image[0]);
+  assertEquals(4, image[1]);
+  assertEquals(20, image[2]);
+  assertEquals(2, image[3]);
+  assertEquals(11, image[4]);
+  assertEquals(14, image[7]);
+  assertEquals(2, image[8]);
+  assertEquals(3, image[9]);
+  assertEquals(0x01, image[10]);
+  assertEquals(0x04, image[13]);
+  assertEquals(7, image[14]);
+  assertEquals(8, image[15]);
+  assertEquals(9, image[16]);
+  assertEquals(0x05, image[17]);
+  assertEquals(9, image[21]);
+  assertEquals(10, image[22]);
+  assertEquals(VLCB::crc16(image.data(), image.size() - 2), (image[23] << 8) + image[24]);
+  assertEquals(1, configTransferService->getExportCount());
+
+  // Too small buffer.
+  byte small[10];
+  assertEquals(0, configTransferService->exportImage(small, sizeof(small)));
+}
+
+void testReadOverLongMessage()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  setConfiguration();
+  std::vector<byte> expected = makeImage();
+
+  sendLongMessage({VLCB::CONFIG_CMD_READ, 0x01, 0x04});
+  process(controller);
+  std::vector<byte> reply = receiveLongMessage(controller);
+
+  assertEquals(3 + expected.size(), reply.size());
+  assertEquals(VLCB::CONFIG_CMD_IMAGE, reply[0]);
+  assertEquals(0x01, reply[1]);
+  assertEquals(0x04, reply[2]);
+  assertEquals(true, std::equal(expected.begin(), expected.end(), reply.begin() + 3));
+}
+
+void testReadOtherNode()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  sendLongMessage({VLCB::CONFIG_CMD_READ, 0x01, 0x05});
+  process(controller);
+
+  assertEquals(false, longMessageService->is_sending());
+  assertEquals(0, mockTransportService->sent_messages.size());
+}
+
+void testWriteOverLongMessage()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  setConfiguration();
+  std::vector<byte> image = makeImage();
+  clearConfiguration();
+  assertEquals(0, configuration->readNV(1));
+  assertEquals(false, configuration->isEventSlotInUse(3));
+
+  sendLongMessage(makeWriteMessage(image));
+  process(controller);
+  std::vector<byte> reply = receiveLongMessage(controller);
+
+  assertEquals(4, reply.size());
+  assertEquals(VLCB::CONFIG_CMD_RESULT, reply[0]);
+  assertEquals(VLCB::CONFIG_OK, reply[3]);
+  assertEquals(1, configTransferService->getImportCount());
+
+  for (byte nv = 1; nv <= 4; ++nv)
+  {
+    assertEquals(10 + nv, configuration->readNV(nv));
+  }
+  assertEquals(3, configuration->findExistingEvent(0x0102, 0x0304));
+  assertEquals(9, configuration->findExistingEvent(0x0506, 0x0708));
+  assertEquals(8, configuration->getEventEVval(3, 2));
+  assertEquals(9, configuration->getEventEVval(9, 1));
+  assertEquals(2, configuration->numEvents());
+}
+
+void testWriteBadCrc()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  setConfiguration();
+  std::vector<byte> image = makeImage();
+  image[4] ^= 0xFF;
+
+  sendLongMessage(makeWriteMessage(image));
+  process(controller);
+  std::vector<byte> reply = receiveLongMessage(controller);
+
+  assertEquals(4, reply.size());
+  assertEquals(VLCB::CONFIG_CRC_ERROR, reply[3]);
+  assertEquals(11, configuration->readNV(1));
+  assertEquals(0, configTransferService->getImportCount());
+  assertEquals(1, configTransferService->getImportErrorCount());
+}
+
+void testImportValidation()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  setConfiguration();
+  std::vector<byte> image = makeImage();
+
+  // Different number of EVs.
+  std::vector<byte> other = image;
+  other[3] = 3;
+  VLCB::Configuration::setTwoBytes(&other[other.size() - 2], VLCB::crc16(other.data(), other.size() - 2));
+  assertEquals(VLCB::CONFIG_SIZE_MISMATCH, configTransferService->importImage(other.data(), other.size()));
+
+  // Event index outside the event table.
+  other = image;
+  other[9] = 20;
+  VLCB::Configuration::setTwoBytes(&other[other.size() - 2], VLCB::crc16(other.data(), other.size() - 2));
+  assertEquals(VLCB::CONFIG_FORMAT_ERROR, configTransferService->importImage(other.data(), other.size()));
+
+  // Unknown version.
+  other = image;
+  other[0] = 2;
+  assertEquals(VLCB::CONFIG_FORMAT_ERROR, configTransferService->importImage(other.data(), other.size()));
+
+  // Image ends before the number of events.
+  other.assign(image.begin(), image.begin() + 6);
+  other.resize(8);
+  VLCB::Configuration::setTwoBytes(&other[6], VLCB::crc16(other.data(), 6));
+  assertEquals(VLCB::CONFIG_FORMAT_ERROR, configTransferService->importImage(other.data(), other.size()));
+
+  assertEquals(4, configTransferService->getImportErrorCount());
+  assertEquals(VLCB::CONFIG_OK, configTransferService->importImage(image.data(), image.size()));
+}
+
+void testRequestWhileSending()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  setConfiguration();
+  std::vector<byte> expected = makeImage();
+  std::vector<byte> other = expected;
+  other[4] = 99;
+  VLCB::Configuration::setTwoBytes(&other[other.size() - 2], VLCB::crc16(other.data(), other.size() - 2));
+
+  sendLongMessage({VLCB::CONFIG_CMD_READ, 0x01, 0x04});
+  process(controller);
+  assertEquals(true, longMessageService->is_sending());
+
+  // A write while the image is being sent is replied to after the image.
+  sendLongMessage(makeWriteMessage(other));
+  for (int i = 0; i < 100; ++i)
+  {
+    addMillis(20);
+    process(controller);
+  }
+
+  std::vector<std::vector<byte>> messages = sentLongMessages();
+  assertEquals(2, messages.size());
+  assertEquals(3 + expected.size(), messages[0].size());
+  assertEquals(true, std::equal(expected.begin(), expected.end(), messages[0].begin() + 3));
+  assertEquals(4, messages[1].size());
+  assertEquals(VLCB::CONFIG_CMD_RESULT, messages[1][0]);
+  assertEquals(VLCB::CONFIG_OK, messages[1][3]);
+  assertEquals(99, configuration->readNV(1));
+}
+
+void testWriteTooLargeWithEx()
+{
+  test();
+
+  // The context buffers are smaller than the dispatcher buffer and limit the message length.
+  VLCB::LongMessageServiceEx *service = new VLCB::LongMessageServiceEx;
+  service->allocateContexts(1, 16, 1);
+  VLCB::Controller controller = createController(service);
+  setConfiguration();
+  std::vector<byte> image = makeImage();
+  clearConfiguration();
+
+  sendLongMessage(makeWriteMessage(image));
+  process(controller);
+
+  assertEquals(0, configTransferService->getImportCount());
+  assertEquals(0, configuration->readNV(1));
+
+  // Requests that fit are still handled.
+  mockTransportService->clearMessages();
+  sendLongMessage({VLCB::CONFIG_CMD_READ, 0x01, 0x04});
+  process(controller);
+  // LongMessageServiceEx copies the message so is_sending() on the base class is false.
+  for (int i = 0; i < 50; ++i)
+  {
+    addMillis(20);
+    process(controller);
+  }
+  std::vector<byte> reply = receiveLongMessage(controller);
+  assertEquals(3 + configTransferService->imageSize(), reply.size());
+  assertEquals(VLCB::CONFIG_CMD_IMAGE, reply[0]);
+}
+
+void testWithMdfService()
+{
+  test();
+
+  // Both services share the long message service through the dispatcher.
+  mockTransportService.reset(new MockTransportService);
+  longMessageService.reset(new VLCB::LongMessageService);
+  dispatcher.reset(new VLCB::LongMessageDispatcher(*longMessageService, receiveBuffer, sizeof(receiveBuffer)));
+  configTransferService.reset(new VLCB::ConfigTransferService(*dispatcher, buffer, sizeof(buffer)));
+  static const byte mdf[] PROGMEM = "{}";
+  byte mdfBuffer[16];
+  VLCB::MdfService mdfService(*dispatcher, mdf, sizeof(mdf) - 1, VLCB::MDF_FORMAT_JSON, mdfBuffer, sizeof(mdfBuffer));
+  VLCB::Controller controller = ::createController({longMessageService.get(), configTransferService.get(), &mdfService,
+                                                    mockTransportService.get()});
+  controller.begin();
+  setConfiguration();
+  std::vector<byte> expected = makeImage();
+
+  sendLongMessage({VLCB::CONFIG_CMD_READ, 0x01, 0x04});
+  process(controller);
+  std::vector<byte> reply = receiveLongMessage(controller);
+  assertEquals(3 + expected.size(), reply.size());
+  assertEquals(VLCB::CONFIG_CMD_IMAGE, reply[0]);
+
+  mockTransportService->clearMessages();
+  sendLongMessage({VLCB::MDF_CMD_READ, 0x01, 0x04}, VLCB::MDF_STREAM_ID);
+  process(controller);
+  reply = receiveLongMessage(controller);
+  assertEquals(1, mdfService.getRequestCount());
+  assertEquals(VLCB::MDF_MESSAGE_HEADER_LEN + 2, reply.size());
+  assertEquals(VLCB::MDF_CMD_DATA, reply[0]);
+  assertEquals('{', reply[VLCB::MDF_MESSAGE_HEADER_LEN]);
+}
+
+}
+
+void testConfigTransferService()
+{
+  testExportImage();
+  testReadOverLongMessage();
+  testReadOtherNode();
+  testWriteOverLongMessage();
+  testWriteBadCrc();
+  testImportValidation();
+  testRequestWhileSending();
+  testWriteTooLargeWithEx();
+  testWithMdfService();
+}
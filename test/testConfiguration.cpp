@@ -231,6 +231,52 @@ void testFindEventByEv()
   assertEquals(3, result);
 }
 
+void testMayContainEvent()
+{
+  test();
+
+  VLCB::Configuration * configuration = createConfiguration();
+
+  assertEquals(false, configuration->mayContainEvent(6, 9));
+
+  configuration->writeEvent(3, 6, 9);
+  configuration->updateEvHashEntry(3);
+
+  assertEquals(true, configuration->mayContainEvent(6, 9));
+  assertEquals(false, configuration->mayContainEvent(6, 8));
+
+  // Remove the event again.
+  configuration->cleareventEEPROM(3);
+  configuration->updateEvHashEntry(3);
+
+  assertEquals(false, configuration->mayContainEvent(6, 9));
+}
+
+void testRebuildEvHashTable()
+{
+  test();
+
+  VLCB::Configuration * configuration = createConfiguration();
+
+  // Change several events without updating the hash table for each.
+  configuration->writeEvent(2, 6, 9);
+  configuration->writeEvent(5, 7, 1);
+  configuration->rebuildEvHashTable();
+
+  assertEquals(true, configuration->getEvTableEntry(2) != 0);
+  assertEquals(true, configuration->getEvTableEntry(5) != 0);
+  assertEquals(0, configuration->getEvTableEntry(3));
+  assertEquals(true, configuration->mayContainEvent(6, 9));
+  assertEquals(true, configuration->mayContainEvent(7, 1));
+
+  configuration->cleareventEEPROM(2);
+  configuration->rebuildEvHashTable();
+
+  assertEquals(0, configuration->getEvTableEntry(2));
+  assertEquals(false, configuration->mayContainEvent(6, 9));
+  assertEquals(5, configuration->findExistingEvent(7, 1));
+}
+
 }
 
 void testConfiguration()
@@ -248,4 +294,6 @@ void testConfiguration()
   testFindEventNotFoundWithOtherSameHash();
   testFindEventMultiple();
   testFindEventByEv();
+  testMayContainEvent();
+  testRebuildEvHashTable();
 }
\ No newline at end of file
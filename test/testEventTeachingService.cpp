@@ -7,6 +7,7 @@
 
 #include <memory>
 #include "TestTools.hpp"
+#include "ArduinoMock.hpp"
 #include "Controller.h"
 #include "MinimumNodeService.h"
 #include "EventTeachingService.h"
@@ -804,6 +805,44 @@ void testEventHashCollisionAndUnlearn()
   mockTransportService->clearMessages();
 }
 
+void testReadEventsSkipsEmptySlots()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  // Store two events in a table of 20 slots.
+  VLCB::Configuration * module_config = controller.getModuleConfig();
+  module_config->writeEvent(3, 0x0506, 0x0708);
+  module_config->updateEvHashEntry(3);
+  module_config->writeEvent(17, 0x0506, 0x0709);
+  module_config->updateEvHashEntry(17);
+
+  // Data: OP, NN
+  VLCB::VlcbMessage msg = {3, {OPC_NERD, 0x01, 0x04}};
+  mockTransportService->setNextMessage(msg);
+
+  process(controller);
+  assertEquals(true, controller.pendingTasks());
+
+  // Each task step shall send a response. Empty slots shall not use a step each.
+  addMillis(5);
+  process(controller);
+  assertEquals(1, mockTransportService->sent_messages.size());
+  assertEquals(OPC_ENRSP, mockTransportService->sent_messages[0].data[0]);
+  assertEquals(3, mockTransportService->sent_messages[0].data[7]);
+
+  addMillis(5);
+  process(controller);
+  assertEquals(2, mockTransportService->sent_messages.size());
+  assertEquals(OPC_ENRSP, mockTransportService->sent_messages[1].data[0]);
+  assertEquals(0x09, mockTransportService->sent_messages[1].data[6]);
+  assertEquals(17, mockTransportService->sent_messages[1].data[7]);
+
+  // The response took 10ms for two events and is now complete.
+  assertEquals(false, controller.pendingTasks());
+}
+
 void testIgnoreMsgsForOtherNodes()
 {
   test();
@@ -1588,6 +1627,7 @@ void testEventTeachingService()
   testTeachEventIndexedWithoutEV();
   testLearnEventIndexedDelete(); // Delete an event slot.
   testEventHashCollisionAndUnlearn(); // tests event lookup in Configuration::findExistingEvent()
+  testReadEventsSkipsEmptySlots();
   testUpdateProducedEventNNEN();
   testUpdateProducedEventNNENToExistingEvent();
 
@@ -145,6 +145,70 @@ void testGridConnectDecode_DATA(const char * inputMessage, int expectedLEN, bool
   }
 }
 
+void testGridConnectDecode_DataValues()
+{
+  test();
+  VLCB::CANFrame frame;
+  bool result = VLCB::decodeGridConnect(":S0000N00102A3B4C5DFEFF;", &frame);
+
+  assertEquals(true, result);
+  assertEquals(8, frame.len);
+  assertEquals(0x00, frame.data[0]);
+  assertEquals(0x10, frame.data[1]);
+  assertEquals(0x2A, frame.data[2]);
+  assertEquals(0x3B, frame.data[3]);
+  assertEquals(0x4C, frame.data[4]);
+  assertEquals(0x5D, frame.data[5]);
+  assertEquals(0xFE, frame.data[6]);
+  assertEquals(0xFF, frame.data[7]);
+}
+
+void testGridConnectDecode_Terminator(const char * inputMessage, bool expectedResult)
+{
+  test();
+  VLCB::CANFrame frame;
+  bool result = VLCB::decodeGridConnect(inputMessage, &frame);
+
+  assertEquals(expectedResult, result);
+}
+
+void testGridConnectRoundTrip()
+{
+  test();
+  char msgBuffer[30];
+  for (uint32_t id : {0x0u, 0x1u, 0x155u, 0x7FFu, 0x3FFFFu, 0x40000u, 0x12345678u & 0x1FFFFFFF, 0x1FFFFFFFu})
+  {
+    for (bool ext : {false, true})
+    {
+      if (!ext && id > 0x7FF)
+      {
+        continue;
+      }
+      VLCB::CANFrame frame;
+      frame.id = id;
+      frame.ext = ext;
+      frame.rtr = (id & 1) != 0;
+      frame.len = id % 9;
+      for (int i = 0; i < 8; i++)
+      {
+        frame.data[i] = (id >> i) + i * 37;
+      }
+      assertEquals(true, VLCB::encodeGridConnect(msgBuffer, &frame));
+
+      VLCB::CANFrame decoded;
+      assertEquals(true, VLCB::decodeGridConnect(msgBuffer, &decoded));
+      assertEquals(frame.id, decoded.id);
+      assertEquals(frame.ext, decoded.ext);
+      assertEquals(frame.rtr, decoded.rtr);
+      assertEquals(frame.len, decoded.len);
+      for (int i = 0; i < frame.len; i++)
+      {
+        assertEquals(frame.data[i], decoded.data[i]);
+      }
+    }
+  }
+}
+
 void testGridConnect()
 {
   // test encoding standard ID - 11 bits, max id 0x7FF
@@ -233,4 +297,16 @@ void testGridConnect()
   testGridConnectDecode_DATA(":X00000000N000102030405FEFF09;", 9, false);   // extended msg, too many data bytes
   testGridConnectDecode_DATA(":X00000000NQ00102030405FEFF;", 8, false);     // extended msg, invalid char in data
   testGridConnectDecode_DATA(":X00000000N000102030405FEFQ;", 8, false);     // extended msg, invalid char in data
+
+  testGridConnectDecode_DataValues();
+
+  // test decode end of frame character
+  testGridConnectDecode_Terminator(":S0000N01", false);                     // missing end of frame
+  testGridConnectDecode_Terminator(":S0000N01;;", false);                   // extra end of frame
+  testGridConnectDecode_Terminator(":S0000N01;0", false);                   // characters after end of frame
+  testGridConnectDecode_Terminator(":S0000", false);                        // truncated in ID
+  testGridConnectDecode_Terminator(":X0000", false);                        // truncated in ID
+  testGridConnectDecode_Terminator("", false);                              // empty
+
+  testGridConnectRoundTrip();
 }
\ No newline at end of file
@@ -0,0 +1,24 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+// Tests for host code that uses real sockets.
+// These are not part of testAll as they need free TCP ports on the loopback interface.
+
+#include <iostream>
+#include "TestTools.hpp"
+
+void testTcpGridConnect();
+
+int main()
+{
+  suite("TcpGridConnect");
+  testTcpGridConnect();
+  int totalFailures = failures();
+  if (totalFailures > 0)
+  {
+    std::cout << "Completed with totalFailures. " << totalFailures << " test(s) failed." << std::endl;
+  }
+  return totalFailures;
+}
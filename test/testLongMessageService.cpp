@@ -5,14 +5,21 @@
 
 // Test cases for LongMessageService.
 
+#include <algorithm>
 #include <memory>
+#include <string>
+#include <vector>
 #include "TestTools.hpp"
+#include "ArduinoMock.hpp"
 #include "Controller.h"
 #include "MinimumNodeService.h"
 #include "LongMessageService.h"
+#include "Crc16.h"
 #include "Parameters.h"
 #include "VlcbCommon.h"
 #include "MockTransportService.h"
+#include "MockCanTransport.h"
+#include "CanService.h"
 
 namespace
 {
@@ -34,6 +41,93 @@ VLCB::Controller createController()
   return controller;
 }
 
+std::unique_ptr<VLCB::LongMessageServiceEx> longMessageServiceEx;
+
+struct ReceivedMessage
+{
+  std::string data;
+  byte streamId;
+  byte status;
+};
+std::vector<ReceivedMessage> receivedMessages;
+
+void messageHandler(void *msg, unsigned int msg_len, byte stream_id, byte status)
+{
+  receivedMessages.push_back({std::string((const char *)msg, msg_len), stream_id, status});
+}
+
+byte subscribedStreams[] = {3, 4};
+
+VLCB::Controller createControllerEx()
+{
+  static std::unique_ptr<VLCB::MinimumNodeService> minimumNodeService;
+  minimumNodeService.reset(new VLCB::MinimumNodeService);
+
+  mockTransportService.reset(new MockTransportService);
+
+  longMessageServiceEx.reset(new VLCB::LongMessageServiceEx);
+  longMessageServiceEx->allocateContexts();
+  longMessageServiceEx->subscribe(subscribedStreams, sizeof(subscribedStreams), messageHandler);
+  receivedMessages.clear();
+
+  VLCB::Controller controller = ::createController({minimumNodeService.get(), longMessageServiceEx.get(), mockTransportService.get()});
+  controller.begin();
+
+  return controller;
+}
+
+// The original bit by bit CRC-16 implementation used to check the table driven one.
+uint16_t referenceCrc16(const byte *data_p, uint16_t length)
+{
+  uint8_t i;
+  uint16_t data;
+  uint16_t crc = 0xffff;
+
+  if (length == 0)
+  {
+    return (~crc);
+  }
+
+  do
+  {
+    for (i = 0, data = (uint16_t) 0xff & *data_p++;
+         i < 8;
+         i++, data >>= 1)
+    {
+      if ((crc & 0x0001) ^ (data & 0x0001))
+      {
+        crc = (crc >> 1) ^ 0x8408;
+      }
+      else
+      { crc >>= 1; }
+    }
+  } while (--length);
+
+  crc = ~crc;
+  data = crc;
+  crc = (crc << 8) | (data >> 8 & 0xff);
+
+  return (crc);
+}
+
+// Header packet followed by data packets for a message.
+std::vector<VLCB::VlcbMessage> makeFragments(byte streamId, const std::string &text, uint16_t crc)
+{
+  std::vector<VLCB::VlcbMessage> fragments;
+  fragments.push_back({8, {OPC_DTXC, streamId, 0, (byte)(text.size() >> 8), (byte)text.size(), (byte)(crc >> 8), (byte)crc, 0}});
+  byte seq = 1;
+  for (size_t i = 0; i < text.size(); i += 5, ++seq)
+  {
+    VLCB::VlcbMessage msg = {8, {OPC_DTXC, streamId, seq}};
+    for (size_t j = 0; j < 5 && i + j < text.size(); ++j)
+    {
+      msg.data[3 + j] = text[i + j];
+    }
+    fragments.push_back(msg);
+  }
+  return fragments;
+}
+
 void testServiceDiscovery()
 {
   test();
@@ -81,10 +175,1115 @@ void testServiceDiscoveryEventProdSvc()
   // Not testing service data bytes.
 }
 
+void testCrc16()
+{
+  test();
+
+  // Check value for CRC-16/X-25 with the result bytes swapped.
+  const byte check[] = "123456789";
+  assertEquals(0x6E90, VLCB::crc16(check, 9));
+  assertEquals(0, VLCB::crc16(check, 0));
+
+  byte data[300];
+  for (unsigned int i = 0; i < sizeof(data); ++i)
+  {
+    data[i] = (i * 151 + 17) ^ (i >> 3);
+  }
+  for (unsigned int length = 0; length <= sizeof(data); length += 7)
+  {
+    assertEquals(referenceCrc16(data, length), VLCB::crc16(data, length));
+
+    // Calculating in 5 byte steps as fragments arrive gives the same result.
+    uint16_t crc = VLCB::CRC16_INIT;
+    for (unsigned int i = 0; i < length; i += 5)
+    {
+      crc = VLCB::crc16Update(crc, data + i, length - i < 5 ? length - i : 5);
+    }
+    assertEquals(referenceCrc16(data, length), VLCB::crc16Final(crc));
+  }
+}
+
+void testSendLongMessageWithCrc()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  longMessageServiceEx->use_crc(true);
+
+  assertEquals(true, longMessageServiceEx->sendLongMessage("123456789", 9, 3));
+  for (int i = 0; i < 20 && longMessageServiceEx->is_sending(); ++i)
+  {
+    addMillis(20);
+    process(controller);
+  }
+
+  assertEquals(3, mockTransportService->sent_messages.size());
+  VLCB::VlcbMessage &header = mockTransportService->sent_messages[0];
+  assertEquals(OPC_DTXC, header.data[0]);
+  assertEquals(3, header.data[1]);
+  assertEquals(0, header.data[2]);
+  assertEquals(9, header.data[4]);
+  assertEquals(0x6E, header.data[5]);
+  assertEquals(0x90, header.data[6]);
+  assertEquals('1', mockTransportService->sent_messages[1].data[3]);
+  assertEquals('6', mockTransportService->sent_messages[2].data[3]);
+}
+
+void testReceiveLongMessageWithCrc()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  longMessageServiceEx->use_crc(true);
+
+  std::string text = "Hello VLCB long message";
+  for (auto &fragment : makeFragments(3, text, referenceCrc16((const byte *)text.data(), text.size())))
+  {
+    mockTransportService->setNextMessage(fragment);
+  }
+  process(controller);
+
+  assertEquals(1, receivedMessages.size());
+  assertEquals(text.c_str(), receivedMessages[0].data.c_str());
+  assertEquals(3, receivedMessages[0].streamId);
+  assertEquals(VLCB::LONG_MESSAGE_COMPLETE, receivedMessages[0].status);
+}
+
+void testReceiveLongMessageWithBadCrc()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  longMessageServiceEx->use_crc(true);
+
+  std::string text = "Hello VLCB long message";
+  std::vector<VLCB::VlcbMessage> fragments = makeFragments(4, text, referenceCrc16((const byte *)text.data(), text.size()));
+  fragments[2].data[4] ^= 0x01;
+  for (auto &fragment : fragments)
+  {
+    mockTransportService->setNextMessage(fragment);
+  }
+  process(controller);
+
+  assertEquals(1, receivedMessages.size());
+  assertEquals(VLCB::LONG_MESSAGE_CRC_ERROR, receivedMessages[0].status);
+}
+
+std::string makeText(unsigned int length)
+{
+  std::string text;
+  for (unsigned int i = 0; i < length; ++i)
+  {
+    text += (char)('a' + i % 26);
+  }
+  return text;
+}
+
+void testFixedPacing()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+
+  std::string text = makeText(20);
+  assertEquals(true, service->sendLongMessage(text.c_str(), text.size(), 3));
+
+  // Header and then one fragment per 20ms.
+  for (int i = 0; i < 10; ++i)
+  {
+    addMillis(10);
+    process(controller);
+  }
+  assertEquals(5, mockTransportService->sent_messages.size());
+  assertEquals(false, service->is_sending());
+  assertEquals(20, service->getBytesSent());
+  assertEquals(4, service->getFragmentsSent());
+  assertEquals(0, service->getPacingBackoffs());
+  // 20 bytes in 80ms
+  assertEquals(250, service->getLastThroughput());
+}
+
+void testFixedPacingNoDelay()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+  service->setDelay(0);
+
+  std::string text = makeText(20);
+  assertEquals(true, service->sendLongMessage(text.c_str(), text.size(), 3));
+
+  // Without adaptive pacing only one fragment is sent in each call to process().
+  controller.process();
+  assertEquals(1, controller.getActionQueue().bufUse());
+
+  // Fragments are sent even if the action queue is half full.
+  for (int i = 0; i < VLCB::ACTION_QUEUE_SIZE / 2; ++i)
+  {
+    controller.putAction(VLCB::ACT_INDICATE_ACTIVITY);
+  }
+  service->process();
+  assertEquals(VLCB::ACTION_QUEUE_SIZE / 2 + 2, controller.getActionQueue().bufUse());
+}
+
+void testAdaptivePacingIdleTransport()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+  MockCanTransport transport;
+  transport.transmitBufferSizeValue = 16;
+  service->setAdaptivePacing(&transport, 0, 20);
+
+  std::string text = makeText(100);
+  assertEquals(true, service->sendLongMessage(text.c_str(), text.size(), 3));
+
+  // Fragments are sent back to back without waiting.
+  for (int i = 0; i < 10 && service->is_sending(); ++i)
+  {
+    process(controller);
+  }
+  assertEquals(false, service->is_sending());
+  assertEquals(21, mockTransportService->sent_messages.size());
+  assertEquals(20, service->getFragmentsSent());
+  assertEquals(0, service->getPacingBackoffs());
+  for (int i = 1; i <= 20; ++i)
+  {
+    assertEquals(i, mockTransportService->sent_messages[i].data[2]);
+  }
+}
+
+void testAdaptivePacingBusyTransport()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+  MockCanTransport transport;
+  transport.transmitBufferSizeValue = 8;
+  transport.transmitBufferUsageValue = 16;
+  service->setAdaptivePacing(&transport, 2, 30);
+
+  std::string text = makeText(15);
+  assertEquals(true, service->sendLongMessage(text.c_str(), text.size(), 3));
+  process(controller);
+  mockTransportService->sent_messages.clear();
+
+  // A full transport means the max interval.
+  addMillis(29);
+  process(controller);
+  assertEquals(0, mockTransportService->sent_messages.size());
+  addMillis(1);
+  process(controller);
+  assertEquals(1, mockTransportService->sent_messages.size());
+  assertEquals(1, service->getPacingBackoffs());
+
+  // Half full transport gives an interval between min and max.
+  // Usage 4 of 8 in the transport and 8 in the action queue gives 2 + 28 * 4 / 16 = 9ms.
+  transport.transmitBufferUsageValue = 4;
+  addMillis(8);
+  process(controller);
+  assertEquals(1, mockTransportService->sent_messages.size());
+  addMillis(1);
+  process(controller);
+  assertEquals(2, mockTransportService->sent_messages.size());
+
+  // Idle transport gives the min interval.
+  transport.transmitBufferUsageValue = 0;
+  addMillis(2);
+  process(controller);
+  assertEquals(3, mockTransportService->sent_messages.size());
+  assertEquals(2, service->getPacingBackoffs());
+  assertEquals(false, service->is_sending());
+}
+
+void testStreamPacingEx()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  MockCanTransport transport;
+  longMessageServiceEx->setAdaptivePacing(&transport, 0, 20);
+
+  std::string slow = makeText(10);
+  std::string fast = makeText(10);
+  assertEquals(true, longMessageServiceEx->sendLongMessage(slow.c_str(), slow.size(), 3));
+  assertEquals(true, longMessageServiceEx->sendLongMessage(fast.c_str(), fast.size(), 4));
+  assertEquals(true, longMessageServiceEx->setStreamPacing(3, 50, 50));
+  assertEquals(false, longMessageServiceEx->setStreamPacing(5, 50, 50));
+
+  process(controller);
+  process(controller);
+
+  // Stream 4 is sent without waiting. Stream 3 waits 50ms between fragments.
+  assertEquals(1, longMessageServiceEx->is_sending());
+  assertEquals(4, mockTransportService->sent_messages.size());
+  assertEquals(0, mockTransportService->sent_messages[0].data[2]); // headers
+  assertEquals(0, mockTransportService->sent_messages[1].data[2]);
+  assertEquals(4, mockTransportService->sent_messages[2].data[1]);
+  assertEquals(4, mockTransportService->sent_messages[3].data[1]);
+
+  addMillis(50);
+  process(controller);
+  assertEquals(5, mockTransportService->sent_messages.size());
+  assertEquals(3, mockTransportService->sent_messages[4].data[1]);
+}
+
+void testPacingBackoffsEx()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  MockCanTransport transport;
+  transport.transmitBufferSizeValue = 8;
+  transport.transmitBufferUsageValue = 16;
+  longMessageServiceEx->setAdaptivePacing(&transport, 2, 30);
+
+  std::string text = makeText(10);
+  assertEquals(true, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 3));
+  assertEquals(true, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 4));
+  process(controller);
+  mockTransportService->sent_messages.clear();
+
+  // Only fragments sent after the longer interval count as back-offs,
+  // not each time the scheduler checks whether a fragment is due.
+  for (int i = 0; i < 4; ++i)
+  {
+    addMillis(30);
+    process(controller);
+  }
+  assertEquals(4, mockTransportService->sent_messages.size());
+  assertEquals(4, longMessageServiceEx->getPacingBackoffs());
+  assertEquals(0, longMessageServiceEx->is_sending());
+}
+
+}
+
+struct Completion
+{
+  byte streamId;
+  byte status;
+};
+std::vector<Completion> completions;
+
+void completionHandler(const byte stream_id, const byte status)
+{
+  completions.push_back({stream_id, status});
+}
+
+void testQueuedMessages()
+{
+  test();
+  completions.clear();
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+  VLCB::send_queue_entry_t queue[2];
+  service->setSendQueue(queue, 2);
+
+  std::string first = makeText(10);
+  std::string second = makeText(5);
+  std::string third = makeText(5);
+  assertEquals(true, service->queueLongMessage(first.c_str(), first.size(), 3, completionHandler));
+  assertEquals(true, service->queueLongMessage(second.c_str(), second.size(), 4, completionHandler));
+  assertEquals(true, service->queueLongMessage(third.c_str(), third.size(), 5));
+  // First message has started so there are two waiting in the queue.
+  assertEquals(2, service->getSendQueueUsage());
+  assertEquals(false, service->queueLongMessage(third.c_str(), third.size(), 6));
+
+  for (int i = 0; i < 20; ++i)
+  {
+    addMillis(10);
+    process(controller);
+  }
+
+  assertEquals(0, service->getSendQueueUsage());
+  assertEquals(false, service->is_sending());
+  // Header and fragments for each message, one message after the other.
+  assertEquals(3 + 2 + 2, mockTransportService->sent_messages.size());
+  assertEquals(3, mockTransportService->sent_messages[0].data[1]);
+  assertEquals(3, mockTransportService->sent_messages[2].data[1]);
+  assertEquals(4, mockTransportService->sent_messages[3].data[1]);
+  assertEquals(5, mockTransportService->sent_messages[5].data[1]);
+  assertEquals(0, mockTransportService->sent_messages[5].data[2]);
+  // Only messages with a completion function are reported.
+  assertEquals(2, completions.size());
+  assertEquals(3, completions[0].streamId);
+  assertEquals(VLCB::LONG_MESSAGE_COMPLETE, completions[0].status);
+  assertEquals(4, completions[1].streamId);
+}
+
+void testSendWithQueue()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+  VLCB::send_queue_entry_t queue[2];
+  service->setSendQueue(queue, 2);
+
+  std::string first = makeText(10);
+  std::string second = makeText(5);
+  std::string third = makeText(5);
+  assertEquals(true, service->queueLongMessage(first.c_str(), first.size(), 3));
+  assertEquals(true, service->queueLongMessage(second.c_str(), second.size(), 4));
+  // A message sent while others are queued waits its turn.
+  assertEquals(true, service->sendLongMessage(third.c_str(), third.size(), 5));
+  assertEquals(2, service->getSendQueueUsage());
+  // The queue is full.
+  assertEquals(false, service->sendLongMessage(third.c_str(), third.size(), 6));
+
+  for (int i = 0; i < 20; ++i)
+  {
+    addMillis(10);
+    process(controller);
+  }
+
+  assertEquals(3 + 2 + 2, mockTransportService->sent_messages.size());
+  assertEquals(3, mockTransportService->sent_messages[0].data[1]);
+  assertEquals(4, mockTransportService->sent_messages[3].data[1]);
+  assertEquals(5, mockTransportService->sent_messages[5].data[1]);
+}
+
+void testQueuedMessagesEx()
+{
+  test();
+  completions.clear();
+
+  VLCB::Controller controller = createControllerEx();
+  VLCB::send_queue_entry_t queue[4];
+  longMessageServiceEx->setSendQueue(queue, 4);
+
+  // More messages than send contexts. The last one waits for a free context.
+  std::string texts[VLCB::NUM_EX_CONTEXTS + 1];
+  for (byte i = 0; i <= VLCB::NUM_EX_CONTEXTS; ++i)
+  {
+    texts[i] = makeText(5 + i);
+    assertEquals(true, longMessageServiceEx->queueLongMessage(texts[i].c_str(), texts[i].size(), 10 + i, completionHandler));
+  }
+  process(controller);
+  assertEquals(VLCB::NUM_EX_CONTEXTS, longMessageServiceEx->is_sending());
+  assertEquals(1, longMessageServiceEx->getSendQueueUsage());
+
+  for (int i = 0; i < 20; ++i)
+  {
+    addMillis(10);
+    process(controller);
+  }
+
+  assertEquals(0, longMessageServiceEx->getSendQueueUsage());
+  assertEquals(0, longMessageServiceEx->is_sending());
+  assertEquals(VLCB::NUM_EX_CONTEXTS + 1, completions.size());
+  assertEquals(10 + VLCB::NUM_EX_CONTEXTS, completions[VLCB::NUM_EX_CONTEXTS].streamId);
+}
+
+struct StreamedFragment
+{
+  std::string data;
+  unsigned int offset;
+  unsigned int messageLength;
+  byte streamId;
+  byte status;
+};
+std::vector<StreamedFragment> streamedFragments;
+
+void streamHandler(const void *data, const unsigned int data_len, const unsigned int offset, const unsigned int message_len, const byte stream_id, const byte status)
+{
+  streamedFragments.push_back({std::string((const char *)data, data_len), offset, message_len, stream_id, status});
+}
+
+void testStreamingReceive()
+{
+  test();
+  streamedFragments.clear();
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+  service->subscribeStreaming(subscribedStreams, sizeof(subscribedStreams), streamHandler);
+
+  std::string text = makeText(12);
+  for (auto &fragment : makeFragments(3, text, 0))
+  {
+    mockTransportService->setNextMessage(fragment);
+  }
+  process(controller);
+
+  // One call per fragment with the data, its offset and the message length.
+  assertEquals(3, streamedFragments.size());
+  std::string received;
+  for (unsigned int i = 0; i < streamedFragments.size(); ++i)
+  {
+    assertEquals(received.size(), streamedFragments[i].offset);
+    assertEquals(12, streamedFragments[i].messageLength);
+    assertEquals(3, streamedFragments[i].streamId);
+    received += streamedFragments[i].data;
+  }
+  assertEquals(text.c_str(), received.c_str());
+  assertEquals(VLCB::LONG_MESSAGE_INCOMPLETE, streamedFragments[1].status);
+  assertEquals(VLCB::LONG_MESSAGE_COMPLETE, streamedFragments[2].status);
+  assertEquals(2, streamedFragments[2].data.size());
+}
+
+void testStreamingReceiveSequenceError()
+{
+  test();
+  streamedFragments.clear();
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+  service->subscribeStreaming(subscribedStreams, sizeof(subscribedStreams), streamHandler);
+
+  std::vector<VLCB::VlcbMessage> fragments = makeFragments(3, makeText(20), 0);
+  fragments.erase(fragments.begin() + 2);
+  for (auto &fragment : fragments)
+  {
+    mockTransportService->setNextMessage(fragment);
+  }
+  process(controller);
+
+  assertEquals(2, streamedFragments.size());
+  assertEquals(VLCB::LONG_MESSAGE_SEQUENCE_ERROR, streamedFragments[1].status);
+  assertEquals(0, streamedFragments[1].data.size());
+  assertEquals(5, streamedFragments[1].offset);
+}
+
+void testStreamingReceiveEx()
+{
+  test();
+  streamedFragments.clear();
+
+  mockTransportService.reset(new MockTransportService);
+  longMessageServiceEx.reset(new VLCB::LongMessageServiceEx);
+  // No receive buffers are needed.
+  assertEquals(true, longMessageServiceEx->allocateContexts(VLCB::NUM_EX_CONTEXTS, 0));
+  longMessageServiceEx->subscribeStreaming(subscribedStreams, sizeof(subscribedStreams), streamHandler);
+  longMessageServiceEx->use_crc(true);
+  VLCB::Controller controller = ::createController({longMessageServiceEx.get(), mockTransportService.get()});
+  controller.begin();
+
+  // Longer than any receive buffer.
+  std::string text = makeText(VLCB::EX_BUFFER_LEN * 2);
+  for (auto &fragment : makeFragments(4, text, referenceCrc16((const byte *)text.data(), text.size())))
+  {
+    mockTransportService->setNextMessage(fragment);
+  }
+  process(controller);
+
+  std::string received;
+  for (auto &fragment : streamedFragments)
+  {
+    received += fragment.data;
+  }
+  assertEquals(text.c_str(), received.c_str());
+  assertEquals(VLCB::LONG_MESSAGE_COMPLETE, streamedFragments.back().status);
+}
+
+void testStaticArena()
+{
+  test();
+
+  static VLCB::LongMessageArena<2, 32, 2> arena;
+  assertEquals(VLCB::longMessageArenaSize(2, 32, 2), sizeof(arena.data));
+
+  mockTransportService.reset(new MockTransportService);
+  longMessageServiceEx.reset(new VLCB::LongMessageServiceEx);
+  assertEquals(true, longMessageServiceEx->allocateContexts(arena));
+  longMessageServiceEx->subscribe(subscribedStreams, sizeof(subscribedStreams), messageHandler);
+  receivedMessages.clear();
+  VLCB::Controller controller = ::createController({longMessageServiceEx.get(), mockTransportService.get()});
+  controller.begin();
+
+  // Receive buffers are in the arena.
+  std::string text = makeText(20);
+  for (auto &fragment : makeFragments(3, text, 0))
+  {
+    mockTransportService->setNextMessage(fragment);
+  }
+  process(controller);
+  assertEquals(1, receivedMessages.size());
+  assertEquals(text.c_str(), receivedMessages[0].data.c_str());
+
+  // Send contexts are in the arena.
+  assertEquals(true, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 3));
+  assertEquals(true, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 4));
+  assertEquals(false, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 5));
+}
+
+void testArenaTooSmall()
+{
+  test();
+
+  static VLCB::LongMessageArena<2, 32, 2> arena;
+  VLCB::LongMessageServiceEx service;
+
+  assertEquals(false, service.allocateContexts(arena.data, sizeof(arena.data), 2, 33, 2));
+  // Misaligned arena.
+  assertEquals(false, service.allocateContexts(arena.data + 1, sizeof(arena.data) - 1, 1, 8, 1));
+
+  // No contexts are left half initialised.
+  std::string text = makeText(10);
+  assertEquals(false, service.sendLongMessage(text.c_str(), text.size(), 3));
+  assertEquals(0, service.is_sending());
+}
+
+// Stream IDs of the data fragments sent so far, in order.
+std::vector<byte> sentDataStreams()
+{
+  std::vector<byte> streams;
+  for (auto &msg : mockTransportService->sent_messages)
+  {
+    if (msg.data[2] != 0)
+    {
+      streams.push_back(msg.data[1]);
+    }
+  }
+  return streams;
+}
+
+void testUrgentStreamFirst()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  MockCanTransport transport;
+  // No pacing delay so that only the bus limits sending.
+  longMessageServiceEx->setAdaptivePacing(&transport, 0, 0);
+  assertEquals(true, longMessageServiceEx->setStreamPriority(3, 2));
+  assertEquals(true, longMessageServiceEx->setStreamPriority(4, 0));
+
+  std::string bulk = makeText(100);
+  std::string urgent = makeText(15);
+  assertEquals(true, longMessageServiceEx->sendLongMessage(bulk.c_str(), bulk.size(), 3));
+  assertEquals(true, longMessageServiceEx->sendLongMessage(urgent.c_str(), urgent.size(), 4));
+
+  // At most a burst of fragments is sent per call.
+  for (int i = 0; i < 20 && longMessageServiceEx->is_sending(); ++i)
+  {
+    addMillis(1);
+    controller.process();
+  }
+  assertEquals(0, longMessageServiceEx->is_sending());
+  process(controller);
+
+  // The urgent message is sent before the rest of the bulk message.
+  std::vector<byte> streams = sentDataStreams();
+  assertEquals(23, streams.size());
+  for (int i = 0; i < 3; ++i)
+  {
+    assertEquals(4, streams[i]);
+  }
+  assertEquals(100, longMessageServiceEx->getStreamBytesSent(3));
+  assertEquals(15, longMessageServiceEx->getStreamBytesSent(4));
+  assertEquals(true, longMessageServiceEx->getStreamLatency(4) < longMessageServiceEx->getStreamLatency(3));
+}
+
+void testStreamsWithoutPriority()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+
+  // Send on more streams than there is room for in the stream table.
+  std::string text = makeText(5);
+  for (byte stream = 20; stream < 20 + VLCB::LONG_MESSAGE_MAX_STREAMS + 1; ++stream)
+  {
+    assertEquals(true, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), stream));
+    for (int i = 0; i < 5; ++i)
+    {
+      addMillis(10);
+      process(controller);
+    }
+  }
+  assertEquals(0, longMessageServiceEx->is_sending());
+
+  // No statistics are kept for these streams so the table still has room.
+  assertEquals(0, longMessageServiceEx->getStreamBytesSent(20));
+  assertEquals(true, longMessageServiceEx->setStreamPriority(3, 1));
+}
+
+void testWeightedStreams()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  MockCanTransport transport;
+  longMessageServiceEx->setAdaptivePacing(&transport, 0, 0);
+  longMessageServiceEx->setStreamPriority(3, 1, 2);
+  longMessageServiceEx->setStreamPriority(4, 1, 1);
+
+  std::string text = makeText(60);
+  assertEquals(true, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 3));
+  assertEquals(true, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 4));
+  process(controller);
+
+  // Stream 3 gets twice the bandwidth of stream 4 while both are sending.
+  std::vector<byte> streams = sentDataStreams();
+  assertEquals(true, streams.size() >= 6);
+  assertEquals(4, std::count(streams.begin(), streams.begin() + 6, 3));
+  assertEquals(2, std::count(streams.begin(), streams.begin() + 6, 4));
+}
+
+// Feed messages sent by the module back to it, as if from another module.
+void loopBackSentMessages()
+{
+  for (auto &msg : mockTransportService->sent_messages)
+  {
+    mockTransportService->setNextMessage(msg);
+  }
+  mockTransportService->sent_messages.clear();
+}
+
+void testCompressedMessage()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  longMessageServiceEx->use_crc(true);
+  longMessageServiceEx->use_compression(true);
+
+  std::string text;
+  for (int i = 0; i < 3; ++i)
+  {
+    text += "{\"name\": \"NV\"},";
+  }
+  assertEquals(true, text.size() <= VLCB::EX_BUFFER_LEN);
+  assertEquals(true, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 3));
+  for (int i = 0; i < 20; ++i)
+  {
+    addMillis(20);
+    process(controller);
+  }
+
+  // Header is flagged and the length is the compressed length.
+  VLCB::VlcbMessage &header = mockTransportService->sent_messages[0];
+  assertEquals(VLCB::LONG_MESSAGE_FLAG_COMPRESSED, header.data[7]);
+  unsigned int compressedLen = (header.data[3] << 8) + header.data[4];
+  assertEquals(true, compressedLen < text.size() / 2);
+  assertEquals(1 + (compressedLen + 4) / 5, mockTransportService->sent_messages.size());
+  assertEquals(text.size() - compressedLen, longMessageServiceEx->getCompressionSavings());
+
+  // The receiver decompresses and checks the CRC of the original message.
+  loopBackSentMessages();
+  process(controller);
+  assertEquals(1, receivedMessages.size());
+  assertEquals(VLCB::LONG_MESSAGE_COMPLETE, receivedMessages[0].status);
+  assertEquals(text.c_str(), receivedMessages[0].data.c_str());
+}
+
+void testIncompressibleMessage()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  longMessageServiceEx->use_compression(true);
+
+  std::string text = "abcdefghij";
+  assertEquals(true, longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 3));
+  process(controller);
+
+  // Sent as it is.
+  assertEquals(0, mockTransportService->sent_messages[0].data[7]);
+  assertEquals(10, mockTransportService->sent_messages[0].data[4]);
+  assertEquals(0, longMessageServiceEx->getCompressionSavings());
+}
+
+void testPlainReceiverIgnoresCompressed()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+  byte buffer[40];
+  service->subscribe(subscribedStreams, sizeof(subscribedStreams), buffer, sizeof(buffer), messageHandler);
+  receivedMessages.clear();
+
+  std::vector<VLCB::VlcbMessage> fragments = makeFragments(3, "aaaaaaaaaaaaaaa", 0);
+  fragments[0].data[7] = VLCB::LONG_MESSAGE_FLAG_COMPRESSED;
+  for (auto &fragment : fragments)
+  {
+    mockTransportService->setNextMessage(fragment);
+  }
+  process(controller);
+
+  assertEquals(0, receivedMessages.size());
+}
+
+void testCorruptCompressedMessage()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+
+  // Distance back past the start of the output.
+  std::vector<VLCB::VlcbMessage> fragments = makeFragments(3, std::string("\x00" "a\x80\x05", 4), 0);
+  fragments[0].data[7] = VLCB::LONG_MESSAGE_FLAG_COMPRESSED;
+  // A run that does not fit the receive buffer.
+  std::vector<VLCB::VlcbMessage> tooLong = makeFragments(3, std::string("\x00" "a\xFF\x00", 4), 0);
+  tooLong[0].data[7] = VLCB::LONG_MESSAGE_FLAG_COMPRESSED;
+  fragments.insert(fragments.end(), tooLong.begin(), tooLong.end());
+  for (auto &fragment : fragments)
+  {
+    mockTransportService->setNextMessage(fragment);
+  }
+  process(controller);
+
+  assertEquals(2, receivedMessages.size());
+  assertEquals(VLCB::LONG_MESSAGE_CRC_ERROR, receivedMessages[0].status);
+  assertEquals(VLCB::LONG_MESSAGE_TRUNCATED, receivedMessages[1].status);
+}
+
+void testRecoveryRequestsMissingFragment()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  longMessageServiceEx->use_crc(true);
+  longMessageServiceEx->use_recovery(true);
+
+  std::string text = "abcdefghijklmnopqrstuvwxy";
+  std::vector<VLCB::VlcbMessage> fragments = makeFragments(3, text, referenceCrc16((const byte *)text.data(), text.size()));
+  for (auto &fragment : fragments)
+  {
+    if (fragment.data[2] != 3)
+    {
+      mockTransportService->setNextMessage(fragment);
+    }
+  }
+  process(controller);
+
+  // Waits for the missing fragment instead of reporting a sequence error.
+  assertEquals(0, receivedMessages.size());
+  assertEquals(1, mockTransportService->sent_messages.size());
+  VLCB::VlcbMessage &nack = mockTransportService->sent_messages[0];
+  assertEquals(OPC_DTXC, nack.data[0]);
+  assertEquals(3, nack.data[1]);
+  assertEquals(0, nack.data[2]);
+  assertEquals(3, nack.data[3]);
+  assertEquals(0, nack.data[4]);
+  assertEquals(VLCB::LONG_MESSAGE_FLAG_NACK, nack.data[7]);
+  assertEquals(1, longMessageServiceEx->getNacksSent());
+
+  mockTransportService->setNextMessage(fragments[3]);
+  process(controller);
+
+  assertEquals(1, receivedMessages.size());
+  assertEquals(VLCB::LONG_MESSAGE_COMPLETE, receivedMessages[0].status);
+  assertEquals(text.c_str(), receivedMessages[0].data.c_str());
+}
+
+void testRecoveryRequestsLostTail()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  longMessageServiceEx->use_recovery(true);
+
+  std::vector<VLCB::VlcbMessage> fragments = makeFragments(3, "abcdefghijklmnopqrstuvwxy", 0);
+  for (int i = 0; i < 3; ++i)
+  {
+    mockTransportService->setNextMessage(fragments[i]);
+  }
+  process(controller);
+  assertEquals(0, mockTransportService->sent_messages.size());
+
+  // The receiver cannot tell that the last fragments are lost until they do not arrive.
+  addMillis(VLCB::LONG_MESSAGE_NACK_INTERVAL);
+  process(controller);
+
+  assertEquals(1, mockTransportService->sent_messages.size());
+  VLCB::VlcbMessage &nack = mockTransportService->sent_messages[0];
+  assertEquals(3, nack.data[3]);
+  assertEquals(4, nack.data[4]);
+  assertEquals(5, nack.data[5]);
+  assertEquals(0, nack.data[6]);
+  assertEquals(VLCB::LONG_MESSAGE_FLAG_NACK, nack.data[7]);
+
+  mockTransportService->setNextMessage(fragments[5]);
+  mockTransportService->setNextMessage(fragments[3]);
+  mockTransportService->setNextMessage(fragments[4]);
+  process(controller);
+
+  assertEquals(1, receivedMessages.size());
+  assertEquals(VLCB::LONG_MESSAGE_COMPLETE, receivedMessages[0].status);
+  assertEquals("abcdefghijklmnopqrstuvwxy", receivedMessages[0].data.c_str());
+}
+
+void testRecoveryNackInterval()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  // The sender paces fragments further apart than the default NACK interval.
+  longMessageServiceEx->use_recovery(true, VLCB::LONG_MESSAGE_RECOVERY_WINDOW, 300);
+
+  std::vector<VLCB::VlcbMessage> fragments = makeFragments(3, "abcdefghijklmnopqrstuvwxy", 0);
+  for (int i = 0; i < 3; ++i)
+  {
+    mockTransportService->setNextMessage(fragments[i]);
+  }
+  process(controller);
+
+  // A late fragment is not requested again.
+  addMillis(200);
+  process(controller);
+  assertEquals(0, mockTransportService->sent_messages.size());
+
+  addMillis(100);
+  process(controller);
+  assertEquals(1, mockTransportService->sent_messages.size());
+  assertEquals(VLCB::LONG_MESSAGE_FLAG_NACK, mockTransportService->sent_messages[0].data[7]);
+  assertEquals(3, mockTransportService->sent_messages[0].data[3]);
+}
+
+void testRecoveryWithPlainReceiver()
+{
+  test();
+
+  // A receiver with recovery loses fragment 2 and a plain receiver on the same stream gets all frames.
+  std::string text = "abcdefghijklmnopqrstuvwxy";
+  std::vector<VLCB::VlcbMessage> fragments = makeFragments(3, text, 0);
+  std::vector<VLCB::VlcbMessage> bus;
+
+  VLCB::Controller controllerEx = createControllerEx();
+  longMessageServiceEx->use_recovery(true);
+  for (auto &fragment : fragments)
+  {
+    bus.push_back(fragment);
+    if (fragment.data[2] != 2)
+    {
+      mockTransportService->setNextMessage(fragment);
+      process(controllerEx);
+    }
+    // A NACK goes on the bus after the fragment that caused it.
+    for (auto &msg : mockTransportService->sent_messages)
+    {
+      bus.push_back(msg);
+    }
+    mockTransportService->clearMessages();
+  }
+
+  // The NACK is sent after the last fragment.
+  assertEquals(fragments.size() + 1, bus.size());
+  assertEquals(VLCB::LONG_MESSAGE_FLAG_NACK, bus.back().data[7]);
+  assertEquals(2, bus.back().data[3]);
+
+  VLCB::Controller controller = createController();
+  VLCB::LongMessageService *service = (VLCB::LongMessageService *)controller.getServices()[1];
+  byte buffer[40];
+  service->subscribe(subscribedStreams, sizeof(subscribedStreams), buffer, sizeof(buffer), messageHandler);
+  receivedMessages.clear();
+  for (auto &msg : bus)
+  {
+    mockTransportService->setNextMessage(msg);
+    process(controller);
+  }
+
+  assertEquals(1, receivedMessages.size());
+  assertEquals(VLCB::LONG_MESSAGE_COMPLETE, receivedMessages[0].status);
+  assertEquals(text.c_str(), receivedMessages[0].data.c_str());
+}
+
+void testNoRecoveryForWrappedSequence()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  longMessageServiceEx->allocateContexts(1, 1300, 1);
+  longMessageServiceEx->use_recovery(true);
+
+  // Fragment 256 would have sequence number 0 so the message is received without recovery.
+  std::vector<VLCB::VlcbMessage> fragments = makeFragments(3, std::string(1280, 'a'), 0);
+  mockTransportService->setNextMessage(fragments[0]);
+  mockTransportService->setNextMessage(fragments[1]);
+  mockTransportService->setNextMessage(fragments[3]);
+  process(controller);
+
+  assertEquals(0, mockTransportService->sent_messages.size());
+  assertEquals(1, receivedMessages.size());
+  assertEquals(VLCB::LONG_MESSAGE_SEQUENCE_ERROR, receivedMessages[0].status);
+}
+
+void testRecoveryResendsFragments()
+{
+  test();
+
+  VLCB::Controller controller = createControllerEx();
+  longMessageServiceEx->use_recovery(true);
+  VLCB::send_queue_entry_t queue[1];
+  longMessageServiceEx->setSendQueue(queue, 1);
+  completions.clear();
+
+  std::string text = "abcdefghijklmnopqrstuvwxy";
+  assertEquals(true, longMessageServiceEx->queueLongMessage(text.c_str(), text.size(), 3, completionHandler));
+  for (int i = 0; i < 10; ++i)
+  {
+    addMillis(20);
+    process(controller);
+  }
+
+  // All fragments sent once but the message is kept for resending.
+  assertEquals(6, mockTransportService->sent_messages.size());
+  assertEquals(1, longMessageServiceEx->is_sending());
+  assertEquals(0, completions.size());
+
+  mockTransportService->sent_messages.clear();
+  mockTransportService->setNextMessage({8, {OPC_DTXC, 3, 0, 2, 4, 0, 0, VLCB::LONG_MESSAGE_FLAG_NACK}});
+  process(controller);
+  addMillis(20);
+  process(controller);
+  addMillis(20);
+  process(controller);
+
+  assertEquals(2, mockTransportService->sent_messages.size());
+  assertEquals(2, mockTransportService->sent_messages[0].data[2]);
+  assertEquals('f', mockTransportService->sent_messages[0].data[3]);
+  assertEquals(4, mockTransportService->sent_messages[1].data[2]);
+  assertEquals('p', mockTransportService->sent_messages[1].data[3]);
+  assertEquals(2, longMessageServiceEx->getFragmentsResent());
+
+  // NACKs for other streams are ignored.
+  mockTransportService->setNextMessage({8, {OPC_DTXC, 4, 0, 1, 0, 0, 0, VLCB::LONG_MESSAGE_FLAG_NACK}});
+  process(controller);
+  addMillis(20);
+  process(controller);
+  assertEquals(2, mockTransportService->sent_messages.size());
+
+  // Released once no more fragments are requested.
+  addMillis(VLCB::LONG_MESSAGE_RECOVERY_WINDOW);
+  process(controller);
+  assertEquals(0, longMessageServiceEx->is_sending());
+  assertEquals(1, completions.size());
+  assertEquals(VLCB::LONG_MESSAGE_COMPLETE, completions[0].status);
+}
+
+struct LossyTransfer
+{
+  unsigned int complete;
+  unsigned int framesSent;
+};
+
+// Send messages over a CAN transport that loses frames. The module receives its own
+// frames as if they came from another module, so it is both sender and receiver.
+LossyTransfer runLossyTransfer(bool recovery, unsigned int numMessages)
+{
+  static std::unique_ptr<VLCB::MinimumNodeService> minimumNodeService;
+  minimumNodeService.reset(new VLCB::MinimumNodeService);
+  MockCanTransport canTransport;
+  VLCB::CanService canService(&canTransport);
+  longMessageServiceEx.reset(new VLCB::LongMessageServiceEx);
+  longMessageServiceEx->allocateContexts();
+  longMessageServiceEx->subscribe(subscribedStreams, sizeof(subscribedStreams), messageHandler);
+  longMessageServiceEx->use_crc(true);
+  longMessageServiceEx->use_recovery(recovery);
+  receivedMessages.clear();
+
+  VLCB::Controller controller = ::createController({minimumNodeService.get(), longMessageServiceEx.get(), &canService});
+  controller.begin();
+  canTransport.sentFrameLossPercent = 10;
+
+  std::string text;
+  for (int i = 0; i < 60; ++i)
+  {
+    text += 'A' + i % 26;
+  }
+
+  unsigned int framesSent = 0, started = 0;
+  for (int step = 0; step < 2000 && (started < numMessages || longMessageServiceEx->is_sending()); ++step)
+  {
+    if (started < numMessages && longMessageServiceEx->sendLongMessage(text.c_str(), text.size(), 3))
+    {
+      ++started;
+    }
+    addMillis(20);
+    process(controller);
+
+    for (auto frame : canTransport.sent_frames)
+    {
+      frame.id ^= 0x40;  // Another CANID.
+      canTransport.setNextMessage(frame);
+    }
+    framesSent += canTransport.sent_frames.size();
+    canTransport.sent_frames.clear();
+  }
+  // Let receivers time out.
+  addMillis(VLCB::LONG_MESSAGE_RECEIVE_TIMEOUT);
+  process(controller);
+
+  LossyTransfer result = {0, framesSent + canTransport.lostSentFrames};
+  for (auto &msg : receivedMessages)
+  {
+    if (msg.status == VLCB::LONG_MESSAGE_COMPLETE && msg.data == text)
+    {
+      ++result.complete;
+    }
+  }
+  return result;
+}
+
+// Message bytes delivered per 100 frames on the bus.
+unsigned int goodput(const LossyTransfer &transfer)
+{
+  return transfer.complete * 60 * 100 / transfer.framesSent;
+}
+
+void testRecoveryGoodput()
+{
+  test();
+
+  const unsigned int numMessages = 20;
+  // Header and 12 fragments for each message.
+  const unsigned int minimumFrames = numMessages * 13;
+
+  LossyTransfer plain = runLossyTransfer(false, numMessages);
+  LossyTransfer recovered = runLossyTransfer(true, numMessages);
+
+  // With 10% of frames lost most messages of 13 frames fail.
+  assertEquals(true, plain.complete < numMessages / 2);
+  assertEquals(minimumFrames, plain.framesSent);
+
+  // Only lost headers are not recovered. Lost fragments are resent with little overhead.
+  assertEquals(true, recovered.complete >= numMessages * 8 / 10);
+  assertEquals(true, recovered.framesSent < minimumFrames * 13 / 10);
+  assertEquals(true, goodput(recovered) > 2 * goodput(plain));
 }
 
 void testLongMessageService()
 {
   testServiceDiscovery();
   testServiceDiscoveryEventProdSvc();
+  testCrc16();
+  testSendLongMessageWithCrc();
+  testReceiveLongMessageWithCrc();
+  testReceiveLongMessageWithBadCrc();
+  testFixedPacing();
+  testFixedPacingNoDelay();
+  testAdaptivePacingIdleTransport();
+  testAdaptivePacingBusyTransport();
+  testStreamPacingEx();
+  testPacingBackoffsEx();
+  testQueuedMessages();
+  testSendWithQueue();
+  testQueuedMessagesEx();
+  testStreamingReceive();
+  testStreamingReceiveSequenceError();
+  testStreamingReceiveEx();
+  testStaticArena();
+  testArenaTooSmall();
+  testUrgentStreamFirst();
+  testStreamsWithoutPriority();
+  testWeightedStreams();
+  testCompressedMessage();
+  testIncompressibleMessage();
+  testPlainReceiverIgnoresCompressed();
+  testCorruptCompressedMessage();
+  testRecoveryRequestsMissingFragment();
+  testRecoveryRequestsLostTail();
+  testRecoveryNackInterval();
+  testRecoveryWithPlainReceiver();
+  testNoRecoveryForWrappedSequence();
+  testRecoveryResendsFragments();
+  testRecoveryGoodput();
 }
@@ -0,0 +1,199 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+// Test cases for MdfService.
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "TestTools.hpp"
+#include "ArduinoMock.hpp"
+#include "Controller.h"
+#include "LongMessageService.h"
+#include "LongMessageDispatcher.h"
+#include "MdfService.h"
+#include "Compression.h"
+#include "VlcbCommon.h"
+#include "MockTransportService.h"
+
+namespace
+{
+std::unique_ptr<MockTransportService> mockTransportService;
+std::unique_ptr<VLCB::LongMessageService> longMessageService;
+std::unique_ptr<VLCB::LongMessageDispatcher> dispatcher;
+std::unique_ptr<VLCB::MdfService> mdfService;
+byte buffer[40];
+byte receiveBuffer[8];
+
+const char mdfText[] = "{\"NodeVariables\": [{\"DisplayTitle\": \"Input 1\", \"Type\": \"NodeVariableBitArray\"},"
+                       " {\"DisplayTitle\": \"Input 2\", \"Type\": \"NodeVariableBitArray\"}]}";
+const byte mdf[] PROGMEM = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyzAB";
+
+VLCB::Controller createController(const byte *data, unsigned int len, VLCB::MdfFormat format, VLCB::LongMessageService *service)
+{
+  mockTransportService.reset(new MockTransportService);
+  longMessageService.reset(service);
+  dispatcher.reset(new VLCB::LongMessageDispatcher(*longMessageService, receiveBuffer, sizeof(receiveBuffer)));
+  mdfService.reset(new VLCB::MdfService(*dispatcher, data, len, format, buffer, sizeof(buffer)));
+
+  VLCB::Controller controller = ::createController({longMessageService.get(), mdfService.get(), mockTransportService.get()});
+  controller.begin();
+  return controller;
+}
+
+VLCB::Controller createController()
+{
+  return createController(mdf, sizeof(mdf) - 1, VLCB::MDF_FORMAT_JSON, new VLCB::LongMessageService);
+}
+
+// Long message fragments for a message to the module.
+void sendLongMessage(const std::vector<byte> &message)
+{
+  mockTransportService->setNextMessage({8, {OPC_DTXC, VLCB::MDF_STREAM_ID, 0,
+                                            (byte)(message.size() >> 8), (byte)message.size(), 0, 0, 0}});
+  byte seq = 1;
+  for (size_t i = 0; i < message.size(); i += 5, ++seq)
+  {
+    VLCB::VlcbMessage msg = {8, {OPC_DTXC, VLCB::MDF_STREAM_ID, seq}};
+    for (size_t j = 0; j < 5 && i + j < message.size(); ++j)
+    {
+      msg.data[3 + j] = message[i + j];
+    }
+    mockTransportService->setNextMessage(msg);
+  }
+}
+
+// Process long enough for the module to send the whole MDF and return the long messages sent.
+std::vector<std::vector<byte>> receiveLongMessages(VLCB::Controller &controller)
+{
+  for (int i = 0; i < 200; ++i)
+  {
+    addMillis(20);
+    process(controller);
+  }
+
+  std::vector<std::vector<byte>> messages;
+  unsigned int length = 0;
+  for (auto &msg : mockTransportService->sent_messages)
+  {
+    if (msg.data[0] != OPC_DTXC)
+    {
+      continue;
+    }
+    if (msg.data[2] == 0)
+    {
+      length = (msg.data[3] << 8) + msg.data[4];
+      messages.push_back({});
+      continue;
+    }
+    for (int j = 0; j < 5 && messages.back().size() < length; ++j)
+    {
+      messages.back().push_back(msg.data[3 + j]);
+    }
+  }
+  return messages;
+}
+
+// Join the data of all parts, checking the headers.
+std::vector<byte> joinParts(const std::vector<std::vector<byte>> &messages, unsigned int offset, unsigned int total)
+{
+  std::vector<byte> data;
+  for (auto &message : messages)
+  {
+    assertEquals(true, message.size() >= VLCB::MDF_MESSAGE_HEADER_LEN);
+    assertEquals(VLCB::MDF_CMD_DATA, message[0]);
+    assertEquals(0x01, message[1]);
+    assertEquals(0x04, message[2]);
+    assertEquals(offset + data.size(), (message[4] << 8) + message[5]);
+    assertEquals(total, (message[6] << 8) + message[7]);
+    data.insert(data.end(), message.begin() + VLCB::MDF_MESSAGE_HEADER_LEN, message.end());
+  }
+  return data;
+}
+
+void testReadInParts()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  sendLongMessage({VLCB::MDF_CMD_READ, 0x01, 0x04});
+  process(controller);
+  std::vector<std::vector<byte>> messages = receiveLongMessages(controller);
+
+  // 100 bytes in parts of 32 bytes.
+  assertEquals(4, messages.size());
+  assertEquals(VLCB::MDF_FORMAT_JSON, messages[0][3]);
+  assertEquals(sizeof(buffer), messages[0].size());
+  assertEquals(VLCB::MDF_MESSAGE_HEADER_LEN + 4, messages[3].size());
+  std::vector<byte> data = joinParts(messages, 0, 100);
+  assertEquals(std::string((const char *)mdf).c_str(), std::string(data.begin(), data.end()).c_str());
+  assertEquals(1, mdfService->getRequestCount());
+  assertEquals(4, mdfService->getPartsSent());
+}
+
+void testReadFromOffset()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  sendLongMessage({VLCB::MDF_CMD_READ, 0x01, 0x04, 0, 90});
+  process(controller);
+  std::vector<std::vector<byte>> messages = receiveLongMessages(controller);
+
+  assertEquals(1, messages.size());
+  std::vector<byte> data = joinParts(messages, 90, 100);
+  assertEquals("stuvwxyzAB", std::string(data.begin(), data.end()).c_str());
+}
+
+void testReadOtherNode()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+
+  sendLongMessage({VLCB::MDF_CMD_READ, 0x01, 0x05});
+  process(controller);
+  addMillis(20);
+  process(controller);
+
+  assertEquals(false, mdfService->isSending());
+  assertEquals(0, mockTransportService->sent_messages.size());
+}
+
+void testReadCompressedWithEx()
+{
+  test();
+
+  byte compressed[sizeof(mdfText)];
+  unsigned int compressedLen = VLCB::compress((const byte *)mdfText, sizeof(mdfText) - 1, compressed, sizeof(compressed));
+  assertEquals(true, compressedLen > 0);
+
+  VLCB::LongMessageServiceEx *service = new VLCB::LongMessageServiceEx;
+  service->allocateContexts(1, 8, 1);
+  VLCB::Controller controller = createController(compressed, compressedLen, VLCB::MDF_FORMAT_COMPRESSED_JSON, service);
+
+  sendLongMessage({VLCB::MDF_CMD_READ, 0x01, 0x04});
+  process(controller);
+  std::vector<std::vector<byte>> messages = receiveLongMessages(controller);
+
+  assertEquals(VLCB::MDF_FORMAT_COMPRESSED_JSON, messages[0][3]);
+  std::vector<byte> data = joinParts(messages, 0, compressedLen);
+  assertEquals(compressedLen, data.size());
+  char text[sizeof(mdfText)] = {};
+  assertEquals(sizeof(mdfText) - 1, VLCB::decompress(data.data(), data.size(), (byte *)text, sizeof(text)));
+  assertEquals(mdfText, text);
+}
+
+}
+
+void testMdfService()
+{
+  testReadInParts();
+  testReadFromOffset();
+  testReadOtherNode();
+  testReadCompressedWithEx();
+}
@@ -19,16 +19,19 @@
 // * NNRST - Done
 // * NNRSM - Done
 
+#include <algorithm>
 #include <memory>
 #include "TestTools.hpp"
 #include "ArduinoMock.hpp"
 #include "Controller.h"
 #include "MinimumNodeServiceWithDiagnostics.h"
+#include "InternalDiagnosticsService.h"
 #include "LongMessageService.h"
 #include "EventConsumerService.h"
 #include "EventProducerService.h"
 #include "VlcbCommon.h"
 #include "MockTransportService.h"
+#include "SimulatedClock.h"
 
 namespace
 {
@@ -508,6 +511,32 @@ void testHeartBeat()
   assertEquals(OPC_HEARTB, mockTransportService->sent_messages[0].data[0]);
 }
 
+void testHeartBeatWithSimulatedClock()
+{
+  test();
+
+  VLCB::Controller controller = createController();
+  VLCB::SimulatedClock clock;
+  controller.setClock(&clock);
+  minimumNodeService->setHeartBeat(true);
+
+  // The Arduino clock does not affect the heartbeat.
+  addMillis(10000);
+  process(controller);
+  assertEquals(0, mockTransportService->sent_messages.size());
+
+  clock.advanceMillis(4500);
+  process(controller);
+  assertEquals(0, mockTransportService->sent_messages.size());
+
+  // Skip ahead a minute. Only one heartbeat is sent.
+  clock.advanceMillis(60000);
+  process(controller);
+  process(controller);
+  assertEquals(1, mockTransportService->sent_messages.size());
+  assertEquals(OPC_HEARTB, mockTransportService->sent_messages[0].data[0]);
+}
+
 void testServiceDiscovery()
 {
   test();
@@ -915,6 +944,67 @@ void testRequestMnsDiagnosticsMessagesActedOn()
   assertEquals(3, mockTransportService->sent_messages[0].data[6]);
 }
 
+void testServiceDiscoveryTaskPoolFull()
+{
+  test();
+
+  minimumNodeService.reset(new VLCB::MinimumNodeServiceWithDiagnostics);
+  mockTransportService.reset(new MockTransportService);
+  static std::unique_ptr<VLCB::InternalDiagnosticsService> internalDiagnosticsService;
+  internalDiagnosticsService.reset(new VLCB::InternalDiagnosticsService);
+
+  VLCB::Controller controller = ::createController({minimumNodeService.get(), internalDiagnosticsService.get(),
+       mockTransportService.get()});
+  controller.begin();
+  minimumNodeService->setHeartBeat(false);
+  const byte serviceIndexInternal = 2;
+
+  // Each request needs a timed response task. One more than there are task slots.
+  VLCB::VlcbMessage msg_rqsd = {4, {OPC_RQSD, 0x01, 0x04, 0}};
+  for (int i = 0 ; i <= VLCB::TIMED_RESPONSE_POOL_SIZE ; ++i)
+  {
+    mockTransportService->setNextMessage(msg_rqsd);
+    process(controller);
+  }
+
+  // The last request is deferred until a task slot is free.
+  // The service count response has service index 0.
+  auto countServiceCounts = [&]() {
+    return std::count_if(mockTransportService->sent_messages.begin(), mockTransportService->sent_messages.end(),
+                         [](const VLCB::VlcbMessage & msg) { return msg.data[0] == OPC_SD && msg.data[3] == 0; });
+  };
+  assertEquals(VLCB::TIMED_RESPONSE_POOL_SIZE, countServiceCounts());
+  assertEquals(1, controller.getDeferredRequests().bufUse());
+
+  processWithTasks(controller);
+  assertEquals(VLCB::TIMED_RESPONSE_POOL_SIZE + 1, countServiceCounts());
+  assertEquals(false, controller.getDeferredRequests().available());
+  mockTransportService->clearMessages();
+
+  // Read the task pool high water mark.
+  VLCB::VlcbMessage msg_rdgn = {5, {OPC_RDGN, 0x01, 0x04, serviceIndexInternal, 5}};
+  mockTransportService->setNextMessage(msg_rdgn);
+  process(controller);
+
+  // Read the number of task allocation failures.
+  msg_rdgn.data[4] = 6;
+  mockTransportService->setNextMessage(msg_rdgn);
+  process(controller);
+
+  assertEquals(2, mockTransportService->sent_messages.size());
+  assertEquals(OPC_DGN, mockTransportService->sent_messages[0].data[0]);
+  assertEquals(serviceIndexInternal, mockTransportService->sent_messages[0].data[3]);
+  assertEquals(5, mockTransportService->sent_messages[0].data[4]);
+  assertEquals(0, mockTransportService->sent_messages[0].data[5]);
+  assertEquals(VLCB::TIMED_RESPONSE_POOL_SIZE, mockTransportService->sent_messages[0].data[6]);
+
+  assertEquals(OPC_DGN, mockTransportService->sent_messages[1].data[0]);
+  assertEquals(serviceIndexInternal, mockTransportService->sent_messages[1].data[3]);
+  assertEquals(6, mockTransportService->sent_messages[1].data[4]);
+  assertEquals(0, mockTransportService->sent_messages[1].data[5]);
+  assertEquals(1, mockTransportService->sent_messages[1].data[6]);
+}
+
 void testModeSetupFromUninitializedToNormal()
 {
   test();
@@ -1136,6 +1226,7 @@ void testMinimumNodeService()
   testModuleNameLearn();
   testModuleNameNormal();
   testHeartBeat();
+  testHeartBeatWithSimulatedClock();
   testServiceDiscovery();
   testServiceDiscoveryLongMessageSvc();
   testServiceDiscoveryIndexOutOfBand();
@@ -1150,6 +1241,7 @@ void testMinimumNodeService()
   testRequestMnsDiagnosticsUptime();
   testRequestMnsDiagnosticsNodeNumberChanges();
   testRequestMnsDiagnosticsMessagesActedOn();
+  testServiceDiscoveryTaskPoolFull();
   testModeSetupFromUninitializedToNormal();
   testModeSetupFromNormalToNormal();
   testModeSetupToUnininitialized();
@@ -0,0 +1,270 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#include <deque>
+#include <string>
+#include "TestTools.hpp"
+#include "ArduinoMock.hpp"
+#include "SerialGC.h"
+
+namespace
+{
+
+class MockStream : public Stream
+{
+public:
+  int available() override { return input.size(); }
+  char read() override
+  {
+    char c = input.front();
+    input.pop_front();
+    return c;
+  }
+  int availableForWrite() override { return writeRoom; }
+  size_t write(const char * s, size_t size) override
+  {
+    output.append(s, size);
+    writeRoom -= size;
+    return size;
+  }
+  void print(const char * s) override { output += s; }
+
+  void addInput(const char * s) { input.insert(input.end(), s, s + strlen(s)); }
+
+  std::deque<char> input;
+  std::string output;
+  int writeRoom = 64;
+};
+
+VLCB::CANFrame makeFrame(uint32_t id, byte data0)
+{
+  VLCB::CANFrame frame;
+  frame.id = id;
+  frame.ext = false;
+  frame.rtr = false;
+  frame.len = 2;
+  frame.data[0] = data0;
+  frame.data[1] = 0x01;
+  return frame;
+}
+
+void testReadOneFrame()
+{
+  test();
+
+  MockStream stream;
+  VLCB::SerialGC serialGC(stream);
+  serialGC.begin();
+
+  stream.addInput(":S0060N9101;");
+
+  assertEquals(true, serialGC.available());
+  VLCB::CANFrame frame = serialGC.getNextCanFrame();
+  assertEquals(3, frame.id);
+  assertEquals(2, frame.len);
+  assertEquals(0x91, frame.data[0]);
+  assertEquals(0x01, frame.data[1]);
+  assertEquals(false, serialGC.available());
+  assertEquals(1, serialGC.receiveCounter());
+}
+
+void testReadSeveralFramesInOneCall()
+{
+  test();
+
+  MockStream stream;
+  VLCB::SerialGC serialGC(stream);
+  serialGC.begin();
+
+  stream.addInput(":S0060N9101;:S0080N9102;\r\n:S00A0N9103;");
+
+  assertEquals(true, serialGC.available());
+  assertEquals(0, stream.input.size());
+  assertEquals(3, serialGC.receiveBufferUsage());
+  assertEquals(3, serialGC.receiveBufferPeak());
+
+  assertEquals(3, serialGC.getNextCanFrame().id);
+  assertEquals(4, serialGC.getNextCanFrame().id);
+  assertEquals(5, serialGC.getNextCanFrame().id);
+  assertEquals(0, serialGC.receiveBufferUsage());
+  assertEquals(3, serialGC.receiveBufferPeak());
+  assertEquals(false, serialGC.available());
+}
+
+void testFrameSplitOverCalls()
+{
+  test();
+
+  MockStream stream;
+  VLCB::SerialGC serialGC(stream);
+  serialGC.begin();
+
+  stream.addInput(":S0060N9");
+  assertEquals(false, serialGC.available());
+  stream.addInput("101;");
+  assertEquals(true, serialGC.available());
+  assertEquals(3, serialGC.getNextCanFrame().id);
+}
+
+void testFullQueueLeavesInput()
+{
+  test();
+
+  MockStream stream;
+  VLCB::SerialGC serialGC(stream);
+  serialGC.begin();
+
+  for (int i = 0; i < VLCB::RX_FRAME_QUEUE_SIZE + 1; ++i)
+  {
+    stream.addInput(":S0060N9101;");
+  }
+
+  assertEquals(true, serialGC.available());
+  assertEquals(VLCB::RX_FRAME_QUEUE_SIZE, serialGC.receiveBufferUsage());
+  assertEquals(strlen(":S0060N9101;"), stream.input.size());
+
+  serialGC.getNextCanFrame();
+  serialGC.available();
+  assertEquals(0, stream.input.size());
+  assertEquals(VLCB::RX_FRAME_QUEUE_SIZE, serialGC.receiveBufferUsage());
+}
+
+void testBadFrameCountsError()
+{
+  test();
+
+  MockStream stream;
+  VLCB::SerialGC serialGC(stream);
+  serialGC.begin();
+
+  stream.addInput(":Q0060N9101;:S0060N9101;");
+
+  assertEquals(true, serialGC.available());
+  assertEquals(1, serialGC.receiveBufferUsage());
+  assertEquals(2, serialGC.receiveCounter());
+  assertEquals(1, serialGC.receiveErrorCounter());
+}
+
+void testTwoInstances()
+{
+  test();
+
+  MockStream stream1;
+  VLCB::SerialGC serialGC1(stream1);
+  MockStream stream2;
+  VLCB::SerialGC serialGC2(stream2);
+
+  // Interleave partial frames on the two instances.
+  stream1.addInput(":S0060N");
+  assertEquals(false, serialGC1.available());
+  stream2.addInput(":S0080N91");
+  assertEquals(false, serialGC2.available());
+  stream1.addInput("9101;");
+  stream2.addInput("02;");
+
+  assertEquals(true, serialGC1.available());
+  assertEquals(true, serialGC2.available());
+  VLCB::CANFrame frame1 = serialGC1.getNextCanFrame();
+  VLCB::CANFrame frame2 = serialGC2.getNextCanFrame();
+  assertEquals(3, frame1.id);
+  assertEquals(0x01, frame1.data[1]);
+  assertEquals(4, frame2.id);
+  assertEquals(0x02, frame2.data[1]);
+}
+
+void testSendFrame()
+{
+  test();
+
+  MockStream stream;
+  VLCB::SerialGC serialGC(stream);
+  serialGC.begin();
+
+  VLCB::CANFrame frame = makeFrame(3, 0x91);
+  assertEquals(true, serialGC.sendCanFrame(&frame));
+
+  assertEquals(":S0060N9101;", stream.output.c_str());
+  assertEquals(0, serialGC.transmitBufferUsage());
+  assertEquals(1, serialGC.transmitCounter());
+}
+
+void testSendDoesNotBlock()
+{
+  test();
+
+  MockStream stream;
+  VLCB::SerialGC serialGC(stream);
+  serialGC.begin();
+  stream.writeRoom = 0;
+
+  for (int i = 0; i < VLCB::TX_FRAME_QUEUE_SIZE; ++i)
+  {
+    VLCB::CANFrame frame = makeFrame(3 + i, 0x91);
+    assertEquals(true, serialGC.sendCanFrame(&frame));
+  }
+  VLCB::CANFrame frame = makeFrame(7, 0x91);
+  assertEquals(false, serialGC.sendCanFrame(&frame));
+
+  assertEquals("", stream.output.c_str());
+  assertEquals(VLCB::TX_FRAME_QUEUE_SIZE, serialGC.transmitBufferUsage());
+  assertEquals(VLCB::TX_FRAME_QUEUE_SIZE, serialGC.transmitBufferPeak());
+  assertEquals(VLCB::TX_FRAME_QUEUE_SIZE, serialGC.transmitCounter());
+
+  // Serial port has room for part of a frame.
+  stream.writeRoom = 8;
+  serialGC.available();
+  assertEquals(":S0060N9", stream.output.c_str());
+  assertEquals(VLCB::TX_FRAME_QUEUE_SIZE, serialGC.transmitBufferUsage());
+
+  // Serial port has room for the rest.
+  stream.writeRoom = 100;
+  serialGC.available();
+  assertEquals(":S0060N9101;:S0080N9101;:S00A0N9101;:S00C0N9101;", stream.output.c_str());
+  assertEquals(0, serialGC.transmitBufferUsage());
+  assertEquals(VLCB::TX_FRAME_QUEUE_SIZE, serialGC.transmitBufferPeak());
+}
+
+
+void testSendWithoutAvailableForWrite()
+{
+  test();
+
+  MockStream stream;
+  VLCB::SerialGC serialGC(stream);
+  serialGC.begin();
+  stream.writeRoom = 0;
+
+  VLCB::CANFrame frame = makeFrame(3, 0x91);
+  assertEquals(true, serialGC.sendCanFrame(&frame));
+  frame = makeFrame(4, 0x91);
+  assertEquals(true, serialGC.sendCanFrame(&frame));
+  assertEquals("", stream.output.c_str());
+
+  // Serial port never reports room. One frame is written per call after the timeout.
+  addMillis(VLCB::TX_STALL_TIMEOUT);
+  stream.writeRoom = 0;
+  serialGC.available();
+  assertEquals(":S0060N9101;", stream.output.c_str());
+  assertEquals(1, serialGC.transmitBufferUsage());
+
+  stream.writeRoom = 0;
+  serialGC.available();
+  assertEquals(":S0060N9101;:S0080N9101;", stream.output.c_str());
+  assertEquals(0, serialGC.transmitBufferUsage());
+}
+}
+
+void testSerialGC()
+{
+  testReadOneFrame();
+  testReadSeveralFramesInOneCall();
+  testFrameSplitOverCalls();
+  testFullQueueLeavesInput();
+  testBadFrameCountsError();
+  testTwoInstances();
+  testSendFrame();
+  testSendDoesNotBlock();
+  testSendWithoutAvailableForWrite();
+}
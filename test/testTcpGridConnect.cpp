@@ -0,0 +1,186 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#include <string>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "TestTools.hpp"
+#include "TcpGridConnect.h"
+
+namespace
+{
+
+// A GridConnect client such as JMRI.
+class Client
+{
+public:
+  explicit Client(uint16_t port)
+  {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    connect(fd, (sockaddr *)&address, sizeof(address));
+  }
+  ~Client() { close(fd); }
+
+  void send(const char * text) { ::send(fd, text, strlen(text), 0); }
+
+  // Read what has arrived, while letting the transport run.
+  std::string receive(VLCB::TcpGridConnect & transport, size_t expectedLength)
+  {
+    std::string result;
+    for (int i = 0; i < 1000 && result.size() < expectedLength; ++i)
+    {
+      transport.available();
+      char buffer[256];
+      ssize_t count = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (count > 0)
+      {
+        result.append(buffer, count);
+      }
+      else
+      {
+        usleep(1000);
+      }
+    }
+    return result;
+  }
+
+  int fd;
+};
+
+bool waitFor(VLCB::TcpGridConnect & transport, unsigned int clients, unsigned int frames)
+{
+  for (int i = 0; i < 1000; ++i)
+  {
+    transport.available();
+    if (transport.getClientCount() == clients && transport.receiveBufferUsage() >= frames)
+    {
+      return true;
+    }
+    usleep(1000);
+  }
+  return false;
+}
+
+VLCB::CANFrame makeFrame(uint32_t id)
+{
+  VLCB::CANFrame frame;
+  frame.id = id;
+  frame.ext = false;
+  frame.rtr = false;
+  frame.len = 2;
+  frame.data[0] = 0x91;
+  frame.data[1] = 0x01;
+  return frame;
+}
+
+void testReceiveFrames()
+{
+  test();
+
+  VLCB::TcpGridConnect transport(0);
+  assertEquals(true, transport.begin());
+
+  Client client(transport.getPort());
+  // Two frames, the second split over two sends and in lower case.
+  client.send(":S0060N9101;\r\n:s0080n91");
+  client.send("02;\r\n");
+
+  assertEquals(true, waitFor(transport, 1, 2));
+  assertEquals(2, transport.receiveBufferUsage());
+  VLCB::CANFrame frame = transport.getNextCanFrame();
+  assertEquals(3, frame.id);
+  assertEquals(0x01, frame.data[1]);
+  frame = transport.getNextCanFrame();
+  assertEquals(4, frame.id);
+  assertEquals(0x02, frame.data[1]);
+  assertEquals(2, transport.receiveCounter());
+  assertEquals(0, transport.receiveErrorCounter());
+}
+
+void testSendToAllClients()
+{
+  test();
+
+  VLCB::TcpGridConnect transport(0);
+  assertEquals(true, transport.begin());
+
+  Client client1(transport.getPort());
+  Client client2(transport.getPort());
+  assertEquals(true, waitFor(transport, 2, 0));
+
+  VLCB::CANFrame frame = makeFrame(3);
+  assertEquals(true, transport.sendCanFrame(&frame));
+
+  assertEquals(":S0060N9101;", client1.receive(transport, 12).c_str());
+  assertEquals(":S0060N9101;", client2.receive(transport, 12).c_str());
+  assertEquals(1, transport.transmitCounter());
+}
+
+void testForwardBetweenClients()
+{
+  test();
+
+  VLCB::TcpGridConnect transport(0);
+  assertEquals(true, transport.begin());
+
+  Client client1(transport.getPort());
+  Client client2(transport.getPort());
+  assertEquals(true, waitFor(transport, 2, 0));
+
+  client1.send(":S0060N9101;");
+
+  assertEquals(":S0060N9101;", client2.receive(transport, 12).c_str());
+  assertEquals(1, transport.receiveBufferUsage());
+  assertEquals(3, transport.getNextCanFrame().id);
+}
+
+void testBadFrameCountsError()
+{
+  test();
+
+  VLCB::TcpGridConnect transport(0);
+  assertEquals(true, transport.begin());
+
+  Client client(transport.getPort());
+  client.send(":Q0060N9101;:S0060N9101;");
+
+  assertEquals(true, waitFor(transport, 1, 1));
+  assertEquals(2, transport.receiveCounter());
+  assertEquals(1, transport.receiveErrorCounter());
+}
+
+void testClientDisconnects()
+{
+  test();
+
+  VLCB::TcpGridConnect transport(0);
+  assertEquals(true, transport.begin());
+
+  {
+    Client client(transport.getPort());
+    assertEquals(true, waitFor(transport, 1, 0));
+  }
+
+  assertEquals(true, waitFor(transport, 0, 0));
+  VLCB::CANFrame frame = makeFrame(3);
+  assertEquals(true, transport.sendCanFrame(&frame));
+}
+
+}
+
+void testTcpGridConnect()
+{
+  testReceiveFrames();
+  testSendToAllClients();
+  testForwardBetweenClients();
+  testBadFrameCountsError();
+  testClientDisconnects();
+}
@@ -43,7 +43,7 @@ void testCreateTimedResponse()
     }
   };
   
-  controller.addTimedResponseTask(new TestResponder(callCount, deleted));
+  controller.addTimedResponseTask<TestResponder>(callCount, deleted);
   
   // Ensure there is a timed response task.
   assertEquals(true, controller.pendingTasks());
@@ -83,7 +83,7 @@ void testTimeResponseCalledAtInterval()
     }
   };
   
-  controller.addTimedResponseTask(new TestResponder(callCount));
+  controller.addTimedResponseTask<TestResponder>(callCount);
   
   addMillis(5);
   process(controller);
@@ -103,10 +103,57 @@ void testTimeResponseCalledAtInterval()
   assertEquals(4, callCount);
 }
 
+void testTaskPoolExhausted()
+{
+  test();
+
+  VLCB::Controller controller = createController({});
+
+  int callCount = 0;
+  class TestResponder : public VLCB::TimedResponse::Task
+  {
+  public:
+    int & callCount;
+    TestResponder(int &callCount)
+    : callCount(callCount)
+    {}
+
+    VLCB::TimedResponse::Result runStep()
+    {
+      ++callCount;
+      return VLCB::TimedResponse::Result::FINISHED;
+    }
+  };
+
+  for (int i = 0 ; i < VLCB::TIMED_RESPONSE_POOL_SIZE ; ++i)
+  {
+    assertEquals(true, controller.addTimedResponseTask<TestResponder>(callCount));
+  }
+  // The pool is full now.
+  assertEquals(false, controller.addTimedResponseTask<TestResponder>(callCount));
+
+  const VLCB::TimedResponse & timedResponses = controller.getTimedResponses();
+  assertEquals(VLCB::TIMED_RESPONSE_POOL_SIZE, timedResponses.getPoolUsage());
+  assertEquals(VLCB::TIMED_RESPONSE_POOL_SIZE, timedResponses.getPoolHighWaterMark());
+  assertEquals(1, timedResponses.getAllocationFailures());
+
+  processWithTasks(controller);
+
+  // Only the tasks that fitted in the pool were run and their slots are released.
+  assertEquals(VLCB::TIMED_RESPONSE_POOL_SIZE, callCount);
+  assertEquals(0, timedResponses.getPoolUsage());
+  assertEquals(VLCB::TIMED_RESPONSE_POOL_SIZE, timedResponses.getPoolHighWaterMark());
+
+  // Released slots can be reused.
+  assertEquals(true, controller.addTimedResponseTask<TestResponder>(callCount));
+  assertEquals(1, timedResponses.getPoolUsage());
+}
+
 }
 
 void testTimedResponse()
 {
   testCreateTimedResponse();
   testTimeResponseCalledAtInterval();
+  testTaskPoolExhausted();
 }
\ No newline at end of file
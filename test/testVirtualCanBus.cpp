@@ -0,0 +1,172 @@
+//  Copyright (C) Sven Rosvall (sven@rosvall.ie)
+//  This file is part of VLCB-Arduino project on https://github.com/SvenRosvall/VLCB-Arduino
+//  Licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//  The full licence can be found at: http://creativecommons.org/licenses/by-nc-sa/4.0
+
+#include <set>
+#include <vector>
+#include "TestTools.hpp"
+#include "ArduinoMock.hpp"
+#include "VirtualCanBus.h"
+
+namespace
+{
+
+VLCB::CANFrame makeFrame(uint32_t id, byte len)
+{
+  VLCB::CANFrame frame = {};
+  frame.id = id;
+  frame.len = len;
+  return frame;
+}
+
+void testFrameTiming()
+{
+  test();
+
+  VirtualCanBus bus(125000);
+
+  // 44 bits + 3 inter frame space + 8 stuff bits.
+  assertEquals(55, VirtualCanBus::frameBits(makeFrame(0x5FF, 0)));
+  // 108 bits + 3 inter frame space + 24 stuff bits.
+  assertEquals(135, VirtualCanBus::frameBits(makeFrame(0x5FF, 8)));
+  // 8us per bit at 125kbit/s.
+  assertEquals(55 * 8, bus.frameTime(makeFrame(0x5FF, 0)));
+  assertEquals(135 * 8, bus.frameTime(makeFrame(0x5FF, 8)));
+}
+
+void testArbitration()
+{
+  test();
+
+  VirtualCanBus bus(125000);
+  VirtualCanTransport low(bus);
+  VirtualCanTransport high(bus);
+  VirtualCanTransport listener(bus, 10);
+
+  std::vector<BusFrame> frames;
+  bus.setFrameObserver([&](const BusFrame & frame) { frames.push_back(frame); });
+
+  VLCB::CANFrame frame = makeFrame((VLCB::CAN_PRIORITY_LOW << 7) + 1, 5);
+  low.sendCanFrame(&frame);
+  frame = makeFrame((VLCB::CAN_PRIORITY_ABOVE << 7) + 2, 5);
+  high.sendCanFrame(&frame);
+
+  assertEquals(true, bus.runUntilIdle(10000));
+
+  assertEquals(2, frames.size());
+  // Higher priority wins even if queued at the same time.
+  assertEquals(&high, frames[0].sender);
+  assertEquals(&low, frames[1].sender);
+  assertEquals(frames[0].completedAt, frames[1].startedAt);
+  assertEquals(bus.frameTime(frame), frames[0].completedAt - frames[0].startedAt);
+  assertEquals(1, low.getArbitrationLosses());
+  assertEquals(0, high.getArbitrationLosses());
+  assertEquals(2, listener.receiveBufferUsage());
+  // Senders do not receive their own frames.
+  assertEquals(1, low.receiveBufferUsage());
+  assertEquals(1, high.receiveBufferUsage());
+}
+
+void testReceiveOverrun()
+{
+  test();
+
+  VirtualCanBus bus(125000);
+  VirtualCanTransport sender(bus, 2, 10);
+  VirtualCanTransport slowReader(bus, 2);
+
+  for (int i = 0; i < 5; ++i)
+  {
+    VLCB::CANFrame frame = makeFrame(0x500 + i, 2);
+    sender.sendCanFrame(&frame);
+  }
+  assertEquals(true, bus.runUntilIdle(100000));
+
+  assertEquals(2, slowReader.receiveBufferUsage());
+  assertEquals(3, slowReader.receiveErrorCounter());
+}
+
+void testEventLatencyOnBusyBus()
+{
+  test();
+
+  const int NODES = 100;
+  VirtualCanBus bus(125000);
+  VirtualCanTransport listener(bus, NODES);
+  for (int i = 0; i < NODES; ++i)
+  {
+    bus.addNode(256 + i, i + 1);
+  }
+
+  unsigned long maxLatency = 0;
+  std::vector<byte> senderOrder;
+  bus.setFrameObserver([&](const BusFrame & frame)
+  {
+    maxLatency = std::max(maxLatency, frame.completedAt - frame.queuedAt);
+    senderOrder.push_back(frame.frame.id & 0x7F);
+  });
+
+  // All nodes send an event at the same time.
+  for (int i = 0; i < NODES; ++i)
+  {
+    bus.getNode(i).controller.sendMessageWithNN(OPC_ACON, 0, 1);
+  }
+  assertEquals(true, bus.runUntilIdle(1000000));
+
+  assertEquals(NODES, bus.getFramesTransmitted());
+  assertEquals(NODES, listener.receiveBufferUsage());
+  assertEquals(0, bus.getIdCollisions());
+  // Nodes with lower CANID win arbitration.
+  for (int i = 0; i < NODES; ++i)
+  {
+    assertEquals(i + 1, senderOrder[i]);
+  }
+  // The last event waits for all the others.
+  unsigned long frameTime = bus.frameTime(makeFrame(0x501, 5));
+  assertEquals(true, maxLatency >= NODES * frameTime);
+  assertEquals(true, maxLatency < (NODES + 1) * frameTime);
+  for (int i = 0; i < NODES; ++i)
+  {
+    assertEquals(0, bus.getNode(i).transport.receiveErrorCounter());
+  }
+}
+
+void testCanIdEnumerationConverges()
+{
+  test();
+
+  const int NODES = 20;
+  VirtualCanBus bus(125000);
+  // All nodes start with the same CANID.
+  for (int i = 0; i < NODES; ++i)
+  {
+    bus.addNode(256 + i, 1);
+  }
+
+  // Each node in turn sends an event. Nodes with the same CANID detect the clash and enumerate.
+  for (int i = 0; i < NODES; ++i)
+  {
+    bus.getNode(i).controller.sendMessageWithNN(OPC_ACON, 0, 1);
+    bus.run(150000);
+  }
+
+  std::set<byte> canIds;
+  for (int i = 0; i < NODES; ++i)
+  {
+    canIds.insert(bus.getNode(i).configuration.CANID);
+  }
+  assertEquals(NODES, canIds.size());
+  assertEquals(0, canIds.count(0));
+}
+
+}
+
+void testVirtualCanBus()
+{
+  testFrameTiming();
+  testArbitration();
+  testReceiveOverrun();
+  testEventLatencyOnBusyBus();
+  testCanIdEnumerationConverges();
+}